@@ -0,0 +1,615 @@
+/*
+ * Asynchronous Block Pipeline
+ *
+ * Description:
+ * aio_run() cycles AIO_DEPTH block slots through read, transform and write.
+ * A slot's reads are queued as soon as its block is planned; when they have
+ * completed and every earlier block has been transformed, the block is
+ * transformed on the calling thread and its write is queued; when the write
+ * completes, the slot takes the next block. The calling thread therefore only
+ * ever transforms or waits, while the queue keeps the disk busy.
+ *
+ * The queue is an io_uring instance driven through the raw system calls (no
+ * liburing), with the slot buffers registered as fixed buffers when the
+ * locked-memory limit allows it. Kernels without io_uring, or with it
+ * disabled, get a queue served by AIO_THREADS plain I/O threads instead.
+ * Short transfers are queued again for the rest, on either backend.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "aio.h"
+
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+
+/* I/O threads of the fallback queue */
+#define AIO_THREADS 2
+
+/* Transfers in flight at most: every slot's reads and its write */
+#define AIO_MAX_REQUESTS (AIO_DEPTH * (AIO_MAX_READS + 1))
+
+/* Slot states */
+enum
+{
+    SLOT_FREE,
+    SLOT_READING,
+    SLOT_READY,
+    SLOT_WRITING
+};
+
+/* One queued transfer */
+typedef struct AioRequest
+{
+    AioBlock *block;
+    const AioRange *range;
+    int write;
+    int buf_index;              // Registered buffer of the range (io_uring)
+    size_t done;                // Bytes transferred so far
+    ssize_t result;             // Bytes transferred by the last attempt, or -errno
+    struct AioRequest *next;    // FIFO link (thread queue)
+} AioRequest;
+
+#ifdef __NR_io_uring_setup
+/* Mapped rings of an io_uring instance */
+typedef struct
+{
+    int fd;
+    int fixed;                  // Slot buffers are registered
+    unsigned to_submit;         // Entries queued but not yet submitted
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+} Uring;
+#endif
+
+/* Request FIFOs of the thread queue */
+typedef struct
+{
+    pthread_t threads[AIO_THREADS];
+    int num_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // Signalled when a request is queued or on shutdown
+    pthread_cond_t done;        // Signalled when a request completes
+    AioRequest *queued, **queued_tail;
+    AioRequest *completed, **completed_tail;
+    int stop;
+} ThreadQueue;
+
+/* A transfer queue: io_uring or the thread queue */
+typedef struct AioQueue
+{
+    Status (*submit)(struct AioQueue *queue, AioRequest *request);
+    AioRequest *(*wait)(struct AioQueue *queue);
+    void (*close)(struct AioQueue *queue);
+#ifdef __NR_io_uring_setup
+    Uring ring;
+#endif
+    ThreadQueue pool;
+} AioQueue;
+
+/* Buffer address of the untransferred rest of a request */
+static unsigned char *request_buffer(const AioRequest *request)
+{
+    return request->block->buffers[request->range->buffer] + request->done;
+}
+
+#ifdef __NR_io_uring_setup
+
+static int uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Unmap the rings and close the instance */
+static void uring_close(AioQueue *queue)
+{
+    Uring *ring = &queue->ring;
+
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+/* Queue a transfer; it is submitted with the next wait */
+static Status uring_submit(AioQueue *queue, AioRequest *request)
+{
+    Uring *ring = &queue->ring;
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    if (ring->fixed)
+    {
+        sqe->opcode = request->write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = request->buf_index;
+    }
+    else
+    {
+        sqe->opcode = request->write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = request->range->fd;
+    sqe->off = request->range->offset + request->done;
+    sqe->addr = (uintptr_t)request_buffer(request);
+    sqe->len = request->range->len - request->done;
+    sqe->user_data = (uintptr_t)request;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    return e_success;
+}
+
+/* Submit the queued transfers and wait for one to complete */
+static AioRequest *uring_wait(AioQueue *queue)
+{
+    Uring *ring = &queue->ring;
+
+    for (;;)
+    {
+        unsigned head = *ring->cq_head;
+        int ready = head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        /* Queued transfers go out before anything is reaped, so the disk never waits on the transform */
+        int submitted = 0;
+        if (ring->to_submit > 0 || !ready)
+            submitted = uring_enter(ring->fd, ring->to_submit, ready ? 0 : 1, IORING_ENTER_GETEVENTS);
+        if (submitted > 0)
+            ring->to_submit -= submitted;
+        else if (submitted < 0 && !ready && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return NULL;
+
+        if (ready)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            AioRequest *request = (AioRequest *)(uintptr_t)cqe->user_data;
+
+            request->result = cqe->res;
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            return request;
+        }
+    }
+}
+
+/* Set up an io_uring instance and register the slot buffers with it */
+static Status uring_open(AioQueue *queue, AioBlock *slots, const size_t *buffer_sizes, int num_buffers)
+{
+    Uring *ring = &queue->ring;
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->fd = uring_setup(AIO_MAX_REQUESTS, &params);
+    if (ring->fd < 0)
+        return e_failure;
+
+    /* Plain READ/WRITE requests came with the current-position feature (Linux 5.6) */
+    if (!(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+        close(ring->fd);
+        return e_failure;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+    {
+        uring_close(queue);
+        return e_failure;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ring = ring->sq_ring;
+    else
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        uring_close(queue);
+        return e_failure;
+    }
+
+    unsigned char *sq = ring->sq_ring;
+    unsigned char *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    /* Fixed buffers spare every transfer the page pinning; past the locked-memory limit plain requests do */
+    struct iovec iov[AIO_DEPTH * AIO_MAX_BUFFERS];
+    for (int slot = 0; slot < AIO_DEPTH; slot++)
+    {
+        for (int i = 0; i < num_buffers; i++)
+        {
+            iov[slot * num_buffers + i].iov_base = slots[slot].buffers[i];
+            iov[slot * num_buffers + i].iov_len = buffer_sizes[i];
+        }
+    }
+    ring->fixed = uring_register(ring->fd, IORING_REGISTER_BUFFERS, iov, AIO_DEPTH * num_buffers) == 0;
+
+    queue->submit = uring_submit;
+    queue->wait = uring_wait;
+    queue->close = uring_close;
+    return e_success;
+}
+
+#endif
+
+/* Thread queue worker: transfer queued requests until shutdown */
+static void *pool_main(void *arg)
+{
+    ThreadQueue *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (pool->queued == NULL && !pool->stop)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->queued == NULL)
+            break;
+
+        AioRequest *request = pool->queued;
+        pool->queued = request->next;
+        if (pool->queued == NULL)
+            pool->queued_tail = &pool->queued;
+        pthread_mutex_unlock(&pool->lock);
+
+        const AioRange *range = request->range;
+        ssize_t got;
+        do
+        {
+            if (request->write)
+                got = pwrite(range->fd, request_buffer(request), range->len - request->done, range->offset + request->done);
+            else
+                got = pread(range->fd, request_buffer(request), range->len - request->done, range->offset + request->done);
+        } while (got < 0 && errno == EINTR);
+        request->result = got < 0 ? -errno : got;
+
+        pthread_mutex_lock(&pool->lock);
+        request->next = NULL;
+        *pool->completed_tail = request;
+        pool->completed_tail = &request->next;
+        pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Hand a transfer to the I/O threads */
+static Status pool_submit(AioQueue *queue, AioRequest *request)
+{
+    ThreadQueue *pool = &queue->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    request->next = NULL;
+    *pool->queued_tail = request;
+    pool->queued_tail = &request->next;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    return e_success;
+}
+
+/* Wait for a transfer to complete on the I/O threads */
+static AioRequest *pool_wait(AioQueue *queue)
+{
+    ThreadQueue *pool = &queue->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->completed == NULL)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    AioRequest *request = pool->completed;
+    pool->completed = request->next;
+    if (pool->completed == NULL)
+        pool->completed_tail = &pool->completed;
+    pthread_mutex_unlock(&pool->lock);
+    return request;
+}
+
+/* Stop and join the I/O threads */
+static void pool_close(AioQueue *queue)
+{
+    ThreadQueue *pool = &queue->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->num_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+/* Start the I/O threads */
+static Status pool_open(AioQueue *queue)
+{
+    ThreadQueue *pool = &queue->pool;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->queued_tail = &pool->queued;
+    pool->completed_tail = &pool->completed;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    queue->submit = pool_submit;
+    queue->wait = pool_wait;
+    queue->close = pool_close;
+
+    for (int i = 0; i < AIO_THREADS; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, pool_main, pool) != 0)
+            break;
+        pool->num_threads++;
+    }
+    if (pool->num_threads > 0)
+        return e_success;
+    pool_close(queue);
+    return e_failure;
+}
+
+/* Whether AIO_BACKEND asks for the thread queue */
+static int want_threads(void)
+{
+    const char *env = getenv("AIO_BACKEND");
+    return env != NULL && strcmp(env, "threads") == 0;
+}
+
+/* Name of the backend the next aio_run() will use */
+const char *aio_backend_name(void)
+{
+#ifdef __NR_io_uring_setup
+    if (!want_threads())
+    {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = uring_setup(1, &params);
+        if (fd >= 0)
+        {
+            close(fd);
+            if (params.features & IORING_FEAT_RW_CUR_POS)
+                return "io_uring";
+        }
+    }
+#endif
+    return "threads";
+}
+
+/* Open the queue the environment and the kernel allow */
+static Status queue_open(AioQueue *queue, AioBlock *slots, const size_t *buffer_sizes, int num_buffers)
+{
+#ifdef __NR_io_uring_setup
+    if (!want_threads() && uring_open(queue, slots, buffer_sizes, num_buffers) == e_success)
+        return e_success;
+#endif
+    return pool_open(queue);
+}
+
+/* Pipeline state of one aio_run() */
+typedef struct
+{
+    AioQueue queue;
+    AioBlock slots[AIO_DEPTH];
+    AioRequest requests[AIO_DEPTH][AIO_MAX_READS + 1];
+    int num_buffers;
+    aio_plan_fn plan;
+    aio_transform_fn transform;
+    void *ctx;
+    long next_block;            // Next block to plan
+    int planned_all;            // plan() has reported the end
+    int failed;
+} AioPipeline;
+
+/* Queue a transfer of a slot's block */
+static void queue_request(AioPipeline *pipeline, int slot, int i, const AioRange *range, int write)
+{
+    AioRequest *request = &pipeline->requests[slot][i];
+
+    request->block = &pipeline->slots[slot];
+    request->range = range;
+    request->write = write;
+    request->buf_index = slot * pipeline->num_buffers + range->buffer;
+    request->done = 0;
+    if (pipeline->queue.submit(&pipeline->queue, request) != e_success)
+    {
+        pipeline->failed = 1;
+        return;
+    }
+    request->block->pending++;
+}
+
+/* Plan the next block into a free slot and queue its reads */
+static void start_block(AioPipeline *pipeline, int slot)
+{
+    AioBlock *block = &pipeline->slots[slot];
+
+    if (pipeline->failed || pipeline->planned_all)
+        return;
+    block->index = pipeline->next_block;
+    block->num_reads = 0;
+    memset(&block->write, 0, sizeof(block->write));
+    if (!pipeline->plan(pipeline->ctx, block->index, block))
+    {
+        pipeline->planned_all = 1;
+        return;
+    }
+    pipeline->next_block++;
+    block->state = SLOT_READING;
+    for (int i = 0; i < block->num_reads && i < AIO_MAX_READS; i++)
+    {
+        if (block->reads[i].len > 0)
+            queue_request(pipeline, slot, i, &block->reads[i], 0);
+    }
+    if (block->pending == 0)
+        block->state = SLOT_READY;
+}
+
+/* Transform the ready blocks that are next in order and queue their writes */
+static void transform_ready(AioPipeline *pipeline, long *next_transform)
+{
+    for (int slot = 0; slot < AIO_DEPTH && !pipeline->failed; slot++)
+    {
+        AioBlock *block = &pipeline->slots[slot];
+
+        if (block->state != SLOT_READY || block->index != *next_transform)
+            continue;
+        if (pipeline->transform(pipeline->ctx, block) != e_success)
+        {
+            pipeline->failed = 1;
+            break;
+        }
+        (*next_transform)++;
+        block->state = SLOT_WRITING;
+        if (block->write.len > 0)
+            queue_request(pipeline, slot, AIO_MAX_READS, &block->write, 1);
+        if (block->pending == 0)
+        {
+            block->state = SLOT_FREE;
+            start_block(pipeline, slot);
+        }
+        /* The block after it may sit in an earlier slot */
+        slot = -1;
+    }
+}
+
+/* Account for a completed transfer; a short one is queued again for the rest */
+static void complete_request(AioPipeline *pipeline, AioRequest *request)
+{
+    AioBlock *block = request->block;
+    int slot = block - pipeline->slots;
+
+    block->pending--;
+    if (request->result <= 0)
+    {
+        pipeline->failed = 1;
+        return;
+    }
+    request->done += request->result;
+    if (request->done < request->range->len && !pipeline->failed)
+    {
+        if (pipeline->queue.submit(&pipeline->queue, request) == e_success)
+            block->pending++;
+        else
+            pipeline->failed = 1;
+        return;
+    }
+    if (block->pending > 0)
+        return;
+    if (block->state == SLOT_READING)
+    {
+        block->state = SLOT_READY;
+    }
+    else if (block->state == SLOT_WRITING)
+    {
+        block->state = SLOT_FREE;
+        start_block(pipeline, slot);
+    }
+}
+
+/* Run blocks through read, transform and write with AIO_DEPTH blocks in flight */
+Status aio_run(const size_t *buffer_sizes, int num_buffers, aio_plan_fn plan, aio_transform_fn transform, void *ctx)
+{
+    if (num_buffers < 1 || num_buffers > AIO_MAX_BUFFERS)
+        return e_failure;
+
+    AioPipeline *pipeline = calloc(1, sizeof(*pipeline));
+    if (pipeline == NULL)
+        return e_failure;
+    pipeline->num_buffers = num_buffers;
+    pipeline->plan = plan;
+    pipeline->transform = transform;
+    pipeline->ctx = ctx;
+
+    Status status = e_success;
+    for (int slot = 0; slot < AIO_DEPTH && status == e_success; slot++)
+    {
+        for (int i = 0; i < num_buffers; i++)
+        {
+            if ((pipeline->slots[slot].buffers[i] = malloc(buffer_sizes[i])) == NULL)
+                status = e_failure;
+        }
+    }
+    if (status == e_success)
+        status = queue_open(&pipeline->queue, pipeline->slots, buffer_sizes, num_buffers);
+
+    if (status == e_success)
+    {
+        long next_transform = 0;
+
+        for (int slot = 0; slot < AIO_DEPTH; slot++)
+            start_block(pipeline, slot);
+        for (;;)
+        {
+            int pending = 0;
+            int busy = 0;
+
+            transform_ready(pipeline, &next_transform);
+            for (int slot = 0; slot < AIO_DEPTH; slot++)
+            {
+                pending += pipeline->slots[slot].pending;
+                busy |= pipeline->slots[slot].state != SLOT_FREE;
+            }
+            /* After a failure only the transfers in flight are waited for */
+            if (pending == 0 && (pipeline->failed || !busy))
+                break;
+
+            AioRequest *request = pipeline->queue.wait(&pipeline->queue);
+            if (request == NULL)
+            {
+                pipeline->failed = 1;
+                break;
+            }
+            complete_request(pipeline, request);
+        }
+        pipeline->queue.close(&pipeline->queue);
+        if (pipeline->failed)
+            status = e_failure;
+    }
+
+    for (int slot = 0; slot < AIO_DEPTH; slot++)
+    {
+        for (int i = 0; i < num_buffers; i++)
+            free(pipeline->slots[slot].buffers[i]);
+    }
+    free(pipeline);
+    return status;
+}
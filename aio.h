@@ -0,0 +1,74 @@
+/*
+ * Header file for the asynchronous block pipeline
+ *
+ * Description:
+ * The stdio backend alternates strictly between reading a cover block,
+ * transforming it and writing it, so the CPU idles during I/O and the disk
+ * during the transform. aio_run() keeps AIO_DEPTH blocks in flight instead:
+ * while one block is transformed, the reads of the blocks after it and the
+ * writes of the blocks before it proceed in the background, and the total
+ * time approaches the larger of the I/O and CPU times rather than their sum.
+ *
+ * Every block slot owns a fixed set of buffers, allocated once per run and
+ * reused for block after block. Blocks are transformed strictly in order,
+ * so running checksums see the payload as a sequential loop would.
+ *
+ * I/O goes through io_uring where the kernel allows it (raw system calls,
+ * with the slot buffers registered as fixed buffers when possible) and
+ * through a pair of plain I/O threads doing pread()/pwrite() otherwise. The
+ * AIO_BACKEND environment variable (uring or threads) overrides the choice.
+*/
+
+#ifndef AIO_H
+#define AIO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "types.h"
+
+/* Block slots in flight */
+#define AIO_DEPTH 4
+
+/* Reads per block and buffers per block slot, at most */
+#define AIO_MAX_READS 2
+#define AIO_MAX_BUFFERS 3
+
+/* One file range of a block, transferred to or from one of its slot's buffers */
+typedef struct
+{
+    int fd;
+    int buffer;                     // Index into AioBlock.buffers
+    size_t len;                     // 0: nothing to transfer
+    off_t offset;
+} AioRange;
+
+/* A block slot and the block it currently holds */
+typedef struct
+{
+    long index;                     // Block number
+    unsigned char *buffers[AIO_MAX_BUFFERS];
+    AioRange reads[AIO_MAX_READS];  // Filled in by the plan callback
+    int num_reads;
+    AioRange write;                 // Filled in by the transform callback
+    int pending;                    // Transfers in flight (pipeline internal)
+    int state;                      // Pipeline internal
+} AioBlock;
+
+/* Set up the reads of block number index; returns 0 once there are no blocks left */
+typedef int (*aio_plan_fn)(void *ctx, long index, AioBlock *block);
+
+/* Transform a block whose reads have completed and set up its write; called in block order */
+typedef Status (*aio_transform_fn)(void *ctx, AioBlock *block);
+
+/*
+ * Run blocks 0, 1, ... through read, transform and write until plan returns
+ * 0. Slot buffer i holds buffer_sizes[i] bytes. On the first failed
+ * transfer or transform no further blocks are started; whatever is in
+ * flight is waited for and e_failure is returned.
+*/
+Status aio_run(const size_t *buffer_sizes, int num_buffers, aio_plan_fn plan, aio_transform_fn transform, void *ctx);
+
+/* Name of the backend the next aio_run() will use ("io_uring" or "threads") */
+const char *aio_backend_name(void);
+
+#endif
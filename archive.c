@@ -0,0 +1,174 @@
+/*
+ * Archive Directories
+ *
+ * Description:
+ * Builds, serializes and validates the member directory of an archive.
+ * Names are checked on load, so an extracted member can never escape the
+ * directory it is written to.
+*/
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "lsb.h"
+
+/* Store a 32-bit value big-endian */
+static void store_be32(unsigned char *out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+/* Load a big-endian 32-bit value */
+static uint32_t load_be32(const unsigned char *in)
+{
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+/* Check a member name: a single non-empty path component */
+static int valid_member_name(const char *name)
+{
+    return name[0] != '\0' && strchr(name, '/') == NULL && strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+/* Describe the member files of an archive */
+Status archive_dir_build(ArchiveDir *dir, char **paths, int count, int depth)
+{
+    long group = lsb_group_size(depth);
+    long end = 0;
+
+    dir->count = count;
+    dir->data_size = 0;
+    dir->entries = calloc(count + 1, sizeof(ArchiveEntry));
+    if (dir->entries == NULL)
+        return e_failure;
+
+    for (int i = 0; i < count; i++)
+    {
+        ArchiveEntry *entry = &dir->entries[i];
+        const char *base = strrchr(paths[i], '/');
+        struct stat st;
+
+        base = base != NULL ? base + 1 : paths[i];
+        if (!valid_member_name(base) || strlen(base) > ARCHIVE_NAME_MAX || archive_dir_find(dir, base) != NULL)
+            return e_failure;
+        if (stat(paths[i], &st) != 0 || !S_ISREG(st.st_mode))
+            return e_failure;
+
+        /* Every member starts on a whole group */
+        long offset = (end + group - 1) / group * group;
+        if (st.st_size > INT_MAX - offset)
+            return e_failure;
+
+        strcpy(entry->name, base);
+        entry->path = paths[i];
+        entry->size = st.st_size;
+        entry->offset = offset;
+        end = offset + st.st_size;
+    }
+    dir->data_size = end;
+    return e_success;
+}
+
+/* Bytes of the serialized directory */
+size_t archive_dir_size(const ArchiveDir *dir)
+{
+    size_t size = 4;
+    for (int i = 0; i < dir->count; i++)
+    {
+        size += 1 + strlen(dir->entries[i].name) + 12;
+    }
+    return size;
+}
+
+/* Serialize the directory */
+void archive_dir_store(const ArchiveDir *dir, unsigned char *out)
+{
+    store_be32(out, dir->count);
+    out += 4;
+    for (int i = 0; i < dir->count; i++)
+    {
+        const ArchiveEntry *entry = &dir->entries[i];
+        size_t len = strlen(entry->name);
+
+        *out++ = (unsigned char)len;
+        memcpy(out, entry->name, len);
+        out += len;
+        store_be32(out, entry->size);
+        store_be32(out + 4, entry->offset);
+        store_be32(out + 8, entry->crc);
+        out += 12;
+    }
+}
+
+/* Parse and validate a serialized directory */
+Status archive_dir_load(ArchiveDir *dir, const unsigned char *in, size_t size, long data_size, int depth)
+{
+    const unsigned char *end = in + size;
+    long group = lsb_group_size(depth);
+    long data_end = 0;
+
+    dir->count = 0;
+    dir->data_size = data_size;
+    dir->entries = NULL;
+    if (size < 4)
+        return e_failure;
+
+    /* Each entry takes at least 14 bytes, which bounds a forged count */
+    uint32_t count = load_be32(in);
+    in += 4;
+    if (count > (size - 4) / 14)
+        return e_failure;
+    dir->entries = calloc(count + 1, sizeof(ArchiveEntry));
+    if (dir->entries == NULL)
+        return e_failure;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        ArchiveEntry *entry = &dir->entries[i];
+
+        if (in >= end)
+            return e_failure;
+        size_t len = *in++;
+        if ((size_t)(end - in) < len + 12)
+            return e_failure;
+        memcpy(entry->name, in, len);
+        entry->name[len] = '\0';
+        in += len;
+        entry->size = load_be32(in);
+        entry->offset = load_be32(in + 4);
+        entry->crc = load_be32(in + 8);
+        in += 12;
+        dir->count = i + 1;
+
+        /* Members are in data order, inside the data field and group aligned */
+        if (!valid_member_name(entry->name) || entry->offset % group != 0 || entry->offset < data_end ||
+            (long)entry->offset + entry->size > data_size)
+            return e_failure;
+        data_end = (long)entry->offset + entry->size;
+    }
+    return in == end ? e_success : e_failure;
+}
+
+/* Find a member by name */
+const ArchiveEntry *archive_dir_find(const ArchiveDir *dir, const char *name)
+{
+    for (int i = 0; i < dir->count; i++)
+    {
+        if (dir->entries[i].name[0] != '\0' && strcmp(dir->entries[i].name, name) == 0)
+            return &dir->entries[i];
+    }
+    return NULL;
+}
+
+/* Free the member table */
+void archive_dir_free(ArchiveDir *dir)
+{
+    free(dir->entries);
+    dir->entries = NULL;
+    dir->count = 0;
+}
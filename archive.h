@@ -0,0 +1,68 @@
+/*
+ * Header file for archive directories
+ *
+ * Description:
+ * An archive packs several files into one cover. Its frame sets
+ * FRAME_FLAG_ARCHIVE, records an empty extension and the size of the data
+ * field, and then stores a directory before the data:
+ *     directory size (4 bytes)
+ *     directory: member count (4 bytes), then per member the name length
+ *                (1 byte), the name, and its size, offset and CRC32C
+ *                (4 bytes each, big-endian)
+ * Members are stored one after another in the data field. Each one starts
+ * on a whole group at the payload depth, so it can be decoded without
+ * touching its neighbours.
+*/
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/* Longest member name (names never contain directories) */
+#define ARCHIVE_NAME_MAX 255
+
+typedef struct
+{
+    char name[ARCHIVE_NAME_MAX + 1];    // Member name
+    uint32_t size;                      // Member size in bytes
+    uint32_t offset;                    // Offset of the member in the data field
+    uint32_t crc;                       // CRC32C of the member
+    const char *path;                   // Source file when packing (not stored)
+} ArchiveEntry;
+
+typedef struct
+{
+    int count;                          // Number of members
+    ArchiveEntry *entries;              // Members in data order
+    long data_size;                     // Bytes of the data field, padding included
+} ArchiveDir;
+
+/*
+ * Describe the files in paths as the members of an archive embedded at the
+ * given depth. Members are named after the last path component; checksums
+ * start at 0 and are filled in while the members are embedded.
+*/
+Status archive_dir_build(ArchiveDir *dir, char **paths, int count, int depth);
+
+/* Bytes of the serialized directory */
+size_t archive_dir_size(const ArchiveDir *dir);
+
+/* Serialize the directory (archive_dir_size() bytes) */
+void archive_dir_store(const ArchiveDir *dir, unsigned char *out);
+
+/*
+ * Parse a serialized directory of size bytes and check every member lies
+ * inside a data field of data_size bytes, on a group boundary at depth.
+*/
+Status archive_dir_load(ArchiveDir *dir, const unsigned char *in, size_t size, long data_size, int depth);
+
+/* Find a member by name (NULL if absent) */
+const ArchiveEntry *archive_dir_find(const ArchiveDir *dir, const char *name);
+
+/* Free the member table */
+void archive_dir_free(ArchiveDir *dir);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * Batch Mode
+ *
+ * Description:
+ * Reads a manifest of encode/decode jobs and runs them on the work-stealing
+ * pool. Every worker owns one EncodeInfo and one DecodeInfo, allocated on
+ * first use and reused for all the jobs it runs, so the 1 MiB image and
+ * secret buffers inside them are allocated once per worker, not per job.
+ * With a cover cache, jobs that embed into the same cover read it once.
+ * Stage progress is not reported; each job reports a single status line
+ * through the options' MessageCallback.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+#include "pool.h"
+#include "report.h"
+
+#define MAX_JOB_ARGS 5
+
+/* One manifest line */
+typedef struct
+{
+    int line;                   // Manifest line number
+    OperationType type;         // e_encode or e_decode
+    char *argv[MAX_JOB_ARGS + 1]; // argv layout expected by read_and_validate_*_args
+    Status status;
+} BatchJob;
+
+/* Reusable per-worker contexts */
+typedef struct
+{
+    EncodeInfo *encInfo;
+    DecodeInfo *decInfo;
+} BatchWorker;
+
+typedef struct
+{
+    BatchOptions *options;
+    BatchWorker *workers;
+    CoverCache *cover_cache;    // Shared by all workers (optional)
+} BatchRun;
+
+/* Prepare a reused EncodeInfo for the next job */
+static void reset_encode_info(EncodeInfo *encInfo, BatchRun *run)
+{
+    BatchOptions *options = run->options;
+
+    encInfo->fptr_src_image = encInfo->fptr_secret = encInfo->fptr_stego_image = NULL;
+    encInfo->src_map = encInfo->stego_map = NULL;
+    encInfo->tail_cloned = 0;
+    encInfo->use_mmap = options->use_mmap;
+    encInfo->depth = options->depth;
+    encInfo->use_index = options->use_index;
+    encInfo->compress = options->compress;
+    encInfo->use_checksum = options->use_checksum;
+    encInfo->num_threads = 1;
+    encInfo->use_aio = options->use_aio;
+    encInfo->cover_cache = run->cover_cache;
+    encInfo->progress = NULL;
+}
+
+/* Prepare a reused DecodeInfo for the next job */
+static void reset_decode_info(DecodeInfo *decInfo, BatchOptions *options)
+{
+    decInfo->fptr_d_src_image = decInfo->fptr_d_secret = NULL;
+    decInfo->d_src_map = NULL;
+    decInfo->use_mmap = options->use_mmap;
+    decInfo->num_threads = 1;
+    decInfo->use_aio = options->use_aio;
+    decInfo->progress = NULL;
+}
+
+/* Run one job on a worker's reusable contexts */
+static void run_job(void *arg, int worker, void *task)
+{
+    BatchRun *run = arg;
+    BatchWorker *ctx = &run->workers[worker];
+    BatchJob *job = task;
+
+    job->status = e_failure;
+    if (job->type == e_encode)
+    {
+        if (ctx->encInfo == NULL && (ctx->encInfo = calloc(1, sizeof(EncodeInfo))) == NULL)
+            return;
+        reset_encode_info(ctx->encInfo, run);
+        if (read_and_validate_encode_args(job->argv, ctx->encInfo) == e_success)
+            job->status = do_encoding(ctx->encInfo);
+    }
+    else
+    {
+        if (ctx->decInfo == NULL && (ctx->decInfo = calloc(1, sizeof(DecodeInfo))) == NULL)
+            return;
+        reset_decode_info(ctx->decInfo, run->options);
+        if (read_and_validate_decode_args(job->argv, ctx->decInfo) == e_success)
+            job->status = do_decoding(ctx->decInfo);
+    }
+
+    report_message(run->options->report, run->options->report_arg, 0, "[line %d] %s %s -> %s: %s", job->line,
+                   job->type == e_encode ? "encode" : "decode", job->argv[2], job->type == e_encode ? job->argv[4] : job->argv[3],
+                   job->status == e_success ? "OK" : "FAILED");
+}
+
+/* Free the arguments parse_job copied out of the manifest line */
+static void free_job_args(BatchJob *job)
+{
+    for (int a = 2; a <= MAX_JOB_ARGS; a++)
+    {
+        free(job->argv[a]);
+        job->argv[a] = NULL;
+    }
+}
+
+/* Parse one manifest line into a job; returns e_failure on a malformed line */
+static Status parse_job(char *text, int line, BatchJob *job)
+{
+    char *fields[MAX_JOB_ARGS];
+    int count = 0;
+
+    for (char *tok = strtok(text, " \t\r\n"); tok != NULL && count < MAX_JOB_ARGS; tok = strtok(NULL, " \t\r\n"))
+    {
+        fields[count++] = tok;
+    }
+
+    memset(job, 0, sizeof(*job));
+    job->line = line;
+    job->status = e_failure;
+    if (strcmp(fields[0], "e") == 0 && count == 4)
+        job->type = e_encode;
+    else if (strcmp(fields[0], "d") == 0 && count == 3)
+        job->type = e_decode;
+    else
+        return e_failure;
+
+    job->argv[0] = "batch";
+    job->argv[1] = job->type == e_encode ? "-e" : "-d";
+    for (int i = 1; i < count; i++)
+    {
+        if ((job->argv[i + 1] = strdup(fields[i])) == NULL)
+        {
+            free_job_args(job);
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+/* Run every job in the manifest */
+Status do_batch(const char *manifest_fname, BatchOptions *options)
+{
+    FILE *manifest = fopen(manifest_fname, "r");
+    if (manifest == NULL)
+    {
+        report_message(options->report, options->report_arg, 1, "%s: %s", manifest_fname, strerror(errno));
+        return e_failure;
+    }
+
+    BatchJob *jobs = NULL;
+    int num_jobs = 0, capacity = 0, line = 0;
+    char text[4096];
+    Status status = e_success;
+
+    while (fgets(text, sizeof(text), manifest) != NULL)
+    {
+        line++;
+        char *start = text + strspn(text, " \t\r\n");
+        if (*start == '\0' || *start == '#')
+            continue;
+        if (num_jobs == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            BatchJob *grown = realloc(jobs, capacity * sizeof(BatchJob));
+            if (grown == NULL)
+            {
+                status = e_failure;
+                break;
+            }
+            jobs = grown;
+        }
+        if (parse_job(start, line, &jobs[num_jobs]) != e_success)
+        {
+            report_message(options->report, options->report_arg, 1, "[line %d] Invalid Job Description", line);
+            status = e_failure;
+            continue;
+        }
+        num_jobs++;
+    }
+    fclose(manifest);
+
+    int num_workers = options->num_workers > 0 ? options->num_workers : pool_default_workers();
+    BatchRun run = { options, calloc(num_workers, sizeof(BatchWorker)), NULL };
+    void **tasks = malloc((num_jobs + 1) * sizeof(void *));
+    CoverCache cover_cache;
+
+    if (options->cover_cache_size > 0 && cover_cache_init(&cover_cache, options->cover_cache_size) == e_success)
+        run.cover_cache = &cover_cache;
+    if (run.workers == NULL || tasks == NULL)
+    {
+        status = e_failure;
+    }
+    else
+    {
+        for (int i = 0; i < num_jobs; i++)
+        {
+            tasks[i] = &jobs[i];
+        }
+        if (pool_run(num_workers, tasks, num_jobs, run_job, &run) != e_success)
+            status = e_failure;
+    }
+
+    int succeeded = 0;
+    for (int i = 0; i < num_jobs; i++)
+    {
+        if (jobs[i].status == e_success)
+            succeeded++;
+        free_job_args(&jobs[i]);
+    }
+    report_message(options->report, options->report_arg, 0, "Batch Complete: %d of %d Jobs Successful", succeeded, num_jobs);
+
+    for (int w = 0; run.workers != NULL && w < num_workers; w++)
+    {
+        if (run.workers[w].encInfo != NULL)
+            release_encode_info(run.workers[w].encInfo);
+        if (run.workers[w].decInfo != NULL)
+            release_decode_info(run.workers[w].decInfo);
+        free(run.workers[w].encInfo);
+        free(run.workers[w].decInfo);
+    }
+    if (run.cover_cache != NULL)
+        cover_cache_destroy(run.cover_cache);
+    free(run.workers);
+    free(tasks);
+    free(jobs);
+    return (status == e_success && succeeded == num_jobs) ? e_success : e_failure;
+}
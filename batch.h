@@ -0,0 +1,36 @@
+/*
+ * Header file for batch mode
+ *
+ * Description:
+ * Batch mode runs many encode/decode jobs listed in a manifest inside one
+ * process. Manifest lines have the form
+ *     e <cover.bmp> <secret> <stego.bmp>
+ *     d <stego.bmp> <output>
+ * Blank lines and lines starting with '#' are ignored.
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include "types.h"
+
+/* Options applied to every job of a batch */
+typedef struct
+{
+    int num_workers;    // Worker threads (<= 0: one per online CPU)
+    int use_mmap;       // Use the mmap backend for every job
+    int depth;          // Embedding depth for encode jobs (bits per image byte, 0 means 1)
+    int use_index;      // Store a chunk index with every encoded payload
+    int compress;       // Compress every encoded payload
+    int use_checksum;   // Store a payload checksum with every encoded payload
+    int use_aio;        // Pipeline the secret data of every job (see aio.h)
+    size_t cover_cache_size; // Bytes of covers kept mapped for encode jobs that share them (0: none, see covercache.h)
+    MessageCallback report; // Told each job's status and the summary (optional, see report.h)
+    void *report_arg;
+} BatchOptions;
+
+/* Run every job in the manifest and report each job's status */
+Status do_batch(const char *manifest_fname, BatchOptions *options);
+
+#endif
@@ -0,0 +1,652 @@
+/*
+ * Benchmark Suite
+ *
+ * Description:
+ * Generates synthetic 24-bit BMP covers and payloads, then times:
+ * - full do_encoding() / do_decoding() runs (stdio, mmap and aio backends) per
+ *   cover size, in MB/s of cover image;
+ * - the isolated helpers encode_byte_to_lsb(), decode_byte_from_lsb(),
+ *   encode_size_to_lsb() and copy_remaining_img_data();
+ * - every bulk LSB kernel the CPU supports, and the depth kernels;
+ * - packing an archive at every depth and extracting each member, checked
+ *   byte for byte against the member.
+ * Each figure is the best of --repeat runs and comes with ns/byte and the
+ * peak RSS so far. Results are written as JSON, one result per line; with
+ * --baseline, results slower than the baseline by more than --threshold
+ * percent are reported as regressions and the exit status is 1.
+ *
+ * Usage: ./stego_bench [--sizes 64K,1M,16M] [--payload random|text]
+ *                      [--dir DIR] [--repeat N] [--out FILE]
+ *                      [--baseline FILE] [--threshold PCT]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "stego.h"
+#include "lsb.h"
+
+#define MAX_RESULTS 256
+#define MAX_SIZES 16
+
+/* Covers are 1024 pixels wide, so rows need no padding */
+#define COVER_WIDTH 1024
+
+/* Isolated kernels run on this many payload bytes per repetition */
+#define KERNEL_BYTES (1024 * 1024)
+
+/* One measurement */
+typedef struct
+{
+    char name[64];
+    const char *unit;       // What the bytes are: "cover", "payload" or "copied"
+    double bytes;
+    double seconds;         // Best of the repetitions
+    long peak_rss_kb;
+} BenchResult;
+
+/* Benchmark settings */
+typedef struct
+{
+    long sizes[MAX_SIZES];
+    int num_sizes;
+    int text_payload;
+    const char *dir;
+    int repeat;
+    const char *out_fname;
+    const char *baseline_fname;
+    double threshold;
+} BenchOptions;
+
+static BenchResult results[MAX_RESULTS];
+static int num_results;
+
+/* Seconds on the monotonic clock */
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Peak resident set size of the process so far */
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+/* Keep the best time of a named measurement */
+static void record(const char *name, const char *unit, double bytes, double seconds)
+{
+    BenchResult *r = NULL;
+
+    for (int i = 0; i < num_results; i++)
+    {
+        if (strcmp(results[i].name, name) == 0)
+            r = &results[i];
+    }
+    if (r == NULL)
+    {
+        if (num_results == MAX_RESULTS)
+            return;
+        r = &results[num_results++];
+        snprintf(r->name, sizeof(r->name), "%s", name);
+        r->seconds = seconds;
+    }
+    r->unit = unit;
+    r->bytes = bytes;
+    if (seconds < r->seconds)
+        r->seconds = seconds;
+    r->peak_rss_kb = peak_rss_kb();
+}
+
+/* Fast deterministic pseudo-random bytes */
+static uint64_t xorshift(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void fill_random(unsigned char *buf, size_t n, uint64_t *state)
+{
+    for (size_t i = 0; i < n; i += 8)
+    {
+        uint64_t v = xorshift(state);
+        memcpy(buf + i, &v, n - i < 8 ? n - i : 8);
+    }
+}
+
+/* Fill buf with log-like text: words from a small vocabulary, one line every dozen */
+static void fill_text(unsigned char *buf, size_t n, uint64_t *state)
+{
+    static const char *words[] =
+    {
+        "INFO", "WARN", "request", "served", "in", "ms", "user", "session", "cache", "hit",
+        "miss", "GET", "POST", "/api/v1/items", "status", "200", "404", "latency", "worker", "queue"
+    };
+    size_t pos = 0;
+    int column = 0;
+
+    while (pos < n)
+    {
+        const char *word = words[xorshift(state) % (sizeof(words) / sizeof(words[0]))];
+        for (const char *c = word; *c != '\0' && pos < n; c++)
+            buf[pos++] = *c;
+        if (pos < n)
+            buf[pos++] = ++column % 12 == 0 ? '\n' : ' ';
+    }
+}
+
+/* Write size bytes of random or text data to fptr, in 1 MiB blocks */
+static Status write_data(FILE *fptr, long size, int text, uint64_t seed)
+{
+    unsigned char *block = malloc(MAX_IMAGE_BUF_SIZE);
+    Status status = block != NULL ? e_success : e_failure;
+
+    for (long done = 0; done < size && status == e_success; done += MAX_IMAGE_BUF_SIZE)
+    {
+        size_t n = size - done < MAX_IMAGE_BUF_SIZE ? size - done : MAX_IMAGE_BUF_SIZE;
+        if (text)
+            fill_text(block, n, &seed);
+        else
+            fill_random(block, n, &seed);
+        if (fwrite(block, 1, n, fptr) != n)
+            status = e_failure;
+    }
+    free(block);
+    return status;
+}
+
+/* Write a payload file of size bytes */
+static Status write_payload(const char *path, long size, int text)
+{
+    FILE *fptr = fopen(path, "w");
+    if (fptr == NULL)
+        return e_failure;
+    Status status = write_data(fptr, size, text, 0x2545F4914F6CDD1Dull);
+    if (fclose(fptr) != 0)
+        status = e_failure;
+    return status;
+}
+
+/* Pixel bytes of a cover of about size bytes: whole rows, at least one */
+static long cover_pixels(long size)
+{
+    long height = (size - 54) / (COVER_WIDTH * 3);
+    return (height < 1 ? 1 : height) * COVER_WIDTH * 3;
+}
+
+/* Write a 24-bit BMP cover of about size bytes with random pixels */
+static Status write_cover(const char *path, long size)
+{
+    uint32_t pixels = (uint32_t)cover_pixels(size);
+    uint32_t height = pixels / (COVER_WIDTH * 3);
+    uint32_t file_size = pixels + 54;
+    unsigned char header[54] = { 'B', 'M' };
+    uint32_t fields[] = { 54, 40, COVER_WIDTH, height };
+
+    memcpy(header + 2, &file_size, 4);
+    memcpy(header + 10, &fields[0], 4);     // Pixel data offset
+    memcpy(header + 14, &fields[1], 4);     // DIB header size
+    memcpy(header + 18, &fields[2], 4);     // Width
+    memcpy(header + 22, &fields[3], 4);     // Height
+    header[26] = 1;                         // Planes
+    header[28] = 24;                        // Bits per pixel
+    memcpy(header + 34, &pixels, 4);        // Image size
+
+    FILE *fptr = fopen(path, "w");
+    if (fptr == NULL)
+        return e_failure;
+    Status status = fwrite(header, 1, 54, fptr) == 54 ? e_success : e_failure;
+    if (status == e_success)
+        status = write_data(fptr, pixels, 0, 0x9E3779B97F4A7C15ull ^ (uint64_t)size);
+    if (fclose(fptr) != 0)
+        status = e_failure;
+    return status;
+}
+
+/* Format a byte count as 64K, 16M, 2G */
+static void size_label(long size, char *label, size_t len)
+{
+    if (size >= (1L << 30) && size % (1L << 30) == 0)
+        snprintf(label, len, "%ldG", size >> 30);
+    else if (size >= (1L << 20) && size % (1L << 20) == 0)
+        snprintf(label, len, "%ldM", size >> 20);
+    else if (size >= 1024 && size % 1024 == 0)
+        snprintf(label, len, "%ldK", size >> 10);
+    else
+        snprintf(label, len, "%ld", size);
+}
+
+/* Time full encode and decode runs on one cover size */
+static Status bench_full_runs(const BenchOptions *opts, long size)
+{
+    char label[32], name[64];
+    char cover[4096], secret[4096], stego[4096], output[4096];
+    // Fill the cover at 1 bit per byte, leaving room for the frame fields
+    long pixels = cover_pixels(size);
+    long payload = pixels / 8 - 64;
+
+    size_label(size, label, sizeof(label));
+    snprintf(cover, sizeof(cover), "%s/bench_cover_%s.bmp", opts->dir, label);
+    snprintf(secret, sizeof(secret), "%s/bench_secret_%s.dat", opts->dir, label);
+    snprintf(stego, sizeof(stego), "%s/bench_stego_%s.bmp", opts->dir, label);
+    snprintf(output, sizeof(output), "%s/bench_output_%s", opts->dir, label);
+
+    if (payload < 1 || write_cover(cover, size) != e_success ||
+        write_payload(secret, payload, opts->text_payload) != e_success)
+    {
+        fprintf(stderr, "Cannot create the %s cover or payload in %s\n", label, opts->dir);
+        return e_failure;
+    }
+
+    Status status = e_success;
+    for (int r = 0; r < opts->repeat && status == e_success; r++)
+    {
+        // stdio, --mmap and --aio backends
+        for (int backend = 0; backend < 3 && status == e_success; backend++)
+        {
+            static const char *suffix[] = { "", "_mmap", "_aio" };
+            EncodeInfo encInfo = { 0 };
+            DecodeInfo decInfo = { 0 };
+            char *enc_argv[] = { "bench", "-e", cover, secret, stego, NULL };
+            char *dec_argv[] = { "bench", "-d", stego, output, NULL };
+            double start;
+
+            encInfo.use_mmap = backend == 1;
+            encInfo.use_aio = backend == 2;
+            status = read_and_validate_encode_args(enc_argv, &encInfo);
+            start = now_seconds();
+            if (status == e_success)
+                status = do_encoding(&encInfo);
+            snprintf(name, sizeof(name), "encode%s/%s/%s", suffix[backend], label, opts->text_payload ? "text" : "random");
+            record(name, "cover", pixels + 54, now_seconds() - start);
+            release_encode_info(&encInfo);
+
+            decInfo.use_mmap = backend == 1;
+            decInfo.use_aio = backend == 2;
+            if (status == e_success)
+                status = read_and_validate_decode_args(dec_argv, &decInfo);
+            start = now_seconds();
+            if (status == e_success)
+                status = do_decoding(&decInfo);
+            snprintf(name, sizeof(name), "decode%s/%s/%s", suffix[backend], label, opts->text_payload ? "text" : "random");
+            record(name, "cover", pixels + 54, now_seconds() - start);
+            release_decode_info(&decInfo);
+        }
+    }
+    if (status != e_success)
+        fprintf(stderr, "Full run on the %s cover failed\n", label);
+
+    // copy_remaining_img_data() on its own: the whole pixel array of the cover
+    for (int r = 0; r < opts->repeat && status == e_success; r++)
+    {
+        FILE *src = fopen(cover, "r");
+        FILE *dest = fopen(stego, "w");
+        double start = now_seconds();
+
+        if (src == NULL || dest == NULL || fseek(src, 54, SEEK_SET) != 0 || copy_remaining_img_data(src, dest) != e_success)
+            status = e_failure;
+        if (dest != NULL && fclose(dest) != 0)
+            status = e_failure;
+        snprintf(name, sizeof(name), "copy_remaining_img_data/%s", label);
+        record(name, "copied", pixels, now_seconds() - start);
+        if (src != NULL)
+            fclose(src);
+    }
+
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+    unlink(output);
+    snprintf(output, sizeof(output), "%s/bench_output_%s.dat", opts->dir, label);
+    unlink(output);
+    return status;
+}
+
+/* Whether two files hold the same bytes */
+static int same_contents(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "r");
+    FILE *fb = fopen(b, "r");
+    int same = fa != NULL && fb != NULL;
+
+    while (same)
+    {
+        int ca = getc(fa), cb = getc(fb);
+        same = ca == cb;
+        if (ca == EOF)
+            break;
+    }
+    if (fa != NULL)
+        fclose(fa);
+    if (fb != NULL)
+        fclose(fb);
+    return same;
+}
+
+/*
+ * Time packing members of awkward sizes into one archive at every depth and
+ * extracting each of them again, which must give back the member exactly.
+ * At depth 3 the members end inside groups, so a member embedded away from
+ * the offset its directory entry names fails the run.
+*/
+static Status bench_archive_runs(const BenchOptions *opts)
+{
+    static const long member_sizes[] = { 1, 22, 70001, 3, 2 };
+    enum { NUM_MEMBERS = sizeof(member_sizes) / sizeof(member_sizes[0]) };
+    char cover[4096], stego[4096], output[4096], paths[NUM_MEMBERS][4096], name[64];
+    char *members[NUM_MEMBERS];
+    long total = 0;
+
+    snprintf(cover, sizeof(cover), "%s/bench_archive_cover.bmp", opts->dir);
+    snprintf(stego, sizeof(stego), "%s/bench_archive_stego.bmp", opts->dir);
+    snprintf(output, sizeof(output), "%s/bench_archive_output", opts->dir);
+    for (int i = 0; i < NUM_MEMBERS; i++)
+    {
+        snprintf(paths[i], sizeof(paths[i]), "%s/bench_member_%d.dat", opts->dir, i);
+        members[i] = paths[i];
+    }
+
+    Status status = write_cover(cover, 1L << 20);
+    for (int i = 0; i < NUM_MEMBERS && status == e_success; i++)
+    {
+        FILE *fptr = fopen(paths[i], "w");
+        if (fptr == NULL || write_data(fptr, member_sizes[i], opts->text_payload, 0x9E3779B97F4A7C15ull * (i + 1)) != e_success)
+            status = e_failure;
+        if (fptr != NULL && fclose(fptr) != 0)
+            status = e_failure;
+        total += member_sizes[i];
+    }
+    if (status != e_success)
+        fprintf(stderr, "Cannot create the archive cover or members in %s\n", opts->dir);
+
+    for (int depth = 1; depth <= LSB_MAX_DEPTH && status == e_success; depth++)
+    {
+        for (int r = 0; r < opts->repeat && status == e_success; r++)
+        {
+            EncodeInfo encInfo = { 0 };
+            ArchiveDir archive = { 0 };
+            double start = now_seconds(), seconds = 0;
+
+            encInfo.src_image_fname = cover;
+            encInfo.stego_image_fname = stego;
+            encInfo.depth = depth;
+            encInfo.archive = &archive;
+            status = archive_dir_build(&archive, members, NUM_MEMBERS, depth);
+            if (status == e_success)
+                status = do_encoding(&encInfo);
+            snprintf(name, sizeof(name), "archive/depth%d", depth);
+            record(name, "payload", total, now_seconds() - start);
+            release_encode_info(&encInfo);
+            archive_dir_free(&archive);
+
+            // Time the extractions only, not the comparisons
+            for (int i = 0; i < NUM_MEMBERS && status == e_success; i++)
+            {
+                DecodeInfo decInfo = { 0 };
+
+                decInfo.d_src_image_fname = stego;
+                decInfo.d_member = strrchr(paths[i], '/') + 1;
+                decInfo.d_secret_fname = output;
+                start = now_seconds();
+                status = do_decoding(&decInfo);
+                seconds += now_seconds() - start;
+                release_decode_info(&decInfo);
+                if (status == e_success && !same_contents(output, paths[i]))
+                    status = e_failure;
+            }
+            snprintf(name, sizeof(name), "extract/depth%d", depth);
+            record(name, "payload", total, seconds);
+        }
+        if (status != e_success)
+            fprintf(stderr, "Archive round trip at depth %d failed\n", depth);
+    }
+
+    unlink(cover);
+    unlink(stego);
+    unlink(output);
+    for (int i = 0; i < NUM_MEMBERS; i++)
+    {
+        unlink(paths[i]);
+    }
+    return status;
+}
+
+/* Time the helpers and bulk kernels on in-memory buffers */
+static Status bench_kernels(const BenchOptions *opts)
+{
+    unsigned char *secret = malloc(KERNEL_BYTES);
+    unsigned char *image = malloc(8 * (size_t)KERNEL_BYTES);
+    uint64_t seed = 0x853C49E6748FEA9Bull;
+    static const char *kernels[] = { "scalar", "sse2", "bmi2", "avx2" };
+    char name[64];
+    volatile unsigned char sink = 0;
+
+    if (secret == NULL || image == NULL)
+    {
+        free(secret);
+        free(image);
+        return e_failure;
+    }
+    fill_random(secret, KERNEL_BYTES, &seed);
+    fill_random(image, 8 * (size_t)KERNEL_BYTES, &seed);
+
+    for (int r = 0; r < opts->repeat; r++)
+    {
+        double start = now_seconds();
+        for (size_t i = 0; i < KERNEL_BYTES; i++)
+            encode_byte_to_lsb(secret[i], (char *)image + 8 * i);
+        record("encode_byte_to_lsb", "payload", KERNEL_BYTES, now_seconds() - start);
+
+        start = now_seconds();
+        for (size_t i = 0; i < KERNEL_BYTES; i++)
+        {
+            char data;
+            decode_byte_from_lsb(&data, (char *)image + 8 * i);
+            sink ^= data;
+        }
+        record("decode_byte_from_lsb", "payload", KERNEL_BYTES, now_seconds() - start);
+
+        start = now_seconds();
+        for (size_t i = 0; i < KERNEL_BYTES / 4; i++)
+            encode_size_to_lsb((uint32_t)i, (char *)image + 32 * i);
+        record("encode_size_to_lsb", "payload", KERNEL_BYTES, now_seconds() - start);
+
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+        {
+            if (lsb_select_kernel(kernels[k]) != 0)
+                continue;
+            start = now_seconds();
+            lsb_embed(image, image, secret, KERNEL_BYTES);
+            snprintf(name, sizeof(name), "lsb_embed/%s", kernels[k]);
+            record(name, "payload", KERNEL_BYTES, now_seconds() - start);
+
+            start = now_seconds();
+            lsb_extract(secret, image, KERNEL_BYTES);
+            snprintf(name, sizeof(name), "lsb_extract/%s", kernels[k]);
+            record(name, "payload", KERNEL_BYTES, now_seconds() - start);
+        }
+        lsb_init();
+
+        for (int depth = 2; depth <= LSB_MAX_DEPTH; depth++)
+        {
+            size_t n = lsb_align_run(KERNEL_BYTES, depth);
+            start = now_seconds();
+            lsb_embed_for_depth(depth)(image, image, secret, n);
+            snprintf(name, sizeof(name), "lsb_embed/depth%d", depth);
+            record(name, "payload", n, now_seconds() - start);
+
+            start = now_seconds();
+            lsb_extract_for_depth(depth)(secret, image, n);
+            snprintf(name, sizeof(name), "lsb_extract/depth%d", depth);
+            record(name, "payload", n, now_seconds() - start);
+        }
+    }
+
+    (void)sink;
+    free(secret);
+    free(image);
+    return e_success;
+}
+
+/* Throughput of a result in MB/s */
+static double mb_per_s(const BenchResult *r)
+{
+    return r->seconds > 0 ? r->bytes / r->seconds / (1024.0 * 1024.0) : 0;
+}
+
+/* Print the results as a table and write them as JSON */
+static Status report_results(const BenchOptions *opts)
+{
+    printf("%-32s %10s %10s %12s\n", "Benchmark", "MB/s", "ns/byte", "Peak RSS KB");
+    for (int i = 0; i < num_results; i++)
+    {
+        const BenchResult *r = &results[i];
+        printf("%-32s %10.1f %10.3f %12ld\n", r->name, mb_per_s(r), r->seconds * 1e9 / r->bytes, r->peak_rss_kb);
+    }
+
+    FILE *out = fopen(opts->out_fname, "w");
+    if (out == NULL)
+    {
+        perror(opts->out_fname);
+        return e_failure;
+    }
+    fprintf(out, "{\n  \"kernel\": \"%s\",\n  \"results\": [\n", lsb_kernel_name());
+    for (int i = 0; i < num_results; i++)
+    {
+        const BenchResult *r = &results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"unit\": \"%s\", \"bytes\": %.0f, \"seconds\": %.6f, \"mb_per_s\": %.2f, "
+                "\"ns_per_byte\": %.4f, \"peak_rss_kb\": %ld}%s\n", r->name, r->unit, r->bytes, r->seconds,
+                mb_per_s(r), r->seconds * 1e9 / r->bytes, r->peak_rss_kb, i + 1 < num_results ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return fclose(out) == 0 ? e_success : e_failure;
+}
+
+/*
+ * Compare against a baseline written by an earlier run. Each result line
+ * holds one "name" and one "mb_per_s". Returns e_failure on a regression.
+*/
+static Status compare_baseline(const BenchOptions *opts)
+{
+    FILE *baseline = fopen(opts->baseline_fname, "r");
+    char line[1024];
+    int compared = 0, regressions = 0;
+
+    if (baseline == NULL)
+    {
+        perror(opts->baseline_fname);
+        return e_failure;
+    }
+
+    while (fgets(line, sizeof(line), baseline) != NULL)
+    {
+        char base_name[64];
+        double base_mb;
+        const char *name = strstr(line, "\"name\": \"");
+        const char *mb = strstr(line, "\"mb_per_s\": ");
+
+        if (name == NULL || mb == NULL || sscanf(name + 9, "%63[^\"]", base_name) != 1 ||
+            sscanf(mb + 12, "%lf", &base_mb) != 1 || base_mb <= 0)
+            continue;
+
+        for (int i = 0; i < num_results; i++)
+        {
+            if (strcmp(results[i].name, base_name) != 0)
+                continue;
+            double change = (mb_per_s(&results[i]) - base_mb) / base_mb * 100;
+            compared++;
+            if (change < -opts->threshold)
+            {
+                printf("REGRESSION %-32s %10.1f MB/s (baseline %.1f, %+.1f%%)\n", base_name, mb_per_s(&results[i]), base_mb, change);
+                regressions++;
+            }
+        }
+    }
+    fclose(baseline);
+
+    printf("Compared %d Results With %s: %d Regression(s) Past %.0f%%\n", compared, opts->baseline_fname, regressions, opts->threshold);
+    return regressions == 0 ? e_success : e_failure;
+}
+
+/* Parse "64K,1M,2G" into sizes */
+static Status parse_sizes(char *list, BenchOptions *opts)
+{
+    opts->num_sizes = 0;
+    for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        char *end;
+        long size = strtol(tok, &end, 10);
+
+        if (*end == 'K' || *end == 'k')
+            size <<= 10;
+        else if (*end == 'M' || *end == 'm')
+            size <<= 20;
+        else if (*end == 'G' || *end == 'g')
+            size <<= 30;
+        // BMP sizes are 32-bit, and the payload size field is a signed 32-bit value
+        if (size < 1024 || size > 0xFFFFFFFFL - 54 || opts->num_sizes == MAX_SIZES)
+            return e_failure;
+        opts->sizes[opts->num_sizes++] = size;
+    }
+    return opts->num_sizes > 0 ? e_success : e_failure;
+}
+
+int main(int argc, char *argv[])
+{
+    char default_sizes[] = "64K,1M,16M";
+    BenchOptions opts = { .dir = "/tmp", .repeat = 3, .out_fname = "bench.json", .threshold = 10 };
+    Status status = parse_sizes(default_sizes, &opts);
+
+    for (int i = 1; i < argc && status == e_success; i++)
+    {
+        int has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--sizes") == 0 && has_value)
+            status = parse_sizes(argv[++i], &opts);
+        else if (strcmp(argv[i], "--payload") == 0 && has_value)
+            opts.text_payload = strcmp(argv[++i], "text") == 0;
+        else if (strcmp(argv[i], "--dir") == 0 && has_value)
+            opts.dir = argv[++i];
+        else if (strcmp(argv[i], "--repeat") == 0 && has_value)
+            opts.repeat = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+        else if (strcmp(argv[i], "--out") == 0 && has_value)
+            opts.out_fname = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && has_value)
+            opts.baseline_fname = argv[++i];
+        else if (strcmp(argv[i], "--threshold") == 0 && has_value)
+            opts.threshold = atof(argv[++i]);
+        else
+            status = e_failure;
+    }
+    if (status != e_success)
+    {
+        printf("Usage: %s [--sizes 64K,1M,16M] [--payload random|text] [--dir DIR] [--repeat N]\n"
+               "       [--out FILE] [--baseline FILE] [--threshold PCT]\n", argv[0]);
+        return 2;
+    }
+
+    printf("LSB Kernel: %s\n", lsb_kernel_name());
+    status = bench_kernels(&opts);
+    for (int i = 0; i < opts.num_sizes && status == e_success; i++)
+    {
+        status = bench_full_runs(&opts, opts.sizes[i]);
+    }
+    if (status == e_success)
+        status = bench_archive_runs(&opts);
+    if (status == e_success)
+        status = report_results(&opts);
+    if (status != e_success)
+        return 2;
+    if (opts.baseline_fname != NULL && compare_baseline(&opts) != e_success)
+        return 1;
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * BMP Layout Engine
+ *
+ * Description:
+ * Parses the BMP file header and DIB header into a BmpLayout and moves cover
+ * bytes between the file layout and contiguous buffers. Cover positions run
+ * over the pixel array in file order, bottom-up and top-down images alike,
+ * so an unpadded 24-bit image with a 54-byte header embeds exactly where it
+ * always did.
+*/
+
+#include <string.h>
+#include "bmp.h"
+
+/* Compression values of biCompression */
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+
+/* Little-endian header fields */
+static uint32_t read_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t read_le16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/* Parse the BMP header into a layout */
+Status bmp_parse_layout(const unsigned char *header, size_t len, BmpLayout *layout)
+{
+    if (header == NULL || len < BMP_HEADER_SIZE || header[0] != 'B' || header[1] != 'M')
+        return e_failure;
+
+    uint32_t data_offset = read_le32(header + 10);
+    uint32_t dib_size = read_le32(header + 14);
+    int32_t width = (int32_t)read_le32(header + 18);
+    int32_t height = (int32_t)read_le32(header + 22);
+    uint16_t bits = read_le16(header + 28);
+    uint32_t compression = read_le32(header + 30);
+
+    /* OS/2 core headers have 16-bit dimensions; everything from BITMAPINFOHEADER on shares the fields above */
+    if (dib_size < 40 || data_offset < 14 + dib_size)
+        return e_failure;
+    if (width <= 0 || height == 0 || height == INT32_MIN)
+        return e_failure;
+    if (!(bits == 24 && compression == BI_RGB) && !(bits == 32 && (compression == BI_RGB || compression == BI_BITFIELDS)))
+        return e_failure;
+
+    memset(layout, 0, sizeof(*layout));
+    layout->data_offset = data_offset;
+    layout->width = width;
+    layout->height = height < 0 ? -(int64_t)height : height;
+    layout->top_down = height < 0;
+    layout->bits_per_pixel = bits;
+    layout->stride = ((uint64_t)width * bits + 31) / 32 * 4;
+
+    /* Refuse pixel arrays no file offset can reach */
+    if (layout->stride > ((uint64_t)INT64_MAX - data_offset) / layout->height)
+        return e_failure;
+
+    size_t row_bytes = (size_t)layout->width * 3;
+    layout->capacity = row_bytes * layout->height;
+    if (bits == 24 && layout->stride != row_bytes)
+    {
+        /* Padded rows: one span per row */
+        layout->num_spans = layout->height;
+        layout->span_bytes = row_bytes;
+        layout->span_pitch = layout->stride;
+    }
+    else
+    {
+        /* Rows follow each other directly: the whole pixel array is one span */
+        layout->num_spans = 1;
+        layout->span_bytes = layout->capacity;
+        layout->span_pitch = layout->stride * layout->height;
+    }
+    return e_success;
+}
+
+/* Offset within a span of its cover byte in */
+static size_t span_offset(const BmpLayout *layout, size_t in)
+{
+    return layout->bits_per_pixel == 32 ? in / 3 * 4 + in % 3 : in;
+}
+
+/* File offset of a cover byte */
+off_t bmp_offset(const BmpLayout *layout, size_t pos)
+{
+    size_t span = pos / layout->span_bytes;
+    size_t in = pos % layout->span_bytes;
+
+    return (off_t)layout->data_offset + (off_t)(span * layout->span_pitch + span_offset(layout, in));
+}
+
+/*
+ * Copy n cover bytes of a 32-bit span between raw, the file byte of the
+ * first one, and cover. lead is its place within its pixel. Whole pixels
+ * move 3 bytes at a time with no per-byte branches.
+*/
+static void move_pixels(unsigned char *raw, unsigned char *cover, size_t lead, size_t n, int to_raw)
+{
+    /* Finish the pixel the run starts in */
+    if (lead > 0)
+    {
+        size_t count = 3 - lead < n ? 3 - lead : n;
+        if (to_raw)
+            memcpy(raw, cover, count);
+        else
+            memcpy(cover, raw, count);
+        raw += count + 1;
+        cover += count;
+        n -= count;
+    }
+
+    if (to_raw)
+    {
+        for (; n >= 3; n -= 3, raw += 4, cover += 3)
+        {
+            raw[0] = cover[0];
+            raw[1] = cover[1];
+            raw[2] = cover[2];
+        }
+        memcpy(raw, cover, n);
+    }
+    else
+    {
+        for (; n >= 3; n -= 3, raw += 4, cover += 3)
+        {
+            cover[0] = raw[0];
+            cover[1] = raw[1];
+            cover[2] = raw[2];
+        }
+        memcpy(cover, raw, n);
+    }
+}
+
+/* Copy n cover bytes from pos on between the file bytes in raw and cover, span by span */
+static void move_cover(const BmpLayout *layout, size_t pos, size_t n, unsigned char *raw, unsigned char *cover, int to_raw)
+{
+    size_t in = pos % layout->span_bytes;
+
+    while (n > 0)
+    {
+        size_t piece = layout->span_bytes - in < n ? layout->span_bytes - in : n;
+
+        if (layout->bits_per_pixel == 32)
+            move_pixels(raw, cover, in % 3, piece, to_raw);
+        else if (to_raw)
+            memcpy(raw, cover, piece);
+        else
+            memcpy(cover, raw, piece);
+
+        /* On to the first byte of the next span */
+        cover += piece;
+        n -= piece;
+        if (n > 0)
+            raw += layout->span_pitch - span_offset(layout, in);
+        in = 0;
+    }
+}
+
+/* Copy cover bytes out of the file layout */
+void bmp_gather(const BmpLayout *layout, size_t pos, size_t n, const unsigned char *raw, unsigned char *cover)
+{
+    move_cover(layout, pos, n, (unsigned char *)raw, cover, 0);
+}
+
+/* Copy cover bytes back into the file layout */
+void bmp_scatter(const BmpLayout *layout, size_t pos, size_t n, const unsigned char *cover, unsigned char *raw)
+{
+    move_cover(layout, pos, n, raw, (unsigned char *)cover, 1);
+}
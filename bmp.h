@@ -0,0 +1,93 @@
+/*
+ * Header file for the BMP layout engine
+ *
+ * Description:
+ * The payload is embedded in the cover bytes of an image: the colour bytes
+ * of its pixel array, in file order. Row padding and the alpha byte of
+ * 32-bit pixels are not cover bytes, and neither is anything before
+ * bfOffBits (file header, DIB header, bit masks) or after the pixel array.
+ *
+ * A BmpLayout is parsed once from the header and maps a cover position
+ * (0 .. capacity) to a file offset through a span table. A span is a run of
+ * rows that follow each other in the file with no padding in between, so an
+ * unpadded 24-bit image is a single span of width * height * 3 bytes that
+ * the LSB kernels run over in place. Padded rows are one span each, and a
+ * 32-bit span holds 3 cover bytes per 4 file bytes. All spans are alike, so
+ * the table is kept as a count, a length and a pitch rather than an array.
+ *
+ * Layouts that are not one plain span are gathered into a contiguous buffer
+ * before the kernels run and scattered back afterwards.
+*/
+
+#ifndef BMP_H
+#define BMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "types.h"
+
+/* Bytes of the BMP file header and BITMAPINFOHEADER, the least a layout is parsed from */
+#define BMP_HEADER_SIZE 54
+
+/*
+ * File bytes spanned by n cover bytes at most: each padding or alpha byte
+ * follows at least 3 cover bytes, and an extent may end on one more gap
+*/
+#define BMP_EXTENT_BOUND(n) ((n) + (n) / 3 + 4)
+
+/* Pixel layout of one image */
+typedef struct
+{
+    uint32_t data_offset;       // bfOffBits: file offset of the pixel array
+    uint32_t width;
+    uint32_t height;            // Rows, whatever the sign of biHeight
+    int top_down;               // biHeight is negative: the top row comes first in the file
+    int bits_per_pixel;         // 24 or 32
+    size_t stride;              // File bytes per row, padding included
+
+    /* Span table: span i starts at file offset data_offset + i * span_pitch */
+    size_t num_spans;
+    size_t span_bytes;          // Cover bytes per span
+    size_t span_pitch;          // File bytes from the start of one span to the next
+    size_t capacity;            // Cover bytes of the whole image
+} BmpLayout;
+
+/*
+ * Parse the first len bytes of an image (at least BMP_HEADER_SIZE) into
+ * layout. Uncompressed 24-bit and 32-bit images (BI_RGB, or BI_BITFIELDS at
+ * 32 bits) with any DIB header from BITMAPINFOHEADER on are accepted.
+*/
+Status bmp_parse_layout(const unsigned char *header, size_t len, BmpLayout *layout);
+
+/* Whether cover bytes are file bytes, so the kernels can run on the image directly */
+static inline int bmp_is_contiguous(const BmpLayout *layout)
+{
+    return layout->num_spans == 1 && layout->bits_per_pixel == 24;
+}
+
+/* File offset just past the pixel array */
+static inline off_t bmp_end(const BmpLayout *layout)
+{
+    return (off_t)layout->data_offset + (off_t)layout->num_spans * layout->span_pitch;
+}
+
+/* File offset of cover byte pos (pos == capacity: the end of the pixel array) */
+off_t bmp_offset(const BmpLayout *layout, size_t pos);
+
+/*
+ * File bytes from cover byte pos up to cover byte pos + n. The extents of
+ * consecutive runs follow each other, padding and alpha bytes included.
+*/
+static inline size_t bmp_extent(const BmpLayout *layout, size_t pos, size_t n)
+{
+    return bmp_offset(layout, pos + n) - bmp_offset(layout, pos);
+}
+
+/* Copy the n cover bytes from pos on out of raw, the file bytes from bmp_offset(pos) */
+void bmp_gather(const BmpLayout *layout, size_t pos, size_t n, const unsigned char *raw, unsigned char *cover);
+
+/* Copy n cover bytes back into raw, leaving its padding and alpha bytes alone */
+void bmp_scatter(const BmpLayout *layout, size_t pos, size_t n, const unsigned char *cover, unsigned char *raw);
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * Chunk Index
+ *
+ * Description:
+ * Builds, serializes and validates the chunk index of an indexed payload.
+ * Checksums are accumulated while the payload streams through the encoder
+ * or decoder, in pieces of any size, so no extra pass over the data is needed.
+*/
+
+#include <stdlib.h>
+#include "chunkidx.h"
+#include "crc32c.h"
+
+/* Number of chunks covering size bytes */
+long chunk_index_count(long size, uint32_t chunk_size)
+{
+    return (size + chunk_size - 1) / chunk_size;
+}
+
+/* Allocate the index of a size-byte payload */
+Status chunk_index_init(ChunkIndex *index, long size, uint32_t chunk_size, size_t entry_size)
+{
+    if (chunk_size == 0 || size < 0 || (entry_size != INDEX_ENTRY_SIZE && entry_size != INDEX_ENTRY_SIZE_64))
+        return e_failure;
+    /* 32-bit offsets cannot address chunks past 4 GiB */
+    if (entry_size == INDEX_ENTRY_SIZE && size > UINT32_MAX)
+        return e_failure;
+
+    index->chunk_size = chunk_size;
+    index->num_chunks = chunk_index_count(size, chunk_size);
+    index->entry_size = entry_size;
+    index->offset = calloc((size_t)index->num_chunks + 1, sizeof(uint64_t));
+    index->length = calloc(2 * (size_t)index->num_chunks + 1, sizeof(uint32_t));
+    if (index->offset == NULL || index->length == NULL)
+    {
+        chunk_index_free(index);
+        return e_failure;
+    }
+    index->crc = index->length + index->num_chunks;
+
+    for (long i = 0; i < index->num_chunks; i++)
+    {
+        long begin = i * (long)chunk_size;
+        index->offset[i] = begin;
+        index->length[i] = size - begin < chunk_size ? size - begin : chunk_size;
+    }
+    return e_success;
+}
+
+/* Free the arrays of the index */
+void chunk_index_free(ChunkIndex *index)
+{
+    free(index->offset);
+    free(index->length);
+    index->offset = NULL;
+    index->length = index->crc = NULL;
+    index->num_chunks = 0;
+}
+
+/* Extend the per-chunk checksums with n bytes at payload offset pos */
+void chunk_index_update(uint32_t *crcs, uint32_t chunk_size, long pos, const unsigned char *data, size_t n)
+{
+    while (n > 0)
+    {
+        long chunk = pos / chunk_size;
+        size_t room = (chunk + 1) * (long)chunk_size - pos;
+        size_t run = n < room ? n : room;
+
+        crcs[chunk] = crc32c(crcs[chunk], data, run);
+        pos += run;
+        data += run;
+        n -= run;
+    }
+}
+
+/* Store a 32-bit value big-endian */
+static void store_be32(unsigned char *out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+/* Load a big-endian 32-bit value */
+static uint32_t load_be32(const unsigned char *in)
+{
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+/* Serialize the entries */
+void chunk_index_store(const ChunkIndex *index, unsigned char *out)
+{
+    size_t wide = index->entry_size - INDEX_ENTRY_SIZE;
+
+    for (long i = 0; i < index->num_chunks; i++, out += index->entry_size)
+    {
+        if (wide)
+            store_be32(out, index->offset[i] >> 32);
+        store_be32(out + wide, index->offset[i]);
+        store_be32(out + wide + 4, index->length[i]);
+        store_be32(out + wide + 8, index->crc[i]);
+    }
+}
+
+/* Read serialized entries and check them against the payload layout */
+Status chunk_index_load(ChunkIndex *index, const unsigned char *in)
+{
+    size_t wide = index->entry_size - INDEX_ENTRY_SIZE;
+
+    for (long i = 0; i < index->num_chunks; i++, in += index->entry_size)
+    {
+        uint64_t offset = wide ? (uint64_t)load_be32(in) << 32 | load_be32(in + 4) : load_be32(in);
+        if (offset != index->offset[i] || load_be32(in + wide + 4) != index->length[i])
+            return e_failure;
+        index->crc[i] = load_be32(in + wide + 8);
+    }
+    return e_success;
+}
@@ -0,0 +1,69 @@
+/*
+ * Header file for the chunk index
+ *
+ * Description:
+ * An indexed payload is split into chunks of chunk_size bytes (the last one
+ * may be shorter). The index stores, for every chunk, its offset and length
+ * within the data field and the CRC32C of its bytes, so a byte range can be
+ * decoded and verified without touching the chunks around it.
+ *
+ * In the image the index is two fields of the extended frame, written after
+ * the file size when FRAME_FLAG_INDEX is set:
+ *     chunk size (4 bytes)
+ *     entries: offset, length, crc (4 bytes each, big-endian) per chunk
+ * In a FRAME_VERSION_64 frame the offset takes 8 bytes.
+*/
+
+#ifndef CHUNKIDX_H
+#define CHUNKIDX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/* Default chunk size, rounded down to a whole group at the payload depth */
+#define INDEX_CHUNK_SIZE (64 * 1024)
+
+/* Bytes of one serialized entry, with 32-bit and 64-bit offsets */
+#define INDEX_ENTRY_SIZE 12
+#define INDEX_ENTRY_SIZE_64 16
+
+typedef struct
+{
+    uint32_t chunk_size;    // Payload bytes per chunk
+    long num_chunks;        // Number of chunks
+    size_t entry_size;      // Bytes of one serialized entry (INDEX_ENTRY_SIZE or INDEX_ENTRY_SIZE_64)
+    uint64_t *offset;       // Offset of each chunk in the data field
+    uint32_t *length;       // Length of each chunk
+    uint32_t *crc;          // CRC32C of each chunk
+} ChunkIndex;
+
+/* Number of chunks of chunk_size bytes covering size bytes */
+long chunk_index_count(long size, uint32_t chunk_size);
+
+/*
+ * Allocate the index of a size-byte payload, serialized with entries of
+ * entry_size bytes. Offsets and lengths describe consecutive chunks;
+ * checksums start at 0.
+*/
+Status chunk_index_init(ChunkIndex *index, long size, uint32_t chunk_size, size_t entry_size);
+
+/* Free the arrays of the index */
+void chunk_index_free(ChunkIndex *index);
+
+/*
+ * Extend the per-chunk checksums in crcs with n payload bytes starting at
+ * payload offset pos. Updates for different chunks may run concurrently.
+*/
+void chunk_index_update(uint32_t *crcs, uint32_t chunk_size, long pos, const unsigned char *data, size_t n);
+
+/* Serialize the entries (num_chunks * entry_size bytes) */
+void chunk_index_store(const ChunkIndex *index, unsigned char *out);
+
+/*
+ * Read serialized entries into an index set up by chunk_index_init() and
+ * check they describe the consecutive chunks of the payload.
+*/
+Status chunk_index_load(ChunkIndex *index, const unsigned char *in);
+
+#endif
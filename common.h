@@ -18,4 +18,44 @@
 */
 #define MAGIC_STRING "#*"
 
+/*
+ * Extended frame, used when the payload is embedded deeper than 1 bit per
+ * image byte, sets a flag or needs 64-bit sizes. MAGIC_STRING_EXT is followed by FRAME_HEADER_SIZE bytes at
+ * 1 bit per image byte: FRAME_VERSION, the depth (bits per image byte for
+ * everything after the header) and a flags byte (FRAME_FLAG_*). The
+ * extension size, extension, file size, shard header, chunk index and
+ * archive directory (if flagged) and data follow at that depth, each field starting on a
+ * fresh image byte.
+ *
+ * FRAME_VERSION stores the file size and chunk index offsets in 32 bits.
+ * FRAME_VERSION_64 stores them in 64 bits; it is written only for payloads
+ * larger than FRAME_V1_MAX_SIZE, which the legacy frame cannot describe
+ * either, so smaller payloads keep their old layout.
+*/
+#define MAGIC_STRING_EXT "#+"
+#define FRAME_VERSION 1
+#define FRAME_VERSION_64 2
+#define FRAME_V1_MAX_SIZE 0x7FFFFFFFL
+#define FRAME_HEADER_SIZE 3
+
+/* Frame flags */
+#define FRAME_FLAG_INDEX 0x01   // A chunk index precedes the data (see chunkidx.h)
+#define FRAME_FLAG_ARCHIVE 0x02 // A member directory precedes the data (see archive.h)
+#define FRAME_FLAG_COMPRESS 0x04 // The data is a series of compressed blocks (see compress.h)
+#define FRAME_FLAG_CHECKSUM 0x08 // A CRC32C of the whole payload follows the file size
+#define FRAME_FLAG_SHARD 0x10   // The payload is one shard of a larger one; a shard header follows the checksum (see shard.h)
+#define FRAME_FLAGS_KNOWN (FRAME_FLAG_INDEX | FRAME_FLAG_ARCHIVE | FRAME_FLAG_COMPRESS | FRAME_FLAG_CHECKSUM | FRAME_FLAG_SHARD)
+
+/*
+ * Buffer sizes shared by the encoder and decoder.
+ * Every secret byte occupies at most 8 image bytes (1 bit per byte), so one
+ * image block of MAX_IMAGE_BUF_SIZE (1 MiB) carries MAX_SECRET_BUF_SIZE secret
+ * bytes at any depth.
+*/
+#define MAX_SECRET_BUF_SIZE (128 * 1024)
+#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
+
+/* Longest secret file extension (including the dot) stored in the image */
+#define MAX_FILE_SUFFIX 8
+
 #endif /* COMMON_H */
@@ -0,0 +1,198 @@
+/*
+ * Block Compressor
+ *
+ * Description:
+ * Greedy LZ77 over a 4-byte hash table, writing the LZ4 block format.
+ * The decompressor checks every length and offset against its input and
+ * output, so a corrupt image cannot make it read or write out of bounds.
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include "compress.h"
+
+/* Shortest match, and the format's end-of-block rules */
+#define MIN_MATCH 4
+#define LAST_LITERALS 5     // The last bytes of a block are always literals
+#define MATCH_LIMIT 12      // No match starts within this many bytes of the end
+
+/* Hash table of 4096 positions (fits the 16-bit positions of one block) */
+#define HASH_BITS 12
+
+static inline uint32_t load32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Length of the common prefix of a and b, comparing b up to limit */
+static size_t match_length(const unsigned char *a, const unsigned char *b, const unsigned char *limit)
+{
+    const unsigned char *start = b;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (b + 8 <= limit)
+    {
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if (x != y)
+            return b - start + (__builtin_ctzll(x ^ y) >> 3);
+        a += 8;
+        b += 8;
+    }
+#endif
+    while (b < limit && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return b - start;
+}
+
+/* Write len as the 255-run continuing a saturated nibble */
+static unsigned char *put_length(unsigned char *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/*
+ * Append one sequence: lit_len literals, then a match of match_len bytes at
+ * offset back (match_len 0 ends the block). Returns NULL if it overflows oend.
+*/
+static unsigned char *put_sequence(unsigned char *op, unsigned char *oend, const unsigned char *lit, size_t lit_len,
+                                   size_t offset, size_t match_len)
+{
+    size_t extra = match_len >= MIN_MATCH ? match_len - MIN_MATCH : 0;
+    size_t worst = 1 + lit_len / 255 + 1 + lit_len + 2 + extra / 255 + 1;
+    unsigned char *token = op++;
+
+    if (worst > (size_t)(oend - token))
+        return NULL;
+
+    *token = (unsigned char)((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15)
+        op = put_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len > 0)
+    {
+        *op++ = (unsigned char)offset;
+        *op++ = (unsigned char)(offset >> 8);
+        *token |= extra < 15 ? extra : 15;
+        if (extra >= 15)
+            op = put_length(op, extra - 15);
+    }
+    return op;
+}
+
+/* Compress n bytes of src into at most cap bytes of dst */
+size_t compress_block(const unsigned char *src, size_t n, unsigned char *dst, size_t cap)
+{
+    uint16_t table[1 << HASH_BITS] = { 0 };
+    const unsigned char *match_end = src + (n > LAST_LITERALS ? n - LAST_LITERALS : 0);
+    unsigned char *op = dst;
+    unsigned char *oend = dst + cap;
+    size_t anchor = 0;
+
+    if (n > COMPRESS_BLOCK_SIZE)
+        return 0;
+
+    for (size_t ip = 0; n >= MATCH_LIMIT && ip <= n - MATCH_LIMIT; )
+    {
+        uint32_t v = load32(src + ip);
+        uint32_t h = hash4(v);
+        size_t ref = table[h];
+
+        table[h] = (uint16_t)ip;
+        if (ref >= ip || load32(src + ref) != v)
+        {
+            // Step faster through data that keeps failing to match
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        size_t len = MIN_MATCH + match_length(src + ref + MIN_MATCH, src + ip + MIN_MATCH, match_end);
+        op = put_sequence(op, oend, src + anchor, ip - anchor, ip - ref, len);
+        if (op == NULL)
+            return 0;
+        ip += len;
+        anchor = ip;
+    }
+
+    op = put_sequence(op, oend, src + anchor, n - anchor, 0, 0);
+    return op != NULL ? (size_t)(op - dst) : 0;
+}
+
+/* Read the 255-run continuing a saturated nibble */
+static int get_length(const unsigned char *src, size_t n, size_t *ip, size_t *len)
+{
+    unsigned char b;
+    do
+    {
+        if (*ip >= n)
+            return -1;
+        b = src[(*ip)++];
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/* Decompress the n-byte block in src into at most cap bytes of dst */
+long decompress_block(const unsigned char *src, size_t n, unsigned char *dst, size_t cap)
+{
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < n)
+    {
+        unsigned char token = src[ip++];
+        size_t lit_len = token >> 4;
+        size_t match_len = token & 15;
+
+        if (lit_len == 15 && get_length(src, n, &ip, &lit_len) != 0)
+            return -1;
+        if (lit_len > n - ip || lit_len > cap - op)
+            return -1;
+        memcpy(dst + op, src + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        // The last sequence has literals only
+        if (ip == n)
+            break;
+
+        if (n - ip < 2)
+            return -1;
+        size_t offset = src[ip] | (size_t)src[ip + 1] << 8;
+        ip += 2;
+        if (match_len == 15 && get_length(src, n, &ip, &match_len) != 0)
+            return -1;
+        match_len += MIN_MATCH;
+        if (offset == 0 || offset > op || match_len > cap - op)
+            return -1;
+
+        // Matches may overlap their own output (runs), so copy forward
+        if (offset >= match_len)
+        {
+            memcpy(dst + op, dst + op - offset, match_len);
+        }
+        else
+        {
+            for (size_t i = 0; i < match_len; i++)
+                dst[op + i] = dst[op + i - offset];
+        }
+        op += match_len;
+    }
+    return (long)op;
+}
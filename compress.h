@@ -0,0 +1,44 @@
+/*
+ * Header file for the block compressor
+ *
+ * Description:
+ * A small LZ77 compressor producing the LZ4 block format: sequences of a
+ * token byte (literal length and match length nibbles, extended by 255-runs),
+ * the literals and a 2-byte little-endian match offset. Blocks hold at most
+ * COMPRESS_BLOCK_SIZE bytes and are compressed independently, so a payload
+ * streams through in bounded memory.
+ *
+ * A compressed payload (FRAME_FLAG_COMPRESS) is a series of blocks, each a
+ * 4-byte big-endian header followed by the block bytes. The header holds the
+ * stored length, with COMPRESS_STORED set when the block is kept as is
+ * because it did not shrink. Every block except the last covers
+ * COMPRESS_BLOCK_SIZE payload bytes.
+*/
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+
+/* Payload bytes per block (match offsets fit 16 bits) */
+#define COMPRESS_BLOCK_SIZE (64 * 1024)
+
+/* Bytes of a block header */
+#define COMPRESS_HEADER_SIZE 4
+
+/* Header flag of a block stored uncompressed */
+#define COMPRESS_STORED 0x80000000u
+
+/*
+ * Compress n bytes (at most COMPRESS_BLOCK_SIZE) of src into dst.
+ * Returns the compressed size, or 0 if it would exceed cap bytes.
+*/
+size_t compress_block(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+
+/*
+ * Decompress the n-byte block in src into at most cap bytes of dst.
+ * Returns the decompressed size, or -1 if the block is malformed.
+*/
+long decompress_block(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * Cover Cache
+ *
+ * Description:
+ * A doubly linked list in recency order, searched from the front under one
+ * lock; the cache holds a handful of covers, not thousands. Covers are
+ * mapped read-only with MAP_POPULATE outside the lock, so a miss on one
+ * cover does not hold up hits on the others. Mappings share the page
+ * cache, so a cached cover costs no memory beyond the file's own pages.
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "covercache.h"
+
+/* Set up an empty cache of capacity bytes */
+Status cover_cache_init(CoverCache *cache, size_t capacity)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->capacity = capacity;
+    return pthread_mutex_init(&cache->lock, NULL) == 0 ? e_success : e_failure;
+}
+
+/* Unmap and free an entry */
+static void entry_free(CoverEntry *entry)
+{
+    munmap(entry->data, entry->size);
+    free(entry);
+}
+
+/* Whether an entry was made from the file state st */
+static int entry_matches(const CoverEntry *entry, const struct stat *st)
+{
+    return entry->size == st->st_size &&
+           entry->mtime.tv_sec == st->st_mtim.tv_sec && entry->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+           entry->ctime.tv_sec == st->st_ctim.tv_sec && entry->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+/* Unlink an entry from the list */
+static void entry_unlink(CoverCache *cache, CoverEntry *entry)
+{
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+/* Link an entry in as the most recently used */
+static void entry_push(CoverCache *cache, CoverEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL)
+        cache->head->prev = entry;
+    else
+        cache->tail = entry;
+    cache->head = entry;
+}
+
+/* Drop an entry from the cache; it is freed now or by its last holder */
+static void entry_evict(CoverCache *cache, CoverEntry *entry)
+{
+    entry_unlink(cache, entry);
+    entry->cached = 0;
+    cache->used -= entry->size;
+    if (entry->refs == 0)
+        entry_free(entry);
+}
+
+/* Find the cached entry of a file (matching or stale), under the lock */
+static CoverEntry *entry_find(CoverCache *cache, const struct stat *st)
+{
+    for (CoverEntry *entry = cache->head; entry != NULL; entry = entry->next)
+    {
+        if (entry->dev == st->st_dev && entry->ino == st->st_ino)
+            return entry;
+    }
+    return NULL;
+}
+
+/* Parse and map the cover open on fd, whose state is st */
+static CoverEntry *entry_load(int fd, const struct stat *st)
+{
+    unsigned char header[BMP_HEADER_SIZE];
+    BmpLayout layout;
+
+    /* Images that are not covers are turned away before any of their pixels is read */
+    if (pread(fd, header, sizeof(header), 0) != sizeof(header) || bmp_parse_layout(header, sizeof(header), &layout) != e_success)
+        return NULL;
+
+    CoverEntry *entry = calloc(1, sizeof(CoverEntry));
+    if (entry == NULL)
+        return NULL;
+    entry->layout = layout;
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim;
+    entry->ctime = st->st_ctim;
+
+    entry->data = mmap(NULL, entry->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (entry->data == MAP_FAILED)
+    {
+        free(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+/* Get a cover from the cache, mapping it on a miss */
+CoverEntry *cover_cache_acquire(CoverCache *cache, const char *path, int fd)
+{
+    struct stat st;
+    int own_fd = -1;
+
+    if (fd < 0 ? stat(path, &st) != 0 : fstat(fd, &st) != 0)
+        return NULL;
+    if (!S_ISREG(st.st_mode) || st.st_size < BMP_HEADER_SIZE || (uintmax_t)st.st_size > cache->capacity)
+        return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    CoverEntry *entry = entry_find(cache, &st);
+    if (entry != NULL && entry_matches(entry, &st))
+    {
+        entry_unlink(cache, entry);
+        entry_push(cache, entry);
+        entry->refs++;
+        cache->hits++;
+        pthread_mutex_unlock(&cache->lock);
+        return entry;
+    }
+    /* The file changed since it was cached */
+    if (entry != NULL)
+        entry_evict(cache, entry);
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    /* Key the entry on the file actually opened, which may differ from the one stat() saw */
+    if (fd < 0)
+    {
+        if ((own_fd = fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+            return NULL;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < BMP_HEADER_SIZE ||
+            (uintmax_t)st.st_size > cache->capacity)
+        {
+            close(own_fd);
+            return NULL;
+        }
+    }
+    entry = entry_load(fd, &st);
+    if (own_fd >= 0)
+        close(own_fd);
+    if (entry == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    /* Another thread may have cached the same cover meanwhile */
+    CoverEntry *other = entry_find(cache, &st);
+    if (other != NULL && entry_matches(other, &st))
+    {
+        entry_free(entry);
+        entry = other;
+        entry_unlink(cache, entry);
+    }
+    else
+    {
+        if (other != NULL)
+            entry_evict(cache, other);
+        entry->cached = 1;
+        cache->used += entry->size;
+    }
+    entry_push(cache, entry);
+    entry->refs++;
+
+    /* Evict from the cold end down to the capacity; the new entry alone always fits */
+    while (cache->used > cache->capacity && cache->tail != entry)
+        entry_evict(cache, cache->tail);
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+/* Give back an entry, freeing it if it was evicted while held */
+void cover_cache_release(CoverCache *cache, CoverEntry *entry)
+{
+    pthread_mutex_lock(&cache->lock);
+    if (--entry->refs == 0 && !entry->cached)
+        entry_free(entry);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* Unmap every cover */
+void cover_cache_destroy(CoverCache *cache)
+{
+    while (cache->head != NULL)
+        entry_evict(cache, cache->head);
+    pthread_mutex_destroy(&cache->lock);
+}
@@ -0,0 +1,75 @@
+/*
+ * Header file for the cover cache
+ *
+ * Description:
+ * Workloads that embed many payloads into the same few covers pay for
+ * every cover again on every encode: open it, read and parse its header
+ * and read every pixel byte. A CoverCache keeps covers that were used
+ * recently parsed and mapped, so an encode into a cached cover starts
+ * embedding straight away and its only I/O is writing the stego image.
+ *
+ * Entries are keyed by device, inode, size and modification and change
+ * times. A cover that was rewritten since it was cached misses and its old
+ * entry is dropped. The cache holds at most capacity mapped bytes and
+ * evicts the least recently used covers beyond that. One cache may be
+ * shared by any number of threads. Entries stay valid while an encode
+ * holds them, even once they have been evicted.
+*/
+
+#ifndef COVERCACHE_H
+#define COVERCACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include "types.h"
+#include "bmp.h"
+
+/* One cached cover */
+typedef struct CoverEntry
+{
+    /* Key: the file and its state when it was mapped */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+
+    BmpLayout layout;               // Parsed header, capacity included
+    unsigned char *data;            // Read-only mapping of the whole file (size bytes)
+    int refs;                       // Encodes holding the entry
+    int cached;                     // Still in the cache (freed once evicted and unused)
+    struct CoverEntry *prev;        // More recently used
+    struct CoverEntry *next;        // Less recently used
+} CoverEntry;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    size_t capacity;                // Mapped bytes kept at most
+    size_t used;                    // Mapped bytes of the cached entries
+    CoverEntry *head;               // Most recently used
+    CoverEntry *tail;               // Least recently used
+    long hits;
+    long misses;
+} CoverCache;
+
+/* Set up an empty cache of capacity bytes */
+Status cover_cache_init(CoverCache *cache, size_t capacity);
+
+/* Unmap every cover; none may still be held */
+void cover_cache_destroy(CoverCache *cache);
+
+/*
+ * Get the cover open on fd (or, with fd < 0, the one at path), mapping and
+ * parsing it on a miss. Returns NULL for covers that cannot be cached (not
+ * a regular file, not a supported BMP, larger than the cache); the caller
+ * then reads the cover itself.
+*/
+CoverEntry *cover_cache_acquire(CoverCache *cache, const char *path, int fd);
+
+/* Give back an entry from cover_cache_acquire() */
+void cover_cache_release(CoverCache *cache, CoverEntry *entry);
+
+#endif
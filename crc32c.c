@@ -0,0 +1,178 @@
+/*
+ * CRC32C Checksums
+ *
+ * Description:
+ * CRC-32C (reflected polynomial 0x82F63B78). CPUs with SSE4.2 use the crc32
+ * instruction, 8 bytes per step; others use slicing-by-8 tables, which also
+ * consume 8 bytes per step with eight table lookups. The implementation and
+ * the tables are set up once by a startup constructor.
+*/
+
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_CRC32_INSN 1
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82F63B78u
+
+/* crc_table[k][b]: CRC of byte b followed by k zero bytes */
+static uint32_t crc_table[8][256];
+
+/*
+ * x^(2^k) mod P, for combining checksums. Unlike zlib's CRC-32 table these
+ * powers do not repeat every 32 entries under the CRC32C polynomial, so
+ * there is one per bit of a byte count in bits (8 * SIZE_MAX).
+*/
+#define X2N_TERMS (3 + 64)
+static uint32_t x2n_table[X2N_TERMS];
+
+/* Update the raw (unconditioned) CRC with slicing-by-8 */
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t n)
+{
+    while (n > 0 && ((uintptr_t)p & 7) != 0)
+    {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        n--;
+    }
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= crc;
+        crc = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^
+              crc_table[5][(lo >> 16) & 0xFF] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+              crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+    }
+    while (n-- > 0)
+    {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef HAVE_CRC32_INSN
+/* Update the raw CRC with the SSE4.2 crc32 instruction */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t n)
+{
+    while (n > 0 && ((uintptr_t)p & 7) != 0)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+        n--;
+    }
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (; n >= 4; n -= 4, p += 4)
+    {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+    while (n-- > 0)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static uint32_t (*crc32c_update)(uint32_t crc, const unsigned char *p, size_t n) = crc32c_sw;
+
+/* Extend crc over n bytes of data */
+uint32_t crc32c(uint32_t crc, const void *data, size_t n)
+{
+    return ~crc32c_update(~crc, data, n);
+}
+
+/* a * b modulo P (reflected bit order) */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+
+    while (m != 0 && a != 0)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            a ^= m;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/* Multiply crc by x^(8 * n), as if n bytes followed it */
+uint32_t crc32c_shift(uint32_t crc, size_t n)
+{
+    for (int k = 3; n != 0; n >>= 1, k++)
+    {
+        if (n & 1)
+            crc = multmodp(x2n_table[k], crc);
+    }
+    return crc;
+}
+
+/* Checksum of a followed by b, from the checksums of a and b */
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b)
+{
+    return crc32c_shift(crc_a, len_b) ^ crc_b;
+}
+
+/* Name of the active implementation */
+const char *crc32c_impl_name(void)
+{
+    return crc32c_update == crc32c_sw ? "slicing-by-8" : "sse4.2";
+}
+
+/* Build the tables and pick the implementation before main() */
+__attribute__((constructor))
+static void crc32c_startup(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++)
+        {
+            crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+        }
+        crc_table[0][i] = crc;
+    }
+    for (int k = 1; k < 8; k++)
+    {
+        for (int i = 0; i < 256; i++)
+            crc_table[k][i] = crc_table[0][crc_table[k - 1][i] & 0xFF] ^ (crc_table[k - 1][i] >> 8);
+    }
+
+    uint32_t p = 1u << 30;      // x^1
+    for (int k = 0; k < X2N_TERMS; k++)
+    {
+        x2n_table[k] = p;
+        p = multmodp(p, p);
+    }
+
+#ifdef HAVE_CRC32_INSN
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_update = crc32c_hw;
+#endif
+}
@@ -0,0 +1,36 @@
+/*
+ * Header file for CRC32C
+ *
+ * Description:
+ * CRC-32C (Castagnoli polynomial, as used by iSCSI, ext4 and SCTP) checksums
+ * for the chunk index, archive members and whole payloads. The value can be
+ * extended piece by piece: crc32c(crc32c(0, a, na), b, nb) equals the
+ * checksum of a followed by b.
+*/
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Extend crc (0 to start) over n bytes of data */
+uint32_t crc32c(uint32_t crc, const void *data, size_t n);
+
+/*
+ * Checksum of a followed by b, given the checksum of each and the length of b.
+ * Pieces checksummed on different threads can be joined this way.
+*/
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b);
+
+/*
+ * The part of crc32c_combine() that depends on crc_a: joining pieces is
+ * linear, so the checksum of p1 p2 ... pn is the XOR over all pieces of
+ * crc32c_shift(crc(pi), bytes after pi), in any order.
+*/
+uint32_t crc32c_shift(uint32_t crc, size_t n);
+
+/* Name of the active implementation ("sse4.2" or "slicing-by-8") */
+const char *crc32c_impl_name(void);
+
+#endif
@@ -12,18 +12,34 @@
 */
 
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "decode.h"
 #include "types.h"
 #include "common.h"
+#include "lsb.h"
+#include "parallel.h"
+#include "aio.h"
+#include "chunkidx.h"
+#include "archive.h"
+#include "crc32c.h"
+#include "compress.h"
+#include "bmp.h"
 
 // Validate decoding arguments and set file names
 Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 {
     // Check if the source image file is a .bmp file
-    if (strcmp(strstr(argv[2], "."), ".bmp") == 0)
+    char *extn = strrchr(argv[2], '.');
+    if (extn != NULL && strcmp(extn, ".bmp") == 0)
     {
         decInfo->d_src_image_fname = argv[2];
     }
@@ -44,32 +60,304 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
     return e_success;
 }
 
+// Map the stego image read-only for the mmap backend
+static Status map_stego_image(DecodeInfo *decInfo)
+{
+    struct stat st;
+    int fd = fileno(decInfo->fptr_d_src_image);
+
+    if (fstat(fd, &st) != 0 || st.st_size < BMP_HEADER_SIZE || (uintmax_t)st.st_size > SIZE_MAX)
+        return e_failure;
+
+    decInfo->d_map_size = st.st_size;
+    decInfo->d_src_map = mmap(NULL, decInfo->d_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (decInfo->d_src_map == MAP_FAILED)
+    {
+        decInfo->d_src_map = NULL;
+        return e_failure;
+    }
+    madvise(decInfo->d_src_map, decInfo->d_map_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(decInfo->d_src_map, decInfo->d_map_size, MADV_HUGEPAGE);
+#endif
+    return e_success;
+}
+
 // Open the source image file for reading
 Status open_files_decode(DecodeInfo *decInfo)
 {
-    decInfo->fptr_d_src_image = fopen(decInfo->d_src_image_fname, "r");
+    // Block buffers are kept across decodings and freed by release_decode_info()
+    if (decInfo->d_image_data == NULL && (decInfo->d_image_data = malloc(MAX_IMAGE_BUF_SIZE)) == NULL)
+        return e_failure;
+    if (decInfo->d_secret_data == NULL && (decInfo->d_secret_data = malloc(MAX_SECRET_BUF_SIZE)) == NULL)
+        return e_failure;
+
+    // A stream the caller opened already (daemon mode, see serve.h) is used as it is
     if (decInfo->fptr_d_src_image == NULL)
     {
-        perror("fopen");
-        fprintf(stderr, "ERROR: Unable to Open The File %s\n", decInfo->d_src_image_fname);
+        decInfo->fptr_d_src_image = fopen(decInfo->d_src_image_fname, "r");
+    }
+    if (decInfo->fptr_d_src_image == NULL)
         return e_failure;
+    if (decInfo->use_mmap)
+    {
+        return map_stego_image(decInfo);
+    }
+    return e_success;
+}
+
+// Release the mapping and close the stego image
+Status close_files_decode(DecodeInfo *decInfo)
+{
+    if (decInfo->d_src_map != NULL)
+    {
+        munmap(decInfo->d_src_map, decInfo->d_map_size);
+        decInfo->d_src_map = NULL;
+    }
+    if (decInfo->fptr_d_src_image != NULL)
+    {
+        fclose(decInfo->fptr_d_src_image);
+        decInfo->fptr_d_src_image = NULL;
+    }
+    return e_success;
+}
+
+// Move the image cursor to a cover position
+static Status seek_image(DecodeInfo *decInfo, size_t pos)
+{
+    if (pos > decInfo->d_layout.capacity)
+        return e_failure;
+    decInfo->d_cover_pos = pos;
+    if (decInfo->d_src_map != NULL)
+        return e_success;
+    return fseeko(decInfo->fptr_d_src_image, bmp_offset(&decInfo->d_layout, pos), SEEK_SET) == 0 ? e_success : e_failure;
+}
+
+/*
+ * Parse the pixel layout and read the first cover bytes into the frame
+ * window, so the frame fields decode from memory in one pass. The header and
+ * the window come from a single read of the head of the file unless the
+ * pixel array starts far into it. The stdio stream is positioned only when
+ * the cursor leaves the window (see read_image_block()).
+*/
+static Status read_frame_window(DecodeInfo *decInfo)
+{
+    unsigned char head[FRAME_WINDOW_SIZE * 2];
+    const unsigned char *file = head;
+    const BmpLayout *layout = &decInfo->d_layout;
+    size_t len;
+
+    decInfo->d_window_len = 0;
+    if (decInfo->d_src_map != NULL)
+    {
+        file = decInfo->d_src_map;
+        len = decInfo->d_map_size;
+    }
+    else
+    {
+        ssize_t got = pread(fileno(decInfo->fptr_d_src_image), head, sizeof(head), 0);
+        if (got < 0)
+            return e_failure;
+        len = got;
+    }
+    if (bmp_parse_layout(file, len, &decInfo->d_layout) != e_success)
+        return e_failure;
+
+    size_t n = layout->capacity < FRAME_WINDOW_SIZE ? layout->capacity : FRAME_WINDOW_SIZE;
+    size_t offset = layout->data_offset;
+    // A mapping of just the head of an image (probe mode) gets the window it holds
+    if (decInfo->d_src_map != NULL && offset + BMP_EXTENT_BOUND(n) > len)
+    {
+        size_t room = len > offset + 4 ? len - offset - 4 : 0;
+        n = room / 4 * 3 < n ? room / 4 * 3 : n;
+    }
+    size_t extent = bmp_extent(layout, 0, n);
+
+    if (offset + extent <= len)
+    {
+        file += offset;
+    }
+    else if (decInfo->d_src_map != NULL || extent > sizeof(head) ||
+             pread_full(fileno(decInfo->fptr_d_src_image), head, extent, offset) != e_success)
+    {
+        // No window: the fields are read as they come
+        return seek_image(decInfo, 0);
+    }
+    bmp_gather(layout, 0, n, file, decInfo->d_window);
+    decInfo->d_window_len = n;
+    decInfo->d_cover_pos = 0;
+    return e_success;
+}
+
+/*
+ * Get the next n cover bytes (at most MAX_IMAGE_BUF_SIZE): in place from the
+ * mapping, or read into d_image_data. The bytes of a non-contiguous image
+ * (see bmp.h) are gathered into d_image_data from the mapping or from their
+ * file extent read into d_raw_data.
+*/
+static Status read_image_block(DecodeInfo *decInfo, size_t n, const unsigned char **image)
+{
+    const BmpLayout *layout = &decInfo->d_layout;
+    size_t pos = decInfo->d_cover_pos;
+    const unsigned char *raw;
+
+    if (n > MAX_IMAGE_BUF_SIZE || n > layout->capacity - pos)
+        return e_failure;
+
+    // Frame fields come from the window; leaving it positions the stream once
+    if (decInfo->d_window_len > 0)
+    {
+        if (pos + n <= decInfo->d_window_len)
+        {
+            decInfo->d_cover_pos += n;
+            *image = decInfo->d_window + pos;
+            return e_success;
+        }
+        decInfo->d_window_len = 0;
+        if (seek_image(decInfo, pos) != e_success)
+            return e_failure;
+    }
+    off_t offset = bmp_offset(layout, pos);
+    size_t extent = bmp_extent(layout, pos, n);
+
+    if (decInfo->d_src_map != NULL)
+    {
+        if ((size_t)offset + extent > decInfo->d_map_size)
+            return e_failure;
+        raw = decInfo->d_src_map + offset;
+    }
+    else if (bmp_is_contiguous(layout))
+    {
+        if (fread(decInfo->d_image_data, 1, n, decInfo->fptr_d_src_image) != n)
+            return e_failure;
+        raw = (const unsigned char *)decInfo->d_image_data;
+    }
+    else
+    {
+        if (decInfo->d_raw_data == NULL && (decInfo->d_raw_data = malloc(BMP_EXTENT_BOUND(MAX_IMAGE_BUF_SIZE))) == NULL)
+            return e_failure;
+        if (fread(decInfo->d_raw_data, 1, extent, decInfo->fptr_d_src_image) != extent)
+            return e_failure;
+        raw = decInfo->d_raw_data;
+    }
+
+    decInfo->d_cover_pos += n;
+    if (bmp_is_contiguous(layout))
+    {
+        *image = raw;
+        return e_success;
+    }
+    // The buffer API has no block buffer until a non-contiguous image needs one
+    if (decInfo->d_image_data == NULL && (decInfo->d_image_data = malloc(MAX_IMAGE_BUF_SIZE)) == NULL)
+        return e_failure;
+    bmp_gather(layout, pos, n, raw, (unsigned char *)decInfo->d_image_data);
+    *image = (const unsigned char *)decInfo->d_image_data;
+    return e_success;
+}
+
+/*
+ * Extract run bytes stored at depth from the cover bytes at cover position
+ * pos on, with positional I/O or from the mapping; the stdio stream is left
+ * where it is. image and raw are scratch buffers for the cover bytes and
+ * their file extent, needed unless the mapped image is contiguous (raw only
+ * for a non-contiguous image file).
+*/
+static Status extract_at(DecodeInfo *decInfo, size_t pos, unsigned char *data, size_t run, int depth,
+                         unsigned char *image, unsigned char *raw)
+{
+    const BmpLayout *layout = &decInfo->d_layout;
+    size_t span = lsb_cover_size(run, depth);
+    int contiguous = bmp_is_contiguous(layout);
+    const unsigned char *source;
+
+    if (pos > layout->capacity || span > layout->capacity - pos)
+        return e_failure;
+    off_t offset = bmp_offset(layout, pos);
+    size_t extent = bmp_extent(layout, pos, span);
+
+    if (decInfo->d_src_map != NULL)
+    {
+        if ((size_t)offset + extent > decInfo->d_map_size)
+            return e_failure;
+        source = decInfo->d_src_map + offset;
+    }
+    else
+    {
+        if (pread_full(fileno(decInfo->fptr_d_src_image), contiguous ? image : raw, extent, offset) != e_success)
+            return e_failure;
+        source = contiguous ? image : raw;
+    }
+
+    if (!contiguous)
+    {
+        bmp_gather(layout, pos, span, source, image);
+        source = image;
+    }
+    lsb_extract_for_depth(depth)(data, source, run);
+    return e_success;
+}
+
+// Decode n bytes stored at depth bits per image byte, in blocks of at most MAX_IMAGE_BUF_SIZE
+static Status decode_run_at_depth(unsigned char *data, size_t n, int depth, DecodeInfo *decInfo)
+{
+    lsb_extract_fn extract = lsb_extract_for_depth(depth);
+    size_t max_run = lsb_align_run(MAX_SECRET_BUF_SIZE, depth);
+    const unsigned char *image;
+
+    while (n > 0)
+    {
+        size_t run = n < max_run ? n : max_run;
+        if (read_image_block(decInfo, lsb_cover_size(run, depth), &image) != e_success)
+            return e_failure;
+        extract(data, image, run);
+        data += run;
+        n -= run;
     }
     return e_success;
 }
 
+// Cover bytes left after the decoding cursor
+static size_t image_bytes_left(DecodeInfo *decInfo)
+{
+    return decInfo->d_layout.capacity - decInfo->d_cover_pos;
+}
+
 // Decode the magic string from the image to validate data presence
 Status decode_magic_string(DecodeInfo *decInfo)
 {
-    fseek(decInfo->fptr_d_src_image, 54L, SEEK_SET); // Skip BMP header
-    decInfo->magic_data = malloc(strlen(MAGIC_STRING) + 1);
+    unsigned char header[FRAME_HEADER_SIZE];
 
-    decode_data_from_image(strlen(MAGIC_STRING), decInfo->fptr_d_src_image, decInfo);
+    if (read_frame_window(decInfo) != e_success) // Skip BMP header, read the frame fields ahead
+    {
+        return e_failure;
+    }
+
+    if (decode_data_from_image(strlen(MAGIC_STRING), decInfo->fptr_d_src_image, decInfo) != e_success)
+    {
+        return e_failure;
+    }
 
     // Check if the decoded magic string matches the expected string
     if (strcmp(decInfo->magic_data, MAGIC_STRING) == 0)
     {
+        decInfo->depth = 1;
+        decInfo->d_flags = 0;
+        decInfo->d_version = FRAME_VERSION;
         return e_success;
     }
+    else if (strcmp(decInfo->magic_data, MAGIC_STRING_EXT) == 0)
+    {
+        // Extended frame: version, depth and flags follow at 1 bit per byte
+        if (decode_run_at_depth(header, FRAME_HEADER_SIZE, 1, decInfo) != e_success)
+            return e_failure;
+        decInfo->depth = header[1];
+        decInfo->d_flags = header[2];
+        decInfo->d_version = header[0];
+        // A compressed data field has no fixed offsets for an index or directory to point at
+        return ((header[0] == FRAME_VERSION || header[0] == FRAME_VERSION_64) && header[1] >= 1 && header[1] <= LSB_MAX_DEPTH &&
+                (header[2] & ~FRAME_FLAGS_KNOWN) == 0 &&
+                ((header[2] & FRAME_FLAG_COMPRESS) == 0 || (header[2] & (FRAME_FLAG_INDEX | FRAME_FLAG_ARCHIVE)) == 0)) ? e_success : e_failure;
+    }
     else
     {
         return e_failure;
@@ -79,12 +367,12 @@ Status decode_magic_string(DecodeInfo *decInfo)
 // Decode data of specified size from the image
 Status decode_data_from_image(int size, FILE *fptr_d_src_image, DecodeInfo *decInfo)
 {
-    char str[8];
-    for (int i = 0; i < size; i++)
-    {
-        fread(str, 8, 1, fptr_d_src_image); // Read 8 bits
-        decode_byte_from_lsb(&decInfo->magic_data[i], str); // Decode the byte
-    }
+    const unsigned char *image;
+
+    // Read all 8 * size bits at once and decode them in bulk
+    if (size < 0 || size >= (int)sizeof(decInfo->magic_data) || read_image_block(decInfo, (size_t)size * 8, &image) != e_success)
+        return e_failure;
+    lsb_extract((unsigned char *)decInfo->magic_data, image, size);
     decInfo->magic_data[size] = '\0';
     return e_success;
 }
@@ -103,140 +391,791 @@ Status decode_byte_from_lsb(char *data, char *image_buffer)
 }
 
 // Decode and validate the size of the file extension
-Status decode_extension_size(int size, FILE *fptr_d_src_image)
+Status decode_extension_size(int max_size, DecodeInfo *decInfo)
 {
-    char str[32];
+    unsigned char bytes[4];
     int length;
 
-    fread(str, 32, sizeof(char), fptr_d_src_image); // Read 32 bits
-    decode_size_from_lsb(str, &length);
+    if (decode_run_at_depth(bytes, 4, decInfo->depth, decInfo) != e_success) // Read 32 bits
+        return e_failure;
+    length = (int)(((uint)bytes[0] << 24) | ((uint)bytes[1] << 16) | ((uint)bytes[2] << 8) | bytes[3]);
 
-    return (length == size) ? e_success : e_failure;
+    decInfo->d_extn_size = length;
+    return (length >= 0 && length <= max_size) ? e_success : e_failure;
 }
 
-// Decode size from the least significant bits
-Status decode_size_from_lsb(char *buffer, int *size)
+// Decode a 32-bit field from the least significant bits (most significant first)
+Status decode_size_from_lsb(char *buffer, uint32_t *size)
 {
-    int num = 0x00;
-    int j = 31;
-    for (int i = 0; i < 32; i++)
-    {
-        num = ((buffer[i] & 0x01) << j--) | num; // Extract 32 bits
-    }
-    *size = num;
+    unsigned char bytes[4];
+    lsb_extract(bytes, (unsigned char *)buffer, 4);
+    *size = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+    return e_success;
 }
 
 // Decode the secret file extension from the image
 Status decode_secret_file_extension(char *file_ext, DecodeInfo *decInfo)
 {
-    file_ext = ".txt"; // Expected extension
-    int size = strlen(file_ext);
-    decInfo->d_extn_secret_file = malloc(size + 1);
+    int size = decInfo->d_extn_size;
 
-    decode_extension_data(size, decInfo->fptr_d_src_image, decInfo);
+    if (decode_extension_data(size, decInfo->fptr_d_src_image, decInfo) != e_success)
+    {
+        return e_failure;
+    }
 
     decInfo->d_extn_secret_file[size] = '\0';
-    return (strcmp(decInfo->d_extn_secret_file, file_ext) == 0) ? e_success : e_failure;
+    // Any extension is accepted, but it must look like one
+    return (size == 0 || decInfo->d_extn_secret_file[0] == '.') ? e_success : e_failure;
 }
 
 // Decode file extension data
 Status decode_extension_data(int size, FILE *fptr_d_src_image, DecodeInfo *decInfo)
 {
-    for (int i = 0; i < size; i++)
+    return decode_run_at_depth((unsigned char *)decInfo->d_extn_secret_file, size, decInfo->depth, decInfo);
+}
+
+// Decode the size of the secret file (64 bits in a FRAME_VERSION_64 frame)
+Status decode_secret_file_size(long file_size, DecodeInfo *decInfo)
+{
+    unsigned char bytes[8];
+    int n = decInfo->d_version == FRAME_VERSION_64 ? 8 : 4;
+    uint64_t value = 0;
+
+    if (decode_run_at_depth(bytes, n, decInfo->depth, decInfo) != e_success)
+        return e_failure;
+    for (int i = 0; i < n; i++)
+        value = value << 8 | bytes[i];
+
+    // Version 1 sizes are signed 32-bit values; anything larger must also fit the payload offsets
+    if (value > (n == 4 ? (uint64_t)FRAME_V1_MAX_SIZE : (uint64_t)LONG_MAX))
+        return e_failure;
+    file_size = (long)value;
+    decInfo->size_secret_file = file_size;
+    return e_success;
+}
+
+// Decode the payload checksum, checked once the whole payload is decoded
+Status decode_payload_checksum(DecodeInfo *decInfo)
+{
+    unsigned char bytes[4];
+
+    decInfo->d_payload_crc = 0;
+    if (decode_run_at_depth(bytes, 4, decInfo->depth, decInfo) != e_success)
+        return e_failure;
+    decInfo->d_checksum = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+    return e_success;
+}
+
+// Decode the shard header; a shard is always checksummed and never an archive
+Status decode_shard_header(DecodeInfo *decInfo)
+{
+    unsigned char bytes[SHARD_HEADER_SIZE];
+
+    if ((decInfo->d_flags & (FRAME_FLAG_CHECKSUM | FRAME_FLAG_ARCHIVE)) != FRAME_FLAG_CHECKSUM)
+        return e_failure;
+    if (decode_run_at_depth(bytes, SHARD_HEADER_SIZE, decInfo->depth, decInfo) != e_success)
+        return e_failure;
+    return shard_header_load(&decInfo->d_shard, bytes, decInfo->size_secret_file);
+}
+
+// Decode the chunk size and the entries of the chunk index
+Status decode_chunk_index(DecodeInfo *decInfo)
+{
+    unsigned char bytes[4];
+    uint32_t chunk_size;
+
+    if (decode_run_at_depth(bytes, 4, decInfo->depth, decInfo) != e_success)
+        return e_failure;
+    chunk_size = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+
+    // Chunks must start on whole image bytes and fit the range decoder's block buffer
+    if (chunk_size == 0 || chunk_size > MAX_SECRET_BUF_SIZE || chunk_size % lsb_group_size(decInfo->depth) != 0)
+        return e_failure;
+
+    // Refuse entries that cannot fit in the image before allocating for them
+    long num_chunks = chunk_index_count(decInfo->size_secret_file, chunk_size);
+    size_t entry_size = decInfo->d_version == FRAME_VERSION_64 ? INDEX_ENTRY_SIZE_64 : INDEX_ENTRY_SIZE;
+    size_t size = (size_t)num_chunks * entry_size;
+    if (lsb_cover_size(size, decInfo->depth) > image_bytes_left(decInfo))
+        return e_failure;
+
+    if (chunk_index_init(&decInfo->d_index, decInfo->size_secret_file, chunk_size, entry_size) != e_success)
+        return e_failure;
+    decInfo->d_crcs = calloc(num_chunks + 1, sizeof(uint32_t));
+    unsigned char *entries = malloc(size + 1);
+    Status status = e_failure;
+
+    if (decInfo->d_crcs != NULL && entries != NULL &&
+        decode_run_at_depth(entries, size, decInfo->depth, decInfo) == e_success)
     {
-        fread(decInfo->d_src_image_fname, 8, 1, fptr_d_src_image); // Read 8 bits
-        decode_byte_from_lsb(&decInfo->d_extn_secret_file[i], decInfo->d_src_image_fname);
+        status = chunk_index_load(&decInfo->d_index, entries);
     }
-    return e_success;
+    free(entries);
+    return status;
 }
 
-// Decode the size of the secret file
-Status decode_secret_file_size(int file_size, DecodeInfo *decInfo)
+/*
+ * Decode the directory of an archive and, when a member was requested,
+ * narrow the decoded range to it
+*/
+Status decode_archive_directory(DecodeInfo *decInfo)
 {
-    char str[32];
-    fread(str, 32, sizeof(char), decInfo->fptr_d_src_image); // Read 32 bits
-    decode_size_from_lsb(str, &file_size);
-    decInfo->size_secret_file = file_size;
+    unsigned char bytes[4];
+    uint32_t size;
+
+    archive_dir_free(&decInfo->d_archive);
+    if (decode_run_at_depth(bytes, 4, decInfo->depth, decInfo) != e_success)
+        return e_failure;
+    size = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+
+    // Refuse a directory that cannot fit in the image before allocating for it
+    if (lsb_cover_size(size, decInfo->depth) > image_bytes_left(decInfo))
+        return e_failure;
+
+    unsigned char *table = malloc((size_t)size + 1);
+    Status status = e_failure;
+
+    if (table != NULL && decode_run_at_depth(table, size, decInfo->depth, decInfo) == e_success)
+        status = archive_dir_load(&decInfo->d_archive, table, size, decInfo->size_secret_file, decInfo->depth);
+    free(table);
+
+    if (status == e_success && decInfo->d_member != NULL)
+    {
+        const ArchiveEntry *entry = archive_dir_find(&decInfo->d_archive, decInfo->d_member);
+        if (entry == NULL)
+            return e_failure;
+        decInfo->use_range = 1;
+        decInfo->range_offset = entry->offset;
+        decInfo->range_length = entry->size;
+    }
+    return status;
+}
+
+/*
+ * Add decoded payload bytes to the chunk checksums and to payload_crc (the
+ * strip's own checksum in strip workers) while they are still in cache
+*/
+static void check_decoded(DecodeInfo *decInfo, long pos, const unsigned char *data, size_t n, uint32_t *payload_crc)
+{
+    if (decInfo->d_crcs != NULL)
+    {
+        chunk_index_update(decInfo->d_crcs, decInfo->d_index.chunk_size, pos, data, n);
+    }
+    if (decInfo->d_flags & FRAME_FLAG_CHECKSUM)
+    {
+        *payload_crc = crc32c(*payload_crc, data, n);
+    }
+}
+
+// Offset of the decoded data within the output file: a joined shard goes to its place in the payload
+static long output_offset(const DecodeInfo *decInfo)
+{
+    return decInfo->d_join != NULL ? decInfo->d_join->offset : 0;
+}
+
+// Context shared by the strip workers of one parallel decode
+typedef struct
+{
+    DecodeInfo *decInfo;
+    size_t data_pos;        // Cover position of secret byte 0
+    unsigned char *out_map; // Mapped output file (mmap backend only)
+} DecodeStrips;
+
+// Extract secret bytes [begin, end) of one strip with positional I/O or from the mapping
+static Status decode_strip(void *ctx, long begin, long end)
+{
+    DecodeStrips *strips = ctx;
+    DecodeInfo *decInfo = strips->decInfo;
+    int depth = decInfo->depth;
+    int contiguous = bmp_is_contiguous(&decInfo->d_layout);
+    long max_run = lsb_align_run(MAX_SECRET_BUF_SIZE, depth);
+    uint32_t crc = 0;
+    unsigned char *image = NULL;
+    unsigned char *raw = NULL;
+    unsigned char *secret = NULL;
+    Status status = e_success;
 
+    // A mapped contiguous image is extracted from in place
+    if (decInfo->d_src_map == NULL || !contiguous)
+    {
+        image = malloc(MAX_IMAGE_BUF_SIZE);
+        status = image != NULL ? e_success : e_failure;
+    }
+    if (decInfo->d_src_map == NULL && !contiguous && (raw = malloc(BMP_EXTENT_BOUND(MAX_IMAGE_BUF_SIZE))) == NULL)
+    {
+        status = e_failure;
+    }
+    if (strips->out_map == NULL && (secret = malloc(MAX_SECRET_BUF_SIZE)) == NULL)
+    {
+        status = e_failure;
+    }
+
+    for (long pos = begin; pos < end && status == e_success; pos += max_run)
+    {
+        size_t run = end - pos < max_run ? end - pos : max_run;
+        unsigned char *out = strips->out_map != NULL ? strips->out_map + pos : secret;
+
+        status = extract_at(decInfo, strips->data_pos + (size_t)pos * 8 / depth, out, run, depth, image, raw);
+        if (status == e_success)
+        {
+            check_decoded(decInfo, pos, out, run, &crc);
+        }
+        if (status == e_success && strips->out_map == NULL)
+        {
+            status = pwrite_full(fileno(decInfo->fptr_d_secret), secret, run, output_offset(decInfo) + pos);
+        }
+    }
+
+    // Strips finish in any order; shifted checksums join by XOR (see crc32c.h)
+    if (decInfo->d_flags & FRAME_FLAG_CHECKSUM)
+    {
+        __atomic_fetch_xor(&decInfo->d_payload_crc, crc32c_shift(crc, decInfo->size_secret_file - end), __ATOMIC_RELAXED);
+    }
+    free(image);
+    free(raw);
+    free(secret);
+    return status;
+}
+
+// Decode the secret data with num_threads strip workers
+static Status decode_secret_file_data_parallel(DecodeInfo *decInfo, unsigned char *out_map)
+{
+    DecodeStrips strips = { decInfo, decInfo->d_cover_pos, out_map };
+    long size = decInfo->size_secret_file;
+
+    if (lsb_cover_size(size, decInfo->depth) > image_bytes_left(decInfo))
+        return e_failure;
+    // Chunk-aligned strips when indexed, so every checksum has a single owner
+    long align = decInfo->d_crcs != NULL ? (long)decInfo->d_index.chunk_size : (long)lsb_group_size(decInfo->depth);
+    if (run_strips(decInfo->num_threads, size, align, decode_strip, &strips) != e_success)
+        return e_failure;
+
+    return seek_image(decInfo, strips.data_pos + lsb_cover_size(size, decInfo->depth));
+}
+
+// Context of one pipelined decode
+typedef struct
+{
+    DecodeInfo *decInfo;
+    size_t data_pos;        // Cover position of secret byte 0
+    long max_run;           // Secret bytes per block
+} DecodePipeline;
+
+// Slot buffers of a pipelined decode: stego extent, decoded run, gathered cover bytes (non-contiguous images)
+enum
+{
+    PIPE_RAW,
+    PIPE_OUT,
+    PIPE_IMAGE
+};
+
+// Read the stego extent of block index
+static int decode_block_plan(void *ctx, long index, AioBlock *block)
+{
+    DecodePipeline *pipeline = ctx;
+    DecodeInfo *decInfo = pipeline->decInfo;
+    long pos = index * pipeline->max_run;
+
+    if (pos >= decInfo->size_secret_file)
+        return 0;
+    size_t run = decInfo->size_secret_file - pos < pipeline->max_run ? decInfo->size_secret_file - pos : pipeline->max_run;
+    size_t cover = pipeline->data_pos + (size_t)pos * 8 / decInfo->depth;
+
+    block->reads[0] = (AioRange){ fileno(decInfo->fptr_d_src_image), PIPE_RAW,
+                                  bmp_extent(&decInfo->d_layout, cover, lsb_cover_size(run, decInfo->depth)),
+                                  bmp_offset(&decInfo->d_layout, cover) };
+    block->num_reads = 1;
+    return 1;
+}
+
+// Extract the run of a block, check it and write it to the output at its offset
+static Status decode_block_transform(void *ctx, AioBlock *block)
+{
+    DecodePipeline *pipeline = ctx;
+    DecodeInfo *decInfo = pipeline->decInfo;
+    const BmpLayout *layout = &decInfo->d_layout;
+    const unsigned char *source = block->buffers[PIPE_RAW];
+    unsigned char *out = block->buffers[PIPE_OUT];
+    long pos = block->index * pipeline->max_run;
+    size_t run = decInfo->size_secret_file - pos < pipeline->max_run ? decInfo->size_secret_file - pos : pipeline->max_run;
+
+    if (!bmp_is_contiguous(layout))
+    {
+        size_t cover = pipeline->data_pos + (size_t)pos * 8 / decInfo->depth;
+        bmp_gather(layout, cover, lsb_cover_size(run, decInfo->depth), source, block->buffers[PIPE_IMAGE]);
+        source = block->buffers[PIPE_IMAGE];
+    }
+    lsb_extract_for_depth(decInfo->depth)(out, source, run);
+    // Blocks arrive in order, so the running checksums see the payload sequentially
+    check_decoded(decInfo, pos, out, run, &decInfo->d_payload_crc);
+
+    block->write = (AioRange){ fileno(decInfo->fptr_d_secret), PIPE_OUT, run, output_offset(decInfo) + pos };
     return e_success;
 }
 
-// Decode the secret file data and write it to a file
-Status decode_secret_file_data(DecodeInfo *decInfo)
+/*
+ * Decode the secret data through the asynchronous pipeline (see aio.h):
+ * stego extents are read ahead and decoded runs written behind while the
+ * blocks in between are extracted, all with positional I/O
+*/
+static Status decode_secret_file_data_pipelined(DecodeInfo *decInfo)
 {
-    char ch;
-    decInfo->fptr_d_secret = fopen("decode_secret_data.txt", "w");
-    if (decInfo->fptr_d_secret == NULL)
+    DecodePipeline pipeline = { decInfo, decInfo->d_cover_pos, lsb_align_run(MAX_SECRET_BUF_SIZE, decInfo->depth) };
+    size_t sizes[] = { BMP_EXTENT_BOUND(MAX_IMAGE_BUF_SIZE), MAX_SECRET_BUF_SIZE, MAX_IMAGE_BUF_SIZE };
+    long size = decInfo->size_secret_file;
+
+    if (lsb_cover_size(size, decInfo->depth) > image_bytes_left(decInfo))
+        return e_failure;
+    int num_buffers = bmp_is_contiguous(&decInfo->d_layout) ? PIPE_IMAGE : PIPE_IMAGE + 1;
+    if (aio_run(sizes, num_buffers, decode_block_plan, decode_block_transform, &pipeline) != e_success)
+        return e_failure;
+
+    decInfo->d_window_len = 0;
+    return seek_image(decInfo, pipeline.data_pos + lsb_cover_size(size, decInfo->depth));
+}
+
+// Decode the secret straight from the mapped stego image into a mapped output file
+static Status decode_secret_file_data_mapped(DecodeInfo *decInfo)
+{
+    size_t size = decInfo->size_secret_file;
+    int fd = fileno(decInfo->fptr_d_secret);
+
+    if (lsb_cover_size(size, decInfo->depth) > image_bytes_left(decInfo) || ftruncate(fd, size) != 0)
+        return e_failure;
+    if (size == 0)
+        return e_success;
+
+    unsigned char *out = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (out == MAP_FAILED)
+        return e_failure;
+    madvise(out, size, MADV_SEQUENTIAL);
+
+    Status status = e_success;
+    if (decInfo->num_threads > 1)
+    {
+        status = decode_secret_file_data_parallel(decInfo, out);
+    }
+    else
     {
-        fprintf(stderr, "Can't Open decode.txt file\n");
+        size_t max_run = lsb_align_run(MAX_SECRET_BUF_SIZE, decInfo->depth);
+        for (size_t done = 0; done < size && status == e_success; done += max_run)
+        {
+            size_t run = size - done < max_run ? size - done : max_run;
+            status = decode_run_at_depth(out + done, run, decInfo->depth, decInfo);
+            check_decoded(decInfo, done, out + done, run, &decInfo->d_payload_crc);
+        }
+    }
+
+    if (msync(out, size, MS_ASYNC) != 0)
+        status = e_failure;
+    munmap(out, size);
+    return status;
+}
+
+// Decode the secret into the caller's buffer
+static Status decode_secret_file_data_memory(DecodeInfo *decInfo)
+{
+    size_t size = decInfo->size_secret_file;
+    size_t max_run = lsb_align_run(MAX_SECRET_BUF_SIZE, decInfo->depth);
+
+    if (size > decInfo->d_out_cap)
         return e_failure;
+    if (decInfo->num_threads > 1 && decInfo->d_src_map != NULL)
+        return decode_secret_file_data_parallel(decInfo, decInfo->d_out_mem);
+
+    for (size_t done = 0; done < size; )
+    {
+        size_t run = size - done < max_run ? size - done : max_run;
+        if (decode_run_at_depth(decInfo->d_out_mem + done, run, decInfo->depth, decInfo) != e_success)
+            return e_failure;
+        check_decoded(decInfo, done, decInfo->d_out_mem + done, run, &decInfo->d_payload_crc);
+        done += run;
     }
+    return e_success;
+}
 
-    for (int i = 0; i < decInfo->size_secret_file; i++)
+// Send decoded range bytes to the caller's buffer or the output file
+static Status emit_range_bytes(DecodeInfo *decInfo, const unsigned char *data, size_t n, size_t *emitted)
+{
+    if (decInfo->d_out_mem != NULL)
+    {
+        if (n > decInfo->d_out_cap - *emitted)
+            return e_failure;
+        memcpy(decInfo->d_out_mem + *emitted, data, n);
+    }
+    else if (fwrite(data, 1, n, decInfo->fptr_d_secret) != n)
+    {
+        return e_failure;
+    }
+    if (decInfo->d_member != NULL)
     {
-        fread(decInfo->d_src_image_fname, 8, sizeof(char), decInfo->fptr_d_src_image);
-        decode_byte_from_lsb(&ch, decInfo->d_src_image_fname);
-        fputc(ch, decInfo->fptr_d_secret); // Write decoded data
+        decInfo->d_range_crc = crc32c(decInfo->d_range_crc, data, n);
     }
+    *emitted += n;
     return e_success;
 }
 
-// Perform the entire decoding process step-by-step
-Status do_decoding(DecodeInfo *decInfo)
+/*
+ * Decode payload bytes [range_offset, range_offset + range_length) only.
+ * Payload byte i sits at a fixed image offset, so decoding seeks straight to
+ * the first group holding the range. An indexed payload is decoded in whole
+ * chunks instead, each verified against its checksum before use.
+*/
+static Status decode_secret_file_range(DecodeInfo *decInfo)
+{
+    int depth = decInfo->depth;
+    int indexed = decInfo->d_crcs != NULL;
+    long size = decInfo->size_secret_file;
+    long begin = decInfo->range_offset;
+    long end = begin + decInfo->range_length;
+    long step = indexed ? (long)decInfo->d_index.chunk_size : (long)lsb_align_run(MAX_SECRET_BUF_SIZE, depth);
+    size_t data_pos = decInfo->d_cover_pos;
+    size_t emitted = 0;
+
+    if (begin < 0 || decInfo->range_length < 0 || end > size)
+        return e_failure;
+
+    unsigned char *buffer = malloc(step);
+    Status status = buffer != NULL ? e_success : e_failure;
+
+    decInfo->d_range_crc = 0;
+
+    for (long pos = begin - begin % (indexed ? step : (long)lsb_group_size(depth)); pos < end && status == e_success; pos += step)
+    {
+        long run = size - pos < step ? size - pos : step;
+        long from = pos > begin ? pos : begin;
+        long to = pos + run < end ? pos + run : end;
+
+        status = seek_image(decInfo, data_pos + (size_t)pos * 8 / depth);
+        if (status == e_success)
+            status = decode_run_at_depth(buffer, run, depth, decInfo);
+        if (status == e_success && indexed && crc32c(0, buffer, run) != decInfo->d_index.crc[pos / step])
+            status = e_failure;
+        if (status == e_success)
+            status = emit_range_bytes(decInfo, buffer + (from - pos), to - from, &emitted);
+    }
+
+    free(buffer);
+    return status;
+}
+
+/*
+ * Decode a compressed data field block by block, sending the requested range
+ * (the whole payload unless use_range is set) to the output. Each block is
+ * read into the first half of the secret buffer and decompressed into the
+ * second half.
+*/
+static Status decode_secret_file_data_compressed(DecodeInfo *decInfo)
 {
-    printf("Decoding Started...\n");
-    if (open_files_decode(decInfo) == e_success)
+    long size = decInfo->size_secret_file;
+    long begin = decInfo->use_range ? decInfo->range_offset : 0;
+    long end = decInfo->use_range ? begin + decInfo->range_length : size;
+    unsigned char *buffer = (unsigned char *)decInfo->d_secret_data;
+    unsigned char *scratch = NULL;
+    size_t emitted = 0;
+
+    if (begin < 0 || end < begin || end > size)
+        return e_failure;
+    // The buffer API decodes without a secret buffer of its own
+    if (buffer == NULL && (buffer = scratch = malloc(2 * COMPRESS_BLOCK_SIZE)) == NULL)
+        return e_failure;
+
+    Status status = e_success;
+    for (long pos = 0; pos < end && status == e_success; pos += COMPRESS_BLOCK_SIZE)
     {
-        printf("Opening of File Successful...\n");
-        if (decode_magic_string(decInfo) == e_success)
+        long raw = size - pos < COMPRESS_BLOCK_SIZE ? size - pos : COMPRESS_BLOCK_SIZE;
+        unsigned char bytes[COMPRESS_HEADER_SIZE];
+        unsigned char *block = buffer + COMPRESS_BLOCK_SIZE;
+
+        if (decode_run_at_depth(bytes, COMPRESS_HEADER_SIZE, decInfo->depth, decInfo) != e_success)
         {
-            printf("Decoding of Magic String is Successful...\n");
-            if (decode_extension_size(strlen(".txt"), decInfo->fptr_d_src_image) == e_success)
-            {
-                printf("Decoding of Secret File Extension Size is Successful...\n");
-                if (decode_secret_file_extension(decInfo->d_extn_secret_file, decInfo) == e_success)
-                {
-                    printf("Decoding of Secret File Extension is Successful...\n");
-                    if (decode_secret_file_size(decInfo->size_secret_file, decInfo) == e_success)
-                    {
-                        printf("Decoding of Secret File Size is Successful...\n");
-                        if (decode_secret_file_data(decInfo) == e_success)
-                        {
-                            printf("Decoding of Secret File Data is Successful...\n");
-                        }
-                        else
-                        {
-                            printf("Decoding of Secret File Data Failed...\n");
-                        }
-                    }
-                    else
-                    {
-                        printf("Decoding of Secret File Size Failed...\n");
-                        return e_failure;
-                    }
-                }
-                else
-                {
-                    printf("Decoding of Secret File Extension Failed...\n");
-                    return e_failure;
-                }
-            }
-            else
-            {
-                printf("Decoding of Secret File Extension Size Failed...\n");
-                return e_failure;
-            }
+            status = e_failure;
+            break;
         }
-        else
+        uint32_t header = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+        uint32_t length = header & ~COMPRESS_STORED;
+
+        if (length > (uint32_t)raw || ((header & COMPRESS_STORED) && length != (uint32_t)raw))
+            status = e_failure;
+        else if (header & COMPRESS_STORED)
+            status = decode_run_at_depth(block, length, decInfo->depth, decInfo);
+        else if (decode_run_at_depth(buffer, length, decInfo->depth, decInfo) != e_success ||
+                 decompress_block(buffer, length, block, COMPRESS_BLOCK_SIZE) != raw)
+            status = e_failure;
+
+        if (status == e_success)
+            check_decoded(decInfo, pos, block, raw, &decInfo->d_payload_crc);
+
+        // Send the part of the block inside the range
+        long from = pos > begin ? pos : begin;
+        long to = pos + raw < end ? pos + raw : end;
+        if (status == e_success && from < to)
+            status = emit_range_bytes(decInfo, block + (from - pos), to - from, &emitted);
+    }
+
+    free(scratch);
+    return status;
+}
+
+// Whether the image has room for the data field the size field claims; a compressed block takes at least its header
+static int payload_fits(DecodeInfo *decInfo)
+{
+    size_t size = decInfo->size_secret_file;
+
+    if (decInfo->d_flags & FRAME_FLAG_COMPRESS)
+    {
+        size_t blocks = size / COMPRESS_BLOCK_SIZE + (size % COMPRESS_BLOCK_SIZE != 0);
+        return blocks <= image_bytes_left(decInfo) / lsb_cover_size(COMPRESS_HEADER_SIZE, decInfo->depth);
+    }
+    return lsb_cover_size(size, decInfo->depth) <= image_bytes_left(decInfo);
+}
+
+// Decode the secret file data and write it to the requested output file
+Status decode_secret_file_data(DecodeInfo *decInfo)
+{
+    long remaining = decInfo->size_secret_file;
+    long max_run = lsb_align_run(MAX_SECRET_BUF_SIZE, decInfo->depth);
+    int opened = decInfo->fptr_d_secret == NULL;
+    Status status = e_success;
+
+    // The size field is untrusted: reject it before any output is created or reserved for it
+    if (!payload_fits(decInfo))
+        return e_failure;
+
+    if (decInfo->d_out_mem != NULL)
+    {
+        if (decInfo->d_flags & FRAME_FLAG_COMPRESS)
+            return (decInfo->use_range || remaining <= (long)decInfo->d_out_cap) ? decode_secret_file_data_compressed(decInfo) : e_failure;
+        return decInfo->use_range ? decode_secret_file_range(decInfo) : decode_secret_file_data_memory(decInfo);
+    }
+
+    // The mmap backend needs the output readable as well as writable; a joined shard must not truncate the others
+    if (opened)
+    {
+        decInfo->fptr_d_secret = fopen(decInfo->d_secret_fname, decInfo->d_join != NULL ? "r+" : decInfo->d_src_map != NULL ? "w+" : "w");
+    }
+    if (decInfo->fptr_d_secret == NULL)
+        return e_failure;
+    if (decInfo->d_join != NULL && fseeko(decInfo->fptr_d_secret, output_offset(decInfo), SEEK_SET) != 0)
+    {
+        fclose(decInfo->fptr_d_secret);
+        decInfo->fptr_d_secret = NULL;
+        return e_failure;
+    }
+
+    if (decInfo->d_flags & FRAME_FLAG_COMPRESS)
+    {
+        status = decode_secret_file_data_compressed(decInfo);
+        remaining = 0;
+    }
+    else if (decInfo->use_range)
+    {
+        status = decode_secret_file_range(decInfo);
+        remaining = 0;
+    }
+    // The mapped output would be resized to the shard, so joined shards take the paths below
+    else if (decInfo->d_src_map != NULL && decInfo->d_join == NULL)
+    {
+        status = decode_secret_file_data_mapped(decInfo);
+        remaining = 0;
+    }
+    // Reserve the whole output up front so the large writes below never extend it piecemeal
+    else if (remaining > 0)
+    {
+        posix_fallocate(fileno(decInfo->fptr_d_secret), output_offset(decInfo), remaining);
+        if (decInfo->num_threads > 1)
         {
-            printf("Decoding of Magic String Failed...\n");
-            return e_failure;
+            status = decode_secret_file_data_parallel(decInfo, NULL);
+            remaining = 0;
+        }
+        else if (decInfo->use_aio && decInfo->d_src_map == NULL)
+        {
+            status = decode_secret_file_data_pipelined(decInfo);
+            remaining = 0;
         }
     }
-    else
+
+    // Read the stego pixels in blocks of at most MAX_IMAGE_BUF_SIZE and decode each block in bulk
+    while (remaining > 0)
+    {
+        int run = remaining < max_run ? remaining : max_run;
+        if (decode_run_at_depth((unsigned char *)decInfo->d_secret_data, run, decInfo->depth, decInfo) != e_success)
+        {
+            status = e_failure;
+            break;
+        }
+        check_decoded(decInfo, decInfo->size_secret_file - remaining, (unsigned char *)decInfo->d_secret_data, run, &decInfo->d_payload_crc);
+        if (fwrite(decInfo->d_secret_data, 1, run, decInfo->fptr_d_secret) != (size_t)run)
+        {
+            status = e_failure;
+            break;
+        }
+        remaining -= run;
+    }
+
+    if (fclose(decInfo->fptr_d_secret) != 0)
+        status = e_failure;
+    decInfo->fptr_d_secret = NULL;
+
+    // Leave no partial output behind; a joined shard's output belongs to the whole join
+    if (status != e_success && opened && decInfo->d_join == NULL)
+        unlink(decInfo->d_secret_fname);
+    return status;
+}
+
+// Report a stage that completed successfully
+static Status finish_stage(DecodeInfo *decInfo, Status status)
+{
+    if (status == e_success && decInfo->progress != NULL)
+    {
+        decInfo->progress(decInfo->stage, decInfo->progress_arg);
+    }
+    return status;
+}
+
+// Fail a decode whose output did not verify, removing the output file the decoder wrote (a join removes its own)
+static Status reject_output(DecodeInfo *decInfo, int to_file)
+{
+    if (to_file && decInfo->d_join == NULL)
+        unlink(decInfo->d_secret_fname);
+    return e_failure;
+}
+
+// Decode the secret file data and check it against the member, payload and chunk checksums it carries
+static Status decode_payload(DecodeInfo *decInfo)
+{
+    // Only an output file the decoder opens itself is removed again
+    int to_file = decInfo->d_out_mem == NULL && decInfo->fptr_d_secret == NULL;
+
+    // An archive is only ever decoded one member at a time
+    if ((decInfo->d_flags & FRAME_FLAG_ARCHIVE) && decInfo->d_member == NULL)
     {
-        printf("Opening of File Failed...\n");
         return e_failure;
     }
+    // A shard is only decoded as part of its set, and only the one the joiner placed
+    if ((decInfo->d_flags & FRAME_FLAG_SHARD) ? decInfo->d_join == NULL || !shard_same(&decInfo->d_shard, decInfo->d_join)
+                                              : decInfo->d_join != NULL)
+    {
+        return e_failure;
+    }
+    if (decode_secret_file_data(decInfo) != e_success)
+    {
+        return e_failure;
+    }
+    if (decInfo->d_member != NULL)
+    {
+        const ArchiveEntry *entry = archive_dir_find(&decInfo->d_archive, decInfo->d_member);
+        return decInfo->d_range_crc == entry->crc ? e_success : reject_output(decInfo, to_file);
+    }
+    // A range is verified chunk by chunk while it is decoded
+    if (decInfo->use_range)
+    {
+        return e_success;
+    }
+    if ((decInfo->d_flags & FRAME_FLAG_CHECKSUM) && decInfo->d_payload_crc != decInfo->d_checksum)
+    {
+        return reject_output(decInfo, to_file);
+    }
+    if (decInfo->d_crcs == NULL)
+    {
+        return e_success;
+    }
+    for (long i = 0; i < decInfo->d_index.num_chunks; i++)
+    {
+        if (decInfo->d_crcs[i] != decInfo->d_index.crc[i])
+            return reject_output(decInfo, to_file);
+    }
     return e_success;
 }
+
+// Decode the file size, the payload checksum if one is kept and the shard header of a shard
+static Status decode_size_fields(DecodeInfo *decInfo)
+{
+    if (decode_secret_file_size(decInfo->size_secret_file, decInfo) != e_success)
+        return e_failure;
+    if ((decInfo->d_flags & FRAME_FLAG_CHECKSUM) && decode_payload_checksum(decInfo) != e_success)
+        return e_failure;
+    return (decInfo->d_flags & FRAME_FLAG_SHARD) ? decode_shard_header(decInfo) : e_success;
+}
+
+// Run the stages of decode_frame()
+static Status decode_frame_stages(DecodeInfo *decInfo)
+{
+    decInfo->stage = e_stage_magic;
+    if (finish_stage(decInfo, decode_magic_string(decInfo)) != e_success)
+        return e_failure;
+
+    decInfo->stage = e_stage_extn_size;
+    if (finish_stage(decInfo, decode_extension_size(MAX_FILE_SUFFIX, decInfo)) != e_success)
+        return e_failure;
+
+    decInfo->stage = e_stage_extn;
+    if (finish_stage(decInfo, decode_secret_file_extension(decInfo->d_extn_secret_file, decInfo)) != e_success)
+        return e_failure;
+
+    decInfo->stage = e_stage_size;
+    if (finish_stage(decInfo, decode_size_fields(decInfo)) != e_success)
+        return e_failure;
+    if (decInfo->probe_only)
+        return e_success;
+
+    if (decInfo->d_flags & FRAME_FLAG_INDEX)
+    {
+        decInfo->stage = e_stage_index;
+        if (finish_stage(decInfo, decode_chunk_index(decInfo)) != e_success)
+            return e_failure;
+    }
+
+    // Listing needs an archive, and extracting a member needs its directory
+    decInfo->stage = e_stage_directory;
+    if ((decInfo->list_only || decInfo->d_member != NULL) && !(decInfo->d_flags & FRAME_FLAG_ARCHIVE))
+        return e_failure;
+    if (decInfo->d_flags & FRAME_FLAG_ARCHIVE)
+    {
+        if (finish_stage(decInfo, decode_archive_directory(decInfo)) != e_success)
+            return e_failure;
+        if (decInfo->list_only)
+            return e_success;
+    }
+
+    decInfo->stage = e_stage_data;
+    return finish_stage(decInfo, decode_payload(decInfo));
+}
+
+// Run every stage after opening; on failure decInfo->stage names the failed stage
+Status decode_frame(DecodeInfo *decInfo)
+{
+    Status status = decode_frame_stages(decInfo);
+
+    chunk_index_free(&decInfo->d_index);
+    free(decInfo->d_crcs);
+    decInfo->d_crcs = NULL;
+    return status;
+}
+
+// Perform the entire decoding process step-by-step and release its resources
+Status do_decoding(DecodeInfo *decInfo)
+{
+    Status status;
+
+    decInfo->stage = e_stage_open;
+    status = finish_stage(decInfo, open_files_decode(decInfo));
+    if (status == e_success)
+    {
+        status = decode_frame(decInfo);
+    }
+
+    close_files_decode(decInfo);
+    return status;
+}
+
+// Free the buffers kept in decInfo across decodings
+void release_decode_info(DecodeInfo *decInfo)
+{
+    free(decInfo->d_image_data);
+    free(decInfo->d_secret_data);
+    free(decInfo->d_raw_data);
+    decInfo->d_image_data = decInfo->d_secret_data = NULL;
+    decInfo->d_raw_data = NULL;
+    archive_dir_free(&decInfo->d_archive);
+}
@@ -14,7 +14,22 @@
 #ifndef DECODE_H
 #define DECODE_H
 
+#include <stdio.h>
+#include <stdint.h>
 #include "types.h" // Contains user defined types
+#include "common.h" // Contains shared constants
+#include "chunkidx.h" // Chunk index of indexed payloads
+#include "archive.h" // Archive member directory
+#include "bmp.h" // Pixel layout of the image
+#include "shard.h" // Shard header of a sharded payload
+
+/*
+ * Cover bytes read ahead for the frame fields. The largest run of fields
+ * before the chunk index entries or archive directory (magic string, frame
+ * header, extension size, extension, 64-bit file size, checksum, shard
+ * header and the index chunk size at 1 bit per byte) takes 488 of them.
+*/
+#define FRAME_WINDOW_SIZE 512
 
 /* 
  * Structure to store information required for
@@ -23,23 +38,67 @@
  * also stored
 */
 
-#define MAX_SECRET_BUF_SIZE 1
-#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
 
 typedef struct _DecodeInfo
 {
     /* Source Image info */
     char *d_src_image_fname;
     FILE *fptr_d_src_image;
-    char d_image_data[MAX_IMAGE_BUF_SIZE];
-    char *magic_data;
-    char *d_extn_secret_file;
+    char *d_image_data;     // Image block buffer (MAX_IMAGE_BUF_SIZE), allocated on first use
+    unsigned char *d_raw_data; // File bytes of a block of a non-contiguous image, allocated on first use
+    BmpLayout d_layout;     // Pixel layout, parsed by decode_magic_string()
+    size_t d_cover_pos;     // Cover bytes decoded from so far
+    unsigned char d_window[FRAME_WINDOW_SIZE]; // First cover bytes of the image, read with the BMP header
+    size_t d_window_len;    // Cover bytes in d_window (0 once the cursor has left it)
+    char magic_data[sizeof(MAGIC_STRING)];
+    char d_extn_secret_file[MAX_FILE_SUFFIX + 1];
+    int d_extn_size;
+    int depth;              // Bits per image byte of the payload fields (from the frame header)
+    int d_flags;            // Frame flags (FRAME_FLAG_*)
+    int d_version;          // Frame version (FRAME_VERSION_64: 64-bit file size and chunk offsets)
+    ChunkIndex d_index;     // Chunk index read from an indexed payload
+    uint32_t *d_crcs;       // Checksums of the decoded chunks, compared against d_index
+    uint32_t d_checksum;    // Payload checksum recorded in the frame (FRAME_FLAG_CHECKSUM)
+    uint32_t d_payload_crc; // Checksum of the decoded payload, compared against d_checksum
+
+    /* Partial extraction (optional) */
+    int use_range;          // Decode only range_length bytes starting at range_offset
+    long range_offset;
+    long range_length;
+
+    /* Archives (optional) */
+    ArchiveDir d_archive;   // Directory read from an archive, kept until release_decode_info()
+    int list_only;          // Stop after reading the directory
+    const char *d_member;   // Member to extract (sets the range to it)
+    uint32_t d_range_crc;   // CRC32C of the decoded range, checked against the member's
+
+    /* Sharded payloads (optional) */
+    ShardInfo d_shard;      // Shard header read from a shard (FRAME_FLAG_SHARD)
+    const ShardInfo *d_join; // Shard expected when joining: its data goes to its offset in an output the caller sized
+
+    int probe_only;         // Stop after the file size and shard header (probe mode)
+
+    /* Memory-mapped backend (optional) */
+    int use_mmap;
+    unsigned char *d_src_map;
+    size_t d_map_size;
+
+    int num_threads; // Strip workers for the secret data (<= 1: sequential)
+    int use_aio;     // Pipeline the stdio secret data stage (see aio.h)
+
+    /* Progress reporting */
+    Stage stage;            // Stage being run (the failed one if decoding fails)
+    StageCallback progress; // Called after each successful stage (optional)
+    void *progress_arg;     // Passed to progress
 
     /* Secret File Info */
-    int size_secret_file;
+    long size_secret_file;
     FILE *fptr_d_dest_image;
     FILE *fptr_d_secret;
     char *d_secret_fname;
+    char *d_secret_data;        // Decoded block buffer (MAX_SECRET_BUF_SIZE), allocated on first use
+    unsigned char *d_out_mem;   // Caller buffer receiving the secret instead of d_secret_fname (optional)
+    size_t d_out_cap;           // Size of d_out_mem
 } DecodeInfo;
 
 /* Decoding function prototypes */
@@ -50,9 +109,18 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
 /* Get File pointers for i/p and o/p files */
 Status open_files_decode(DecodeInfo *decInfo);
 
+/* Release the mapping, close files and free decoded fields */
+Status close_files_decode(DecodeInfo *decInfo);
+
 /* Perform the decoding */
 Status do_decoding(DecodeInfo *decInfo);
 
+/* Run every stage after opening: magic string through secret file data */
+Status decode_frame(DecodeInfo *decInfo);
+
+/* Free the buffers kept in decInfo across decodings */
+void release_decode_info(DecodeInfo *decInfo);
+
 /* Store Magic String */
 Status decode_magic_string(DecodeInfo *decInfo);
 
@@ -62,11 +130,11 @@ Status decode_data_from_image(int size, FILE *fptr_d_src_image, DecodeInfo *decI
 /* Decode a byte into LSB of image data array */
 Status decode_byte_from_lsb (char *data, char *image_buffer);
 
-/* Decode secret file extension size */
-Status decode_extension_size (int size, FILE *fptr_d_src_image);
+/* Decode secret file extension size (at most max_size bytes) */
+Status decode_extension_size (int max_size, DecodeInfo *decInfo);
 
-/* Decode LSB Size */
-Status decode_size_from_lsb (char *buffer, int *size);
+/* Decode a 32-bit LSB size field */
+Status decode_size_from_lsb (char *buffer, uint32_t *size);
 
 /* Decode secret file extension */
 Status decode_secret_file_extension (char *file_ext, DecodeInfo *decInfo);
@@ -75,9 +143,21 @@ Status decode_secret_file_extension (char *file_ext, DecodeInfo *decInfo);
 Status decode_extension_data (int size, FILE *fptr_d_src_image, DecodeInfo *decInfo);
 
 /* Decode secret file size */
-Status decode_secret_file_size (int file_size, DecodeInfo *decInfo);
+Status decode_secret_file_size (long file_size, DecodeInfo *decInfo);
+
+/* Decode the payload checksum that follows the file size */
+Status decode_payload_checksum (DecodeInfo *decInfo);
+
+/* Decode the shard header that follows the payload checksum */
+Status decode_shard_header (DecodeInfo *decInfo);
+
+/* Decode the chunk index of an indexed payload */
+Status decode_chunk_index (DecodeInfo *decInfo);
+
+/* Decode the directory of an archive */
+Status decode_archive_directory (DecodeInfo *decInfo);
 
-/* Encode secret file data */
+/* Decode secret file data (or the requested range of it) */
 Status decode_secret_file_data (DecodeInfo *decInfo);
 
 #endif
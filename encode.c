@@ -16,101 +16,624 @@
  * - Copying the remaining image data after encoding.
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 #include "encode.h"
 #include "types.h"
 #include "common.h"
+#include "lsb.h"
+#include "parallel.h"
+#include "aio.h"
+#include "chunkidx.h"
+#include "archive.h"
+#include "crc32c.h"
+#include "compress.h"
+#include "bmp.h"
 
 /* Function Definitions */
 
-/* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image)
+/* Read the BMP_HEADER_SIZE-byte BMP header from the start of an image */
+static Status read_bmp_header(FILE *fptr_image, unsigned char *header)
 {
-    uint width, height;
-    fseek(fptr_image, 18, SEEK_SET);
-    fread(&width, sizeof(int), 1, fptr_image);
-    printf("Width = %u\n", width);
-    fread(&height, sizeof(int), 1, fptr_image);
-    printf("Height = %u\n", height);
-    return width * height * 3;
+    fseek(fptr_image, 0, SEEK_SET);
+    return fread(header, sizeof(char), BMP_HEADER_SIZE, fptr_image) == BMP_HEADER_SIZE ? e_success : e_failure;
+}
+
+/* Get image size: the cover bytes of the pixel array */
+size_t get_image_size_for_bmp(FILE *fptr_image)
+{
+    unsigned char header[BMP_HEADER_SIZE] = { 0 };
+    BmpLayout layout;
+
+    if (read_bmp_header(fptr_image, header) != e_success || bmp_parse_layout(header, sizeof(header), &layout) != e_success)
+        return 0;
+    return layout.capacity;
+}
+
+/*
+ * Map the stego image read-write, pre-sized to map_size with ftruncate(); if
+ * it is a reflink clone only the pages that are actually written get copied.
+*/
+static Status map_stego_image(EncodeInfo *encInfo)
+{
+    int fd_stego = fileno(encInfo->fptr_stego_image);
+
+    if (!encInfo->tail_cloned && ftruncate(fd_stego, encInfo->map_size) != 0)
+        return e_failure;
+    encInfo->stego_map = mmap(NULL, encInfo->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_stego, 0);
+    if (encInfo->stego_map == MAP_FAILED)
+    {
+        encInfo->stego_map = NULL;
+        return e_failure;
+    }
+
+    madvise(encInfo->stego_map, encInfo->map_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(encInfo->stego_map, encInfo->map_size, MADV_HUGEPAGE);
+#endif
+    return e_success;
+}
+
+/* Map the cover read-only and the stego image read-write, both the size of the cover */
+static Status map_images(EncodeInfo *encInfo)
+{
+    struct stat st;
+    int fd_src = fileno(encInfo->fptr_src_image);
+
+    if (fstat(fd_src, &st) != 0 || st.st_size < BMP_HEADER_SIZE || (uintmax_t)st.st_size > SIZE_MAX)
+        return e_failure;
+
+    encInfo->map_size = st.st_size;
+    encInfo->src_map = mmap(NULL, encInfo->map_size, PROT_READ, MAP_PRIVATE, fd_src, 0);
+    if (encInfo->src_map == MAP_FAILED)
+    {
+        encInfo->src_map = NULL;
+        return e_failure;
+    }
+    if (map_stego_image(encInfo) != e_success)
+    {
+        munmap(encInfo->src_map, encInfo->map_size);
+        encInfo->src_map = NULL;
+        return e_failure;
+    }
+
+    madvise(encInfo->src_map, encInfo->map_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(encInfo->src_map, encInfo->map_size, MADV_HUGEPAGE);
+#endif
+    return e_success;
+}
+
+/* Release the mappings and close every file opened by open_files() */
+Status close_files(EncodeInfo *encInfo)
+{
+    Status status = e_success;
+
+    if (encInfo->stego_map != NULL)
+    {
+        if (msync(encInfo->stego_map, encInfo->map_size, MS_ASYNC) != 0)
+            status = e_failure;
+        munmap(encInfo->stego_map, encInfo->map_size);
+        encInfo->stego_map = NULL;
+    }
+    if (encInfo->cover != NULL)
+    {
+        cover_cache_release(encInfo->cover_cache, encInfo->cover);
+        encInfo->cover = NULL;
+    }
+    else if (encInfo->src_map != NULL)
+        munmap(encInfo->src_map, encInfo->map_size);
+    encInfo->src_map = NULL;
+    if (encInfo->fptr_src_image != NULL)
+        fclose(encInfo->fptr_src_image);
+    if (encInfo->fptr_secret != NULL)
+        fclose(encInfo->fptr_secret);
+    if (encInfo->fptr_stego_image != NULL && fclose(encInfo->fptr_stego_image) != 0)
+        status = e_failure;
+    encInfo->fptr_src_image = encInfo->fptr_secret = encInfo->fptr_stego_image = NULL;
+    return status;
+}
+
+/*
+ * Try to make the stego image a copy-on-write clone of the cover (btrfs, XFS).
+ * On success only the modified prefix is written afterwards and the tail copy
+ * is skipped; otherwise the normal copy path is used.
+*/
+static Status clone_cover_to_stego(EncodeInfo *encInfo)
+{
+#ifdef FICLONE
+    if (ioctl(fileno(encInfo->fptr_stego_image), FICLONE, fileno(encInfo->fptr_src_image)) == 0)
+        return e_success;
+#endif
+    return e_failure;
 }
 
 /* Open files for source image, secret file, and stego image */
 Status open_files(EncodeInfo *encInfo)
 {
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
-    if (encInfo->fptr_src_image == NULL) return e_failure;
+    /* Block buffers are kept across encodings and freed by release_encode_info() */
+    if (encInfo->image_data == NULL && (encInfo->image_data = malloc(MAX_IMAGE_BUF_SIZE)) == NULL)
+        return e_failure;
+    if (encInfo->secret_data == NULL && (encInfo->secret_data = malloc(MAX_SECRET_BUF_SIZE)) == NULL)
+        return e_failure;
+
+    /* A cached cover is already mapped and parsed, so there is nothing to open */
+    if (encInfo->cover_cache != NULL)
+        encInfo->cover = cover_cache_acquire(encInfo->cover_cache, encInfo->src_image_fname,
+                                             encInfo->fptr_src_image != NULL ? fileno(encInfo->fptr_src_image) : -1);
+    if (encInfo->cover != NULL)
+    {
+        encInfo->src_map = encInfo->cover->data;
+        encInfo->map_size = encInfo->cover->size;
+    }
 
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
-    if (encInfo->fptr_secret == NULL) return e_failure;
+    /* Streams the caller opened already (daemon mode, see serve.h) are used as they are */
+    if (encInfo->fptr_src_image == NULL && encInfo->cover == NULL)
+    {
+        encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
+        if (encInfo->fptr_src_image == NULL) return e_failure;
+    }
 
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
+    /* Archive members are opened one at a time while they are embedded */
+    if (encInfo->archive == NULL && encInfo->fptr_secret == NULL)
+    {
+        encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
+        if (encInfo->fptr_secret == NULL) return e_failure;
+    }
+
+    /* A shared writable mapping needs the stego image opened for reading too */
+    if (encInfo->fptr_stego_image == NULL)
+        encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, encInfo->use_mmap ? "w+" : "w");
     if (encInfo->fptr_stego_image == NULL) return e_failure;
 
+    /* The tail of a cached cover is written from its mapping */
+    encInfo->tail_cloned = encInfo->cover == NULL && clone_cover_to_stego(encInfo) == e_success;
+
+    if (encInfo->use_mmap)
+        return encInfo->cover != NULL ? map_stego_image(encInfo) : map_images(encInfo);
     return e_success;
 }
 
 /* Validate and read input arguments */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 {
-    if (strcmp(strstr(argv[2], "."), ".bmp") == 0)
+    char *extn = strrchr(argv[2], '.');
+    if (extn != NULL && strcmp(extn, ".bmp") == 0)
         encInfo->src_image_fname = argv[2];
     else return e_failure;
 
-    if (strcmp(strstr(argv[3], "."), ".txt") == 0)
-        encInfo->secret_fname = argv[3];
-    else return e_failure;
+    /* Any secret file type is accepted; its extension (if any) is stored in the image */
+    char *base = strrchr(argv[3], '/');
+    extn = strrchr(base ? base : argv[3], '.');
+    if (extn == NULL)
+        extn = "";
+    if (strlen(extn) > MAX_FILE_SUFFIX)
+        return e_failure;
+    strcpy(encInfo->extn_secret_file, extn);
+    encInfo->secret_fname = argv[3];
 
     encInfo->stego_image_fname = argv[4] ? argv[4] : "stego.bmp";
     return e_success;
 }
 
+/* Bits per image byte used for the payload fields */
+static int payload_depth(const EncodeInfo *encInfo)
+{
+    return encInfo->depth > 1 ? encInfo->depth : 1;
+}
+
+/* Frame flags of the payload; any flag or a deeper embedding needs the extended frame */
+static int frame_flags(const EncodeInfo *encInfo)
+{
+    return (encInfo->use_index ? FRAME_FLAG_INDEX : 0) | (encInfo->archive != NULL ? FRAME_FLAG_ARCHIVE : 0) |
+           (encInfo->compress ? FRAME_FLAG_COMPRESS : 0) | (encInfo->use_checksum ? FRAME_FLAG_CHECKSUM : 0) |
+           (encInfo->shard != NULL ? FRAME_FLAG_SHARD : 0);
+}
+
+/* Frame version: 64-bit sizes only for payloads the 32-bit fields cannot describe */
+static int frame_version(const EncodeInfo *encInfo)
+{
+    return encInfo->size_secret_file > FRAME_V1_MAX_SIZE ? FRAME_VERSION_64 : FRAME_VERSION;
+}
+
+/* Whether the payload needs the extended frame rather than the legacy one */
+static int extended_frame(const EncodeInfo *encInfo)
+{
+    return payload_depth(encInfo) > 1 || frame_flags(encInfo) != 0 || frame_version(encInfo) != FRAME_VERSION;
+}
+
+/* Bytes of the file size field */
+static size_t size_field_bytes(const EncodeInfo *encInfo)
+{
+    return frame_version(encInfo) == FRAME_VERSION_64 ? 8 : 4;
+}
+
+/* Bytes of one chunk index entry */
+static size_t index_entry_size(const EncodeInfo *encInfo)
+{
+    return frame_version(encInfo) == FRAME_VERSION_64 ? INDEX_ENTRY_SIZE_64 : INDEX_ENTRY_SIZE;
+}
+
+/* Image bytes of the data field: a compressed payload is checked against its worst case, all blocks stored */
+static size_t data_cover_size(const EncodeInfo *encInfo, int depth)
+{
+    size_t size = encInfo->size_secret_file;
+    size_t blocks = size / COMPRESS_BLOCK_SIZE;
+    size_t last = size % COMPRESS_BLOCK_SIZE;
+
+    if (!encInfo->compress)
+        return lsb_cover_size(size, depth);
+    return blocks * (lsb_cover_size(COMPRESS_HEADER_SIZE, depth) + lsb_cover_size(COMPRESS_BLOCK_SIZE, depth)) +
+           (last > 0 ? lsb_cover_size(COMPRESS_HEADER_SIZE, depth) + lsb_cover_size(last, depth) : 0);
+}
+
+/* Offset of the first byte to embed within the secret file: a shard starts partway in */
+static long secret_offset(const EncodeInfo *encInfo)
+{
+    return encInfo->shard != NULL ? encInfo->shard->offset : 0;
+}
+
+/* Chunk size of an indexed payload: whole groups at the payload depth */
+static uint32_t index_chunk_size(int depth)
+{
+    return lsb_align_run(INDEX_CHUNK_SIZE, depth);
+}
+
+/* Cover bytes the whole payload takes: magic string and frame header at 1 bit per byte, the rest at the payload depth */
+static size_t payload_cover_size(const EncodeInfo *encInfo)
+{
+    int depth = payload_depth(encInfo);
+    size_t needed = 8 * strlen(MAGIC_STRING) + (extended_frame(encInfo) ? 8 * FRAME_HEADER_SIZE : 0)
+                    + lsb_cover_size(4, depth) + lsb_cover_size(strlen(encInfo->extn_secret_file), depth)
+                    + lsb_cover_size(size_field_bytes(encInfo), depth) + data_cover_size(encInfo, depth);
+    if (encInfo->use_checksum)
+        needed += lsb_cover_size(4, depth);
+    if (encInfo->shard != NULL)
+        needed += lsb_cover_size(SHARD_HEADER_SIZE, depth);
+    if (encInfo->use_index)
+        needed += lsb_cover_size(4, depth) + lsb_cover_size(index_entry_size(encInfo) * chunk_index_count(encInfo->size_secret_file, index_chunk_size(depth)), depth);
+    if (encInfo->archive != NULL)
+        needed += lsb_cover_size(4, depth) + lsb_cover_size(archive_dir_size(encInfo->archive), depth);
+    return needed;
+}
+
 /* Check if the image has enough capacity to hold the secret file */
 Status check_capacity(EncodeInfo *encInfo)
 {
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
-    encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+    unsigned char header[BMP_HEADER_SIZE];
 
-    if (encInfo->image_capacity >= 54 + 16 + 32 + 32 + 32 + (8 * encInfo->size_secret_file))
+    /* A cached cover was parsed when it was cached */
+    if (encInfo->cover != NULL)
+        encInfo->layout = encInfo->cover->layout;
+    else
+    {
+        if (encInfo->src_map != NULL)
+        {
+            if (encInfo->map_size < sizeof(header))
+                return e_failure;
+            memcpy(header, encInfo->src_map, sizeof(header));
+        }
+        else if (read_bmp_header(encInfo->fptr_src_image, header) != e_success)
+            return e_failure;
+        if (bmp_parse_layout(header, sizeof(header), &encInfo->layout) != e_success)
+            return e_failure;
+    }
+    encInfo->image_capacity = encInfo->layout.capacity;
+    encInfo->image_width = encInfo->layout.width;
+    encInfo->image_height = encInfo->layout.height;
+    encInfo->bits_per_pixel = encInfo->layout.bits_per_pixel;
+    encInfo->cover_pos = 0;
+    if (encInfo->archive != NULL)
+        encInfo->size_secret_file = encInfo->archive->data_size;
+    else if (encInfo->shard != NULL)
+        encInfo->size_secret_file = encInfo->shard->length;
+    else if (encInfo->secret_mem == NULL)
+    {
+        /* Payload offsets are longs throughout */
+        off_t size = get_file_size(encInfo->fptr_secret);
+        if (size < 0 || size > LONG_MAX)
+            return e_failure;
+        encInfo->size_secret_file = size;
+    }
+
+    if (encInfo->depth < 0 || encInfo->depth > LSB_MAX_DEPTH)
+        return e_failure;
+    /* Index entries and member offsets address the data field, whose compressed size is not known up front */
+    if (encInfo->compress && (encInfo->use_index || encInfo->archive != NULL))
+        return e_failure;
+    /* A shard is a piece of one secret file, and its checksum is what verifies it on joining */
+    if (encInfo->shard != NULL && (encInfo->archive != NULL || !encInfo->use_checksum))
+        return e_failure;
+
+    if (encInfo->image_capacity >= payload_cover_size(encInfo))
         return e_success;
     return e_failure;
 }
 
-/* Get file size */
-uint get_file_size(FILE *fptr)
+/* Most secret bytes a cover of capacity cover bytes holds: the frame grows with the payload, so search for it */
+long encode_max_secret_size(const EncodeInfo *encInfo, size_t capacity)
+{
+    EncodeInfo trial = *encInfo;
+    int depth = payload_depth(encInfo);
+    long low = -1;
+
+    /* No size from high on fits: its data field alone takes more than capacity cover bytes */
+    long high = capacity / 8 * depth + depth < (size_t)LONG_MAX ? (long)(capacity / 8 * depth + depth) : LONG_MAX;
+
+    if (trial.depth < 0 || trial.depth > LSB_MAX_DEPTH)
+        return -1;
+    while (high - low > 1)
+    {
+        trial.size_secret_file = low + (high - low) / 2;
+        if (payload_cover_size(&trial) <= capacity)
+            low = trial.size_secret_file;
+        else
+            high = trial.size_secret_file;
+    }
+    return low;
+}
+
+/* Get file size (-1 on failure) */
+off_t get_file_size(FILE *fptr)
 {
-    fseek(fptr, 0, SEEK_SET);
-    fseek(fptr, 0, SEEK_END);
-    return ftell(fptr);
+    if (fseeko(fptr, 0, SEEK_END) != 0)
+        return -1;
+    return ftello(fptr);
 }
 
-/* Copy BMP header from source to destination */
+/*
+ * Copy the headers before the pixel array out of the mapped cover, into the
+ * stego mapping or stream (nothing to copy when encoding in place)
+*/
+static Status copy_bmp_header_mapped(EncodeInfo *encInfo)
+{
+    size_t size = encInfo->layout.data_offset;
+
+    if (encInfo->map_size < size)
+        return e_failure;
+    if (encInfo->stego_map == NULL)
+        return fwrite(encInfo->src_map, sizeof(char), size, encInfo->fptr_stego_image) == size ? e_success : e_failure;
+    if (encInfo->stego_map != encInfo->src_map)
+        memcpy(encInfo->stego_map, encInfo->src_map, encInfo->layout.data_offset);
+    return e_success;
+}
+
+/* Copy the BMP header, DIB header and anything else before the pixel array from source to destination */
 Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
 {
-    char buffer[54];
+    unsigned char buffer[4096];
+    BmpLayout layout;
+
+    if (read_bmp_header(fptr_src_image, buffer) != e_success || bmp_parse_layout(buffer, BMP_HEADER_SIZE, &layout) != e_success)
+        return e_failure;
+
     fseek(fptr_src_image, 0, SEEK_SET);
-    fread(buffer, sizeof(char), 54, fptr_src_image);
-    fwrite(buffer, sizeof(char), 54, fptr_dest_image);
+    for (size_t left = layout.data_offset; left > 0; )
+    {
+        size_t chunk = left < sizeof(buffer) ? left : sizeof(buffer);
+        if (fread(buffer, sizeof(char), chunk, fptr_src_image) != chunk ||
+            fwrite(buffer, sizeof(char), chunk, fptr_dest_image) != chunk)
+            return e_failure;
+        left -= chunk;
+    }
     return e_success;
 }
 
-/* Encode a magic string into the image */
-Status encode_magic_string(char *magic_string, EncodeInfo *encInfo)
+
+/*
+ * Get the next n cover bytes to embed into.
+ * With the mmap backend the bytes are used in place: image_in points into the
+ * cover mapping and image_out into the stego mapping. A mapped (cached) cover
+ * written to a stream embeds from the mapping into encInfo->image_data.
+ * Otherwise the bytes are read into image_data, which serves as both. The
+ * bytes of a non-contiguous cover (see bmp.h) are gathered into image_data
+ * either way, from the mappings or from their file extent in raw_data.
+*/
+static Status cover_block_begin(EncodeInfo *encInfo, size_t n, unsigned char **image_in, unsigned char **image_out)
 {
-    encode_data_to_image(magic_string, 2, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+    const BmpLayout *layout = &encInfo->layout;
+    size_t pos = encInfo->cover_pos;
+    const unsigned char *raw;
+
+    if (n > layout->capacity - pos)
+        return e_failure;
+    off_t offset = bmp_offset(layout, pos);
+    size_t extent = bmp_extent(layout, pos, n);
+
+    if (encInfo->src_map != NULL && (size_t)offset + extent > encInfo->map_size)
+        return e_failure;
+    if (encInfo->stego_map != NULL)
+    {
+        if (bmp_is_contiguous(layout))
+        {
+            *image_in = encInfo->src_map + offset;
+            *image_out = encInfo->stego_map + offset;
+            return e_success;
+        }
+        /* Padding and alpha bytes go to the stego image unchanged */
+        if (encInfo->stego_map != encInfo->src_map)
+            memcpy(encInfo->stego_map + offset, encInfo->src_map + offset, extent);
+        raw = encInfo->src_map + offset;
+    }
+    else if (bmp_is_contiguous(layout))
+    {
+        *image_out = (unsigned char *)encInfo->image_data;
+        if (encInfo->src_map != NULL)
+        {
+            *image_in = encInfo->src_map + offset;
+            return e_success;
+        }
+        if (fread(encInfo->image_data, sizeof(char), n, encInfo->fptr_src_image) != n)
+            return e_failure;
+        *image_in = *image_out;
+        return e_success;
+    }
+    else
+    {
+        if (encInfo->raw_data == NULL && (encInfo->raw_data = malloc(BMP_EXTENT_BOUND(MAX_IMAGE_BUF_SIZE))) == NULL)
+            return e_failure;
+        if (encInfo->src_map != NULL)
+            memcpy(encInfo->raw_data, encInfo->src_map + offset, extent);
+        else if (fread(encInfo->raw_data, sizeof(char), extent, encInfo->fptr_src_image) != extent)
+            return e_failure;
+        raw = encInfo->raw_data;
+    }
+
+    /* The buffer API has no block buffer until a non-contiguous cover needs one */
+    if (encInfo->image_data == NULL && (encInfo->image_data = malloc(MAX_IMAGE_BUF_SIZE)) == NULL)
+        return e_failure;
+    bmp_gather(layout, pos, n, raw, (unsigned char *)encInfo->image_data);
+    *image_in = *image_out = (unsigned char *)encInfo->image_data;
     return e_success;
 }
 
-/* Encode secret data byte by byte into image pixels */
-Status encode_data_to_image(char *data, int size, FILE *fptr_src_image, FILE *fptr_stego_image, EncodeInfo *encInfo)
+/* Commit the n cover bytes obtained from cover_block_begin() to the stego image */
+static Status cover_block_end(EncodeInfo *encInfo, size_t n)
 {
-    for (int i = 0; i < size; i++)
+    const BmpLayout *layout = &encInfo->layout;
+    size_t pos = encInfo->cover_pos;
+
+    encInfo->cover_pos += n;
+    if (encInfo->stego_map != NULL)
     {
-        fread(encInfo->image_data, sizeof(char), 8, fptr_src_image);
-        encode_byte_to_lsb(data[i], encInfo->image_data);
-        fwrite(encInfo->image_data, sizeof(char), 8, fptr_stego_image);
+        if (!bmp_is_contiguous(layout))
+            bmp_scatter(layout, pos, n, (unsigned char *)encInfo->image_data, encInfo->stego_map + bmp_offset(layout, pos));
+        return e_success;
+    }
+    if (bmp_is_contiguous(layout))
+        return fwrite(encInfo->image_data, sizeof(char), n, encInfo->fptr_stego_image) == n ? e_success : e_failure;
+
+    size_t extent = bmp_extent(layout, pos, n);
+    bmp_scatter(layout, pos, n, (unsigned char *)encInfo->image_data, encInfo->raw_data);
+    return fwrite(encInfo->raw_data, sizeof(char), extent, encInfo->fptr_stego_image) == extent ? e_success : e_failure;
+}
+
+/*
+ * Embed run secret bytes at depth into the cover bytes from cover position
+ * pos on, with positional I/O on the descriptors or directly on the
+ * mappings; the stdio streams are left where they are. image and raw are
+ * scratch buffers for the cover bytes and their file extent, needed unless
+ * the mapped cover is contiguous (raw only for a non-contiguous file cover).
+*/
+static Status embed_at(EncodeInfo *encInfo, size_t pos, const unsigned char *data, size_t run, int depth,
+                       unsigned char *image, unsigned char *raw)
+{
+    const BmpLayout *layout = &encInfo->layout;
+    lsb_embed_fn embed = lsb_embed_for_depth(depth);
+    size_t span = lsb_cover_size(run, depth);
+    int contiguous = bmp_is_contiguous(layout);
+
+    if (pos > layout->capacity || span > layout->capacity - pos)
+        return e_failure;
+    off_t offset = bmp_offset(layout, pos);
+    size_t extent = bmp_extent(layout, pos, span);
+
+    if (encInfo->src_map != NULL && (size_t)offset + extent > encInfo->map_size)
+        return e_failure;
+    if (encInfo->stego_map != NULL)
+    {
+        if (contiguous)
+        {
+            embed(encInfo->stego_map + offset, encInfo->src_map + offset, data, run);
+            return e_success;
+        }
+        if (encInfo->stego_map != encInfo->src_map)
+            memcpy(encInfo->stego_map + offset, encInfo->src_map + offset, extent);
+        bmp_gather(layout, pos, span, encInfo->src_map + offset, image);
+        embed(image, image, data, run);
+        bmp_scatter(layout, pos, span, image, encInfo->stego_map + offset);
+        return e_success;
+    }
+
+    if (encInfo->src_map != NULL)
+    {
+        if (contiguous)
+        {
+            embed(image, encInfo->src_map + offset, data, run);
+            return pwrite_full(fileno(encInfo->fptr_stego_image), image, span, offset);
+        }
+        memcpy(raw, encInfo->src_map + offset, extent);
     }
+    else if (pread_full(fileno(encInfo->fptr_src_image), contiguous ? image : raw, extent, offset) != e_success)
+        return e_failure;
+    if (contiguous)
+    {
+        embed(image, image, data, run);
+        return pwrite_full(fileno(encInfo->fptr_stego_image), image, span, offset);
+    }
+    bmp_gather(layout, pos, span, raw, image);
+    embed(image, image, data, run);
+    bmp_scatter(layout, pos, span, image, raw);
+    return pwrite_full(fileno(encInfo->fptr_stego_image), raw, extent, offset);
+}
+
+/* Allocate the scratch buffers embed_at() needs for span cover bytes (NULL where none is needed) */
+static Status alloc_embed_buffers(const EncodeInfo *encInfo, size_t span, unsigned char **image, unsigned char **raw)
+{
+    int contiguous = bmp_is_contiguous(&encInfo->layout);
+
+    *image = (encInfo->stego_map == NULL || !contiguous) ? malloc(span + 1) : NULL;
+    *raw = (encInfo->stego_map == NULL && !contiguous) ? malloc(BMP_EXTENT_BOUND(span)) : NULL;
+    if ((encInfo->stego_map == NULL || !contiguous) && *image == NULL)
+        return e_failure;
+    if (encInfo->stego_map == NULL && !contiguous && *raw == NULL)
+        return e_failure;
+    return e_success;
+}
+
+/*
+ * Embed size secret bytes at depth bits per image byte, block by block.
+ * Each pass takes up to MAX_IMAGE_BUF_SIZE cover bytes, embeds the matching
+ * run of secret bytes and writes the block back in one go. Runs are cut on
+ * group boundaries, so the blocks line up with a single run of size bytes.
+*/
+static Status encode_run_at_depth(const char *data, long size, int depth, EncodeInfo *encInfo)
+{
+    lsb_embed_fn embed = lsb_embed_for_depth(depth);
+    long max_run = lsb_align_run(MAX_SECRET_BUF_SIZE, depth);
+
+    while (size > 0)
+    {
+        long run = size < max_run ? size : max_run;
+        size_t span = lsb_cover_size(run, depth);
+        unsigned char *image_in, *image_out;
+
+        if (cover_block_begin(encInfo, span, &image_in, &image_out) != e_success)
+            return e_failure;
+        embed(image_out, image_in, (const unsigned char *)data, run);
+        if (cover_block_end(encInfo, span) != e_success)
+            return e_failure;
+
+        data += run;
+        size -= run;
+    }
+    return e_success;
+}
+
+/* Encode secret data into image pixels at the payload depth */
+Status encode_data_to_image(char *data, long size, FILE *fptr_src_image, FILE *fptr_stego_image, EncodeInfo *encInfo)
+{
+    return encode_run_at_depth(data, size, payload_depth(encInfo), encInfo);
+}
+
+/* Encode a magic string into the image (always 1 bit per byte) */
+Status encode_magic_string(char *magic_string, EncodeInfo *encInfo)
+{
+    return encode_run_at_depth(magic_string, strlen(magic_string), 1, encInfo);
 }
 
 /* Encode a byte into the LSB of image data */
@@ -122,153 +645,845 @@ Status encode_byte_to_lsb(char data, char *image_buffer)
         image_buffer[i] = (image_buffer[i] & 0xFE) | ((data & mask) >> (7 - i));
         mask = mask >> 1;
     }
+    return e_success;
 }
 
 /* Encode the secret file extension size */
-Status encode_secret_file_extn_size(int size, FILE *fptr_src_image, FILE *fptr_stego_image)
+Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
 {
-    char buffer[32];
-    fread(buffer, 32, 1, fptr_src_image);
-    encode_size_to_lsb(size, buffer);
-    fwrite(buffer, 32, 1, fptr_stego_image);
+    char bytes[4] = { (uint)size >> 24, (uint)size >> 16, (uint)size >> 8, (uint)size };
+    return encode_data_to_image(bytes, 4, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+}
+
+/* Encode a 32-bit field in LSB (most significant first); the file size field is wider in 64-bit frames */
+Status encode_size_to_lsb(uint32_t size, char *image_buffer)
+{
+    unsigned char bytes[4] = { size >> 24, size >> 16, size >> 8, size };
+    lsb_embed((unsigned char *)image_buffer, (unsigned char *)image_buffer, bytes, 4);
     return e_success;
 }
 
-/* Encode the size of secret file in LSB */
-Status encode_size_to_lsb(int size, char *image_buffer)
+/* Encode the secret file extension into the image */
+Status encode_secret_file_extn(char *file_extn, EncodeInfo *encInfo)
+{
+    return encode_data_to_image(file_extn, strlen(file_extn), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+}
+
+/* Encode secret file size into the image (64 bits in a FRAME_VERSION_64 frame) */
+Status encode_secret_file_size(long size, EncodeInfo *encInfo)
+{
+    int n = size_field_bytes(encInfo);
+    char bytes[8];
+
+    for (int i = 0; i < n; i++)
+        bytes[i] = (uint64_t)size >> (8 * (n - 1 - i));
+    return encode_data_to_image(bytes, n, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+}
+
+/*
+ * Re-embed size bytes at the payload depth over a field embedded earlier at
+ * cover position pos. The stdio streams are left where they are.
+*/
+static Status encode_patch_field(EncodeInfo *encInfo, size_t pos, const unsigned char *data, size_t size)
 {
-    unsigned int mask = 1 << 31, i;
-    for (i = 0; i < 32; i++)
+    int depth = payload_depth(encInfo);
+    unsigned char *image, *raw;
+    Status status = alloc_embed_buffers(encInfo, lsb_cover_size(size, depth), &image, &raw);
+
+    if (status == e_success && encInfo->stego_map == NULL && fflush(encInfo->fptr_stego_image) != 0)
+        status = e_failure;
+    if (status == e_success)
+        status = embed_at(encInfo, pos, data, size, depth, image, raw);
+
+    free(image);
+    free(raw);
+    return status;
+}
+
+/* Embed the final index entries over the reserved ones */
+static Status encode_chunk_index_patch(EncodeInfo *encInfo)
+{
+    size_t size = (size_t)encInfo->index.num_chunks * encInfo->index.entry_size;
+    unsigned char *entries = malloc(size + 1);
+    Status status = e_failure;
+
+    if (entries != NULL)
     {
-        image_buffer[i] = (image_buffer[i] & 0xFE) | ((size & mask) >> (31 - i));
-        mask = mask >> 1;
+        chunk_index_store(&encInfo->index, entries);
+        status = encode_patch_field(encInfo, encInfo->index_offset, entries, size);
+    }
+    free(entries);
+    return status;
+}
+
+/* Embed the final archive directory over the reserved one */
+static Status encode_archive_directory_patch(EncodeInfo *encInfo)
+{
+    size_t size = archive_dir_size(encInfo->archive);
+    unsigned char *table = malloc(size);
+    Status status = e_failure;
+
+    if (table != NULL)
+    {
+        archive_dir_store(encInfo->archive, table);
+        status = encode_patch_field(encInfo, encInfo->archive_offset, table, size);
     }
+    free(table);
+    return status;
+}
+
+/* Embed the final payload checksum over the reserved one */
+static Status encode_payload_checksum_patch(EncodeInfo *encInfo)
+{
+    uint32_t crc = encInfo->payload_crc;
+    unsigned char bytes[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+
+    return encode_patch_field(encInfo, encInfo->checksum_offset, bytes, 4);
+}
+
+/*
+ * Account for n secret bytes at offset pos of the secret being embedded,
+ * while they are still in cache. payload_crc is the payload checksum to
+ * extend: the strip's own one in strip workers.
+*/
+static void note_secret_bytes(EncodeInfo *encInfo, long pos, const unsigned char *data, size_t n, uint32_t *payload_crc)
+{
+    if (encInfo->use_index)
+        chunk_index_update(encInfo->index.crc, encInfo->index.chunk_size, encInfo->secret_base + pos, data, n);
+    if (encInfo->secret_crc != NULL)
+        *encInfo->secret_crc = crc32c(*encInfo->secret_crc, data, n);
+    if (encInfo->use_checksum)
+        *payload_crc = crc32c(*payload_crc, data, n);
+}
+
+/* Context shared by the strip workers of one parallel encode */
+typedef struct
+{
+    EncodeInfo *encInfo;
+    size_t data_pos;                // Cover position of secret byte 0
+} EncodeStrips;
+
+/*
+ * Embed secret bytes [begin, end) of one strip.
+ * Workers never touch the shared FILE streams: they use pread/pwrite on the
+ * descriptors, or embed directly on the shared mappings.
+*/
+static Status encode_strip(void *ctx, long begin, long end)
+{
+    EncodeStrips *strips = ctx;
+    EncodeInfo *encInfo = strips->encInfo;
+    int fd_secret = encInfo->fptr_secret != NULL ? fileno(encInfo->fptr_secret) : -1;
+    unsigned char *buffer = encInfo->secret_mem != NULL ? NULL : malloc(MAX_SECRET_BUF_SIZE);
+    unsigned char *image, *raw;
+    int depth = payload_depth(encInfo);
+    long max_run = lsb_align_run(MAX_SECRET_BUF_SIZE, depth);
+    uint32_t crc = 0;
+    Status status = alloc_embed_buffers(encInfo, MAX_IMAGE_BUF_SIZE, &image, &raw);
+
+    if (encInfo->secret_mem == NULL && buffer == NULL)
+        status = e_failure;
+
+    for (long pos = begin; pos < end && status == e_success; pos += max_run)
+    {
+        size_t run = end - pos < max_run ? end - pos : max_run;
+        const unsigned char *secret = encInfo->secret_mem != NULL ? encInfo->secret_mem + pos : buffer;
+
+        if (encInfo->secret_mem == NULL && pread_full(fd_secret, buffer, run, secret_offset(encInfo) + pos) != e_success)
+        {
+            status = e_failure;
+            break;
+        }
+
+        note_secret_bytes(encInfo, pos, secret, run, &crc);
+        status = embed_at(encInfo, strips->data_pos + (size_t)pos * 8 / depth, secret, run, depth, image, raw);
+    }
+
+    /* Strips finish in any order; shifted checksums join by XOR (see crc32c.h) */
+    if (encInfo->use_checksum)
+        __atomic_fetch_xor(&encInfo->payload_crc, crc32c_shift(crc, encInfo->size_secret_file - end), __ATOMIC_RELAXED);
+    free(buffer);
+    free(image);
+    free(raw);
+    return status;
+}
+
+/* Encode the secret file data with num_threads strip workers */
+static Status encode_secret_file_data_parallel(EncodeInfo *encInfo)
+{
+    EncodeStrips strips = { encInfo, encInfo->cover_pos };
+    long size = encInfo->size_secret_file;
+    int depth = payload_depth(encInfo);
+
+    if (lsb_cover_size(size, depth) > encInfo->layout.capacity - encInfo->cover_pos)
+        return e_failure;
+    /* Every cover byte read so far has been written, so both streams sit at the same offset */
+    if (encInfo->stego_map == NULL && fflush(encInfo->fptr_stego_image) != 0)
+        return e_failure;
+
+    /*
+     * Strips start on group boundaries so each maps to whole image bytes, and
+     * on chunk boundaries when indexed so every checksum has a single owner.
+    */
+    long align = encInfo->use_index ? (long)encInfo->index.chunk_size : (long)lsb_group_size(depth);
+    if (run_strips(encInfo->num_threads, size, align, encode_strip, &strips) != e_success)
+        return e_failure;
+
+    encInfo->cover_pos += lsb_cover_size(size, depth);
+    if (encInfo->stego_map != NULL)
+        return e_success;
+    off_t end = bmp_offset(&encInfo->layout, encInfo->cover_pos);
+    if ((encInfo->src_map == NULL && fseeko(encInfo->fptr_src_image, end, SEEK_SET) != 0) ||
+        fseeko(encInfo->fptr_stego_image, end, SEEK_SET) != 0)
+        return e_failure;
     return e_success;
 }
 
-/* Encode the secret file extension into the image */
-Status encode_secret_file_extn(char *file_extn, EncodeInfo *encInfo)
+/* Context of one pipelined encode */
+typedef struct
 {
-    encode_data_to_image(file_extn, strlen(file_extn), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+    EncodeInfo *encInfo;
+    size_t data_pos;                // Cover position of secret byte 0
+    long max_run;                   // Secret bytes per block
+    int depth;
+} EncodePipeline;
+
+/* Slot buffers of a pipelined encode: cover extent, secret run, gathered cover bytes (non-contiguous covers) */
+enum
+{
+    PIPE_RAW,
+    PIPE_SECRET,
+    PIPE_IMAGE
+};
+
+/* Read the cover extent and the secret run of block index */
+static int encode_block_plan(void *ctx, long index, AioBlock *block)
+{
+    EncodePipeline *pipeline = ctx;
+    EncodeInfo *encInfo = pipeline->encInfo;
+    long pos = index * pipeline->max_run;
+
+    if (pos >= encInfo->size_secret_file)
+        return 0;
+    size_t run = encInfo->size_secret_file - pos < pipeline->max_run ? encInfo->size_secret_file - pos : pipeline->max_run;
+    size_t cover = pipeline->data_pos + (size_t)pos * 8 / pipeline->depth;
+
+    block->reads[0] = (AioRange){ fileno(encInfo->fptr_src_image), PIPE_RAW,
+                                  bmp_extent(&encInfo->layout, cover, lsb_cover_size(run, pipeline->depth)),
+                                  bmp_offset(&encInfo->layout, cover) };
+    block->reads[1] = (AioRange){ fileno(encInfo->fptr_secret), PIPE_SECRET, run, secret_offset(encInfo) + pos };
+    block->num_reads = 2;
+    return 1;
+}
+
+/* Embed the secret run of a block into its cover extent and write the extent out */
+static Status encode_block_transform(void *ctx, AioBlock *block)
+{
+    EncodePipeline *pipeline = ctx;
+    EncodeInfo *encInfo = pipeline->encInfo;
+    const BmpLayout *layout = &encInfo->layout;
+    const unsigned char *secret = block->buffers[PIPE_SECRET];
+    unsigned char *raw = block->buffers[PIPE_RAW];
+    long pos = block->index * pipeline->max_run;
+    size_t run = block->reads[1].len;
+    lsb_embed_fn embed = lsb_embed_for_depth(pipeline->depth);
+
+    /* Blocks arrive in order, so the running checksums see the secret sequentially */
+    note_secret_bytes(encInfo, pos, secret, run, &encInfo->payload_crc);
+    if (bmp_is_contiguous(layout))
+    {
+        embed(raw, raw, secret, run);
+    }
+    else
+    {
+        size_t cover = pipeline->data_pos + (size_t)pos * 8 / pipeline->depth;
+        size_t span = lsb_cover_size(run, pipeline->depth);
+        unsigned char *image = block->buffers[PIPE_IMAGE];
+
+        bmp_gather(layout, cover, span, raw, image);
+        embed(image, image, secret, run);
+        bmp_scatter(layout, cover, span, image, raw);
+    }
+
+    block->write = block->reads[0];
+    block->write.fd = fileno(encInfo->fptr_stego_image);
     return e_success;
 }
 
-/* Encode secret file size into the image */
-Status encode_secret_file_size(long size, EncodeInfo *encInfo)
+/*
+ * Encode the secret file data through the asynchronous pipeline (see aio.h):
+ * cover extents and secret runs are read ahead and stego extents written
+ * behind while the blocks in between are embedded, all with positional I/O.
+*/
+static Status encode_secret_file_data_pipelined(EncodeInfo *encInfo)
 {
-    char buffer[32];
-    fread (buffer, 32, 1, encInfo->fptr_src_image);
-    encode_size_to_lsb(size, buffer);
-    fwrite(buffer, 32, 1, encInfo->fptr_stego_image);
+    int depth = payload_depth(encInfo);
+    EncodePipeline pipeline = { encInfo, encInfo->cover_pos, lsb_align_run(MAX_SECRET_BUF_SIZE, depth), depth };
+    size_t sizes[] = { BMP_EXTENT_BOUND(MAX_IMAGE_BUF_SIZE), MAX_SECRET_BUF_SIZE, MAX_IMAGE_BUF_SIZE + 1 };
+    long size = encInfo->size_secret_file;
+
+    if (lsb_cover_size(size, depth) > encInfo->layout.capacity - encInfo->cover_pos)
+        return e_failure;
+    /* Every cover byte read so far has been written, so both streams sit at the same offset */
+    if (fflush(encInfo->fptr_stego_image) != 0)
+        return e_failure;
+    posix_fadvise(fileno(encInfo->fptr_secret), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int num_buffers = bmp_is_contiguous(&encInfo->layout) ? PIPE_IMAGE : PIPE_IMAGE + 1;
+    if (aio_run(sizes, num_buffers, encode_block_plan, encode_block_transform, &pipeline) != e_success)
+        return e_failure;
+
+    encInfo->cover_pos += lsb_cover_size(size, depth);
+    off_t end = bmp_offset(&encInfo->layout, encInfo->cover_pos);
+    if (fseeko(encInfo->fptr_src_image, end, SEEK_SET) != 0 || fseeko(encInfo->fptr_stego_image, end, SEEK_SET) != 0)
+        return e_failure;
     return e_success;
 }
 
-/* Encode the secret file data into the image */
+/*
+ * Encode the secret file data into the image.
+ * The secret is streamed in MAX_SECRET_BUF_SIZE chunks, so memory use does
+ * not depend on its size. While a chunk is embedded, the kernel is asked to
+ * read ahead the next one.
+*/
 Status encode_secret_file_data(EncodeInfo *encInfo)
 {
-    fseek(encInfo->fptr_secret, 0, SEEK_SET);
-    char str[encInfo->size_secret_file];
-    fread(str, encInfo->size_secret_file, 1, encInfo->fptr_secret);
-    encode_data_to_image(str, strlen(str), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+    long remaining = encInfo->size_secret_file;
+    long offset = 0;
+    long max_chunk = lsb_align_run(MAX_SECRET_BUF_SIZE, payload_depth(encInfo));
+
+    /* A running checksum over the whole secret needs its bytes in order */
+    if (encInfo->num_threads > 1 && encInfo->secret_crc == NULL)
+        return encode_secret_file_data_parallel(encInfo);
+
+    /* An in-memory secret is embedded straight from the caller's buffer */
+    if (encInfo->secret_mem != NULL)
+    {
+        note_secret_bytes(encInfo, 0, encInfo->secret_mem, remaining, &encInfo->payload_crc);
+        return encode_data_to_image((char *)encInfo->secret_mem, remaining, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+    }
+    if (encInfo->use_aio && encInfo->src_map == NULL)
+        return encode_secret_file_data_pipelined(encInfo);
+
+    /* Chunks end on group boundaries, so they embed exactly like one long run */
+    int fd_secret = fileno(encInfo->fptr_secret);
+    if (fseeko(encInfo->fptr_secret, secret_offset(encInfo), SEEK_SET) != 0)
+        return e_failure;
+    posix_fadvise(fd_secret, secret_offset(encInfo), 0, POSIX_FADV_SEQUENTIAL);
+    while (remaining > 0)
+    {
+        int chunk = remaining < max_chunk ? remaining : max_chunk;
+        if (fread(encInfo->secret_data, 1, chunk, encInfo->fptr_secret) != (size_t)chunk)
+            return e_failure;
+        note_secret_bytes(encInfo, offset, (unsigned char *)encInfo->secret_data, chunk, &encInfo->payload_crc);
+
+        offset += chunk;
+        remaining -= chunk;
+        if (remaining > 0)
+            posix_fadvise(fd_secret, secret_offset(encInfo) + offset, MAX_SECRET_BUF_SIZE, POSIX_FADV_WILLNEED);
+
+        if (encode_data_to_image(encInfo->secret_data, chunk, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo) != e_success)
+            return e_failure;
+    }
+    return e_success;
+}
+
+/*
+ * Encode the secret file data as compressed blocks. Each block of
+ * COMPRESS_BLOCK_SIZE secret bytes is read into the first half of the secret
+ * buffer and compressed into the second half; a block that does not shrink
+ * is embedded as is.
+*/
+static Status encode_secret_file_data_compressed(EncodeInfo *encInfo)
+{
+    unsigned char *buffer = (unsigned char *)encInfo->secret_data;
+    unsigned char *scratch = NULL;
+    long remaining = encInfo->size_secret_file;
+    long offset = 0;
+    Status status = e_success;
+
+    /* The buffer API embeds without a secret buffer of its own */
+    if (buffer == NULL && (buffer = scratch = malloc(2 * COMPRESS_BLOCK_SIZE)) == NULL)
+        return e_failure;
+
+    if (encInfo->fptr_secret != NULL && fseeko(encInfo->fptr_secret, secret_offset(encInfo), SEEK_SET) != 0)
+        status = e_failure;
+    while (remaining > 0 && status == e_success)
+    {
+        size_t raw = remaining < COMPRESS_BLOCK_SIZE ? remaining : COMPRESS_BLOCK_SIZE;
+        const unsigned char *block = encInfo->secret_mem != NULL ? encInfo->secret_mem + offset : buffer;
+        unsigned char *packed = buffer + COMPRESS_BLOCK_SIZE;
+
+        if (encInfo->secret_mem == NULL && fread(buffer, 1, raw, encInfo->fptr_secret) != raw)
+        {
+            status = e_failure;
+            break;
+        }
+
+        note_secret_bytes(encInfo, offset, block, raw, &encInfo->payload_crc);
+        size_t size = compress_block(block, raw, packed, raw - 1);
+        uint32_t header = size > 0 ? size : COMPRESS_STORED | raw;
+        char bytes[COMPRESS_HEADER_SIZE] = { header >> 24, header >> 16, header >> 8, header };
+        if (size == 0)
+        {
+            packed = (unsigned char *)block;
+            size = raw;
+        }
+
+        status = encode_data_to_image(bytes, COMPRESS_HEADER_SIZE, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+        if (status == e_success)
+            status = encode_data_to_image((char *)packed, size, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+        offset += raw;
+        remaining -= raw;
+    }
+
+    free(scratch);
+    return status;
+}
+
+/* Copy len bytes between descriptors with pread/pwrite through a large buffer */
+static Status copy_fd_range_buffered(int fd_src, off_t *off_src, int fd_dest, off_t *off_dest, off_t len)
+{
+    char *buffer = malloc(MAX_IMAGE_BUF_SIZE);
+    Status status = e_success;
+
+    if (buffer == NULL)
+        return e_failure;
+    while (len > 0 && status == e_success)
+    {
+        size_t chunk = len < MAX_IMAGE_BUF_SIZE ? (size_t)len : MAX_IMAGE_BUF_SIZE;
+        ssize_t got = pread(fd_src, buffer, chunk, *off_src);
+        if (got <= 0)
+        {
+            status = e_failure;
+            break;
+        }
+        for (ssize_t done = 0; done < got; )
+        {
+            ssize_t put = pwrite(fd_dest, buffer + done, got - done, *off_dest + done);
+            if (put <= 0)
+            {
+                status = e_failure;
+                break;
+            }
+            done += put;
+        }
+        *off_src += got;
+        *off_dest += got;
+        len -= got;
+    }
+    free(buffer);
+    return status;
+}
+
+/*
+ * Copy the remaining image data out of the mapped cover, into the stego
+ * mapping or stream (nothing to copy when encoding in place)
+*/
+static Status copy_remaining_img_data_mapped(EncodeInfo *encInfo)
+{
+    size_t offset = bmp_offset(&encInfo->layout, encInfo->cover_pos);
+
+    if (offset > encInfo->map_size)
+        return e_failure;
+    size_t size = encInfo->map_size - offset;
+    if (encInfo->stego_map == NULL)
+        return fwrite(encInfo->src_map + offset, sizeof(char), size, encInfo->fptr_stego_image) == size ? e_success : e_failure;
+    if (encInfo->stego_map != encInfo->src_map)
+        memcpy(encInfo->stego_map + offset, encInfo->src_map + offset, size);
     return e_success;
 }
 
-/* Copy the remaining image data after encoding */
+/*
+ * Copy the remaining image data after encoding.
+ * The tail is moved inside the kernel with copy_file_range(), falling back to
+ * sendfile() and then to a buffered pread/pwrite loop. The stdio streams are
+ * flushed before the copy and repositioned after it, so the FILE offsets stay
+ * consistent with the descriptors.
+*/
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
 {
-    char ch;
-    while ((fread(&ch, 1, 1, fptr_src)) > 0)
+    struct stat st;
+    int fd_src = fileno(fptr_src);
+    int fd_dest = fileno(fptr_dest);
+
+    if (fflush(fptr_dest) != 0 || fstat(fd_src, &st) != 0)
+        return e_failure;
+
+    off_t off_src = ftello(fptr_src);
+    off_t off_dest = ftello(fptr_dest);
+    if (off_src < 0 || off_dest < 0)
+        return e_failure;
+    off_t len = st.st_size > off_src ? st.st_size - off_src : 0;
+
+    /* First choice: copy_file_range (may even share extents on CoW filesystems) */
+    while (len > 0)
+    {
+        ssize_t done = copy_file_range(fd_src, &off_src, fd_dest, &off_dest, len, 0);
+        if (done <= 0)
+            break;
+        len -= done;
+    }
+
+    /* Second choice: sendfile, which writes at the destination file offset */
+    if (len > 0 && lseek(fd_dest, off_dest, SEEK_SET) == off_dest)
+    {
+        while (len > 0)
+        {
+            ssize_t done = sendfile(fd_dest, fd_src, &off_src, len);
+            if (done <= 0)
+                break;
+            off_dest += done;
+            len -= done;
+        }
+    }
+
+    /* Last resort: plain buffered copy */
+    if (len > 0 && copy_fd_range_buffered(fd_src, &off_src, fd_dest, &off_dest, len) != e_success)
+        return e_failure;
+
+    /* Resynchronise the stdio streams with the descriptor offsets */
+    if (fseeko(fptr_src, off_src, SEEK_SET) != 0 || fseeko(fptr_dest, off_dest, SEEK_SET) != 0)
+        return e_failure;
+    return e_success;
+}
+
+/* Report a stage that completed successfully */
+static Status finish_stage(EncodeInfo *encInfo, Status status)
+{
+    if (status == e_success && encInfo->progress != NULL)
+        encInfo->progress(encInfo->stage, encInfo->progress_arg);
+    return status;
+}
+
+/*
+ * Frame serializer. Everything between the BMP header and the data field
+ * (magic string, frame header, extension size, extension, file size, the
+ * reserved checksum, shard header, chunk index and archive directory) is
+ * laid out as one list of fields, each at its own depth and starting on a
+ * fresh cover byte, and embedded in a single pass. Consecutive fields share
+ * a cover block, so the whole frame normally costs one block read and write.
+*/
+
+/* Fields of the largest frame */
+#define FRAME_MAX_FIELDS 11
+
+/* One field of the frame */
+typedef struct
+{
+    Stage stage;                    // Stage the field is reported under
+    const unsigned char *data;
+    size_t size;
+    int depth;
+    size_t *pos;                    // Receives the cover position of the field (optional)
+} FrameField;
+
+typedef struct
+{
+    FrameField fields[FRAME_MAX_FIELDS];
+    int count;
+    unsigned char scalars[32];      // Backing store of the fixed-size fields
+    size_t used;
+    unsigned char shard[SHARD_HEADER_SIZE]; // Shard header
+    unsigned char *entries;         // Reserved chunk index entries
+    unsigned char *table;           // Reserved archive directory
+} FrameWriter;
+
+/* Append a field */
+static void frame_add(FrameWriter *fw, Stage stage, const void *data, size_t size, int depth, size_t *pos)
+{
+    fw->fields[fw->count++] = (FrameField){ stage, data, size, depth, pos };
+}
+
+/* Append a big-endian field of size bytes holding value */
+static void frame_add_value(FrameWriter *fw, Stage stage, uint64_t value, size_t size, int depth, size_t *pos)
+{
+    unsigned char *bytes = fw->scalars + fw->used;
+
+    for (size_t i = 0; i < size; i++)
+        bytes[i] = value >> (8 * (size - 1 - i));
+    fw->used += size;
+    frame_add(fw, stage, bytes, size, depth, pos);
+}
+
+/*
+ * Lay out the frame fields of encInfo. The checksum, index entries and
+ * directory are reserved with zero checksums and rewritten once the data
+ * has been embedded.
+*/
+static Status frame_build(FrameWriter *fw, EncodeInfo *encInfo)
+{
+    int depth = payload_depth(encInfo);
+    size_t extn_size = strlen(encInfo->extn_secret_file);
+
+    if (extended_frame(encInfo))
     {
-        fwrite(&ch, 1, 1, fptr_dest);
+        frame_add(fw, e_stage_magic, MAGIC_STRING_EXT, strlen(MAGIC_STRING_EXT), 1, NULL);
+        frame_add_value(fw, e_stage_magic, (uint32_t)frame_version(encInfo) << 16 | depth << 8 | frame_flags(encInfo),
+                        FRAME_HEADER_SIZE, 1, NULL);
+    }
+    else
+        frame_add(fw, e_stage_magic, MAGIC_STRING, strlen(MAGIC_STRING), 1, NULL);
+
+    frame_add_value(fw, e_stage_extn_size, extn_size, 4, depth, NULL);
+    frame_add(fw, e_stage_extn, encInfo->extn_secret_file, extn_size, depth, NULL);
+    frame_add_value(fw, e_stage_size, encInfo->size_secret_file, size_field_bytes(encInfo), depth, NULL);
+    if (encInfo->use_checksum)
+    {
+        encInfo->payload_crc = 0;
+        frame_add_value(fw, e_stage_size, 0, 4, depth, &encInfo->checksum_offset);
+    }
+    if (encInfo->shard != NULL)
+    {
+        shard_header_store(encInfo->shard, fw->shard);
+        frame_add(fw, e_stage_size, fw->shard, SHARD_HEADER_SIZE, depth, NULL);
+    }
+
+    if (encInfo->use_index)
+    {
+        uint32_t chunk_size = index_chunk_size(depth);
+
+        encInfo->stage = e_stage_index;
+        if (chunk_index_init(&encInfo->index, encInfo->size_secret_file, chunk_size, index_entry_size(encInfo)) != e_success)
+            return e_failure;
+        size_t size = (size_t)encInfo->index.num_chunks * encInfo->index.entry_size;
+        if ((fw->entries = malloc(size + 1)) == NULL)
+            return e_failure;
+        chunk_index_store(&encInfo->index, fw->entries);
+        frame_add_value(fw, e_stage_index, chunk_size, 4, depth, NULL);
+        frame_add(fw, e_stage_index, fw->entries, size, depth, &encInfo->index_offset);
+    }
+
+    if (encInfo->archive != NULL)
+    {
+        size_t size = archive_dir_size(encInfo->archive);
+
+        encInfo->stage = e_stage_directory;
+        if ((fw->table = malloc(size)) == NULL)
+            return e_failure;
+        archive_dir_store(encInfo->archive, fw->table);
+        frame_add_value(fw, e_stage_directory, size, 4, depth, NULL);
+        frame_add(fw, e_stage_directory, fw->table, size, depth, &encInfo->archive_offset);
     }
     return e_success;
 }
 
-/* Perform the encoding process */
-Status do_encoding(EncodeInfo *encInfo)
+/*
+ * Embed the fields in order. Runs of fields that fit one cover block are
+ * embedded into it with their own kernels; a field larger than a block (a
+ * big index or directory) is embedded block by block on its own. Each stage
+ * is reported once all of its fields are in the stego image.
+*/
+static Status frame_embed(FrameWriter *fw, EncodeInfo *encInfo)
 {
-    printf("Encoding Started...\n");
-    if (open_files(encInfo) == e_success)
+    for (int i = 0, j; i < fw->count; i = j)
     {
-        printf("Opening of File Successful...\n");
-        if (check_capacity(encInfo) == e_success)
+        size_t span = 0;
+
+        for (j = i; j < fw->count; j++)
+        {
+            size_t field_span = lsb_cover_size(fw->fields[j].size, fw->fields[j].depth);
+            if (field_span > MAX_IMAGE_BUF_SIZE - span)
+                break;
+            span += field_span;
+        }
+
+        encInfo->stage = fw->fields[i].stage;
+        if (j == i)
         {
-            printf("Capacity Check Successful...\n");
-            if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+            FrameField *field = &fw->fields[j++];
+            if (field->pos != NULL)
+                *field->pos = encInfo->cover_pos;
+            if (encode_run_at_depth((const char *)field->data, field->size, field->depth, encInfo) != e_success)
+                return e_failure;
+        }
+        else
+        {
+            unsigned char *image_in, *image_out;
+            size_t at = 0;
+
+            if (cover_block_begin(encInfo, span, &image_in, &image_out) != e_success)
+                return e_failure;
+            for (int k = i; k < j; k++)
             {
-                printf("Header Copy Successful...\n");
-                if (encode_magic_string(MAGIC_STRING, encInfo) == e_success)
-                {
-                    printf("Encoding of Magic String is Successful...\n");
-                    strcpy(encInfo->extn_secret_file, strstr(encInfo->secret_fname, "."));
-                    if (encode_secret_file_extn_size(strlen(encInfo->extn_secret_file), encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
-                    {
-                        printf("Encoding of Secret File Extension Size is Successful...\n");
-                        if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_success)
-                        {
-                            printf("Encoding of Secret File Size is Successful...\n");
-                            if (encode_secret_file_size(encInfo->size_secret_file, encInfo) == e_success)
-                            {
-                                printf("Encoding of Secret File Size Successful...\n");
-                                if (encode_secret_file_data(encInfo) == e_success)
-                                {
-                                    printf("Encoding of Secret File Data Successful...\n");
-                                    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
-                                    {
-                                        printf("Remaining Image Data Copy Successful...\n");
-                                    }
-                                    else
-                                    {
-                                        printf("Copying Remaining Image Data Failed...\n");
-                                        return e_failure;
-                                    }
-                                }
-                                else
-                                {
-                                    printf("Encoding of Secret File Data Failed...\n");
-                                    return e_failure;
-                                }
-                            }
-                            else
-                            {
-                                printf("Encoding of Secret File Size Failed...\n");
-                                return e_failure;
-                            }
-                        }
-                        else
-                        {
-                            printf("Encoding of Secret File Extension Failed...\n");
-                            return e_failure;
-                        }
-                    }
-                    else
-                    {
-                        printf("Encoding of Secret File Extension Size Failed...\n");
-                        return e_failure;
-                    }
-                }
-                else
-                {
-                    printf("Encoding of Magic String Failed...\n");
-                    return e_failure;
-                }
+                FrameField *field = &fw->fields[k];
+                if (field->pos != NULL)
+                    *field->pos = encInfo->cover_pos + at;
+                lsb_embed_for_depth(field->depth)(image_out + at, image_in + at, field->data, field->size);
+                at += lsb_cover_size(field->size, field->depth);
             }
-            else
-            {
-                printf("Header Copy Failed...\n");
+            if (cover_block_end(encInfo, span) != e_success)
                 return e_failure;
+        }
+
+        for (int k = i; k < j; k++)
+        {
+            if (k + 1 == fw->count || fw->fields[k + 1].stage != fw->fields[k].stage)
+            {
+                encInfo->stage = fw->fields[k].stage;
+                finish_stage(encInfo, e_success);
             }
         }
-        else
+    }
+    return e_success;
+}
+
+/* Serialize and embed the frame fields in one pass */
+static Status encode_frame_fields(EncodeInfo *encInfo)
+{
+    FrameWriter fw = { .count = 0 };
+    Status status = frame_build(&fw, encInfo);
+
+    if (status == e_success)
+        status = frame_embed(&fw, encInfo);
+    free(fw.entries);
+    free(fw.table);
+    return status;
+}
+
+/*
+ * Embed the archive members one after another, each opened only while it is
+ * embedded. A run of bytes that is not a whole number of groups is padded
+ * in the image, so the last bytes of a member that ends inside a group are
+ * embedded together with the zero padding that aligns the next member, as
+ * one whole group. The data field then lies in the image exactly like one
+ * continuous run, and every member sits where the decoder seeks for it.
+*/
+static Status encode_archive_members(EncodeInfo *encInfo)
+{
+    ArchiveDir *archive = encInfo->archive;
+    long data_size = encInfo->size_secret_file;
+    long group = lsb_group_size(payload_depth(encInfo));
+    Status status = e_success;
+
+    for (int i = 0; i < archive->count && status == e_success; i++)
+    {
+        ArchiveEntry *entry = &archive->entries[i];
+        long end = (long)entry->offset + entry->size;
+        long next = i + 1 < archive->count ? (long)archive->entries[i + 1].offset : end;
+        long head = entry->size - entry->size % group;
+
+        encInfo->fptr_secret = fopen(entry->path, "r");
+        if (encInfo->fptr_secret == NULL)
         {
-            printf("Capacity Check Failed...\n");
-            return e_failure;
+            status = e_failure;
+            break;
         }
+        encInfo->size_secret_file = head;
+        encInfo->secret_base = entry->offset;
+        encInfo->secret_crc = &entry->crc;
+        entry->crc = 0;
+        status = encode_secret_file_data(encInfo);
+
+        /* The member's partial group followed by the padding */
+        if (status == e_success && next > (long)entry->offset + head)
+        {
+            unsigned char last[8] = { 0 };
+            long tail = entry->size - head;
+
+            status = pread_full(fileno(encInfo->fptr_secret), last, tail, head);
+            if (status == e_success)
+            {
+                note_secret_bytes(encInfo, head, last, tail, &encInfo->payload_crc);
+                encInfo->secret_crc = NULL;
+                note_secret_bytes(encInfo, entry->size, last + tail, next - end, &encInfo->payload_crc);
+                status = encode_data_to_image((char *)last, next - entry->offset - head, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+            }
+        }
+
+        fclose(encInfo->fptr_secret);
+        encInfo->fptr_secret = NULL;
     }
+
+    encInfo->size_secret_file = data_size;
+    encInfo->secret_base = 0;
+    encInfo->secret_crc = NULL;
+    return status;
+}
+
+/* Encode the secret file data (or archive members), then the final index, directory and checksum */
+static Status encode_payload(EncodeInfo *encInfo)
+{
+    Status status;
+
+    if (encInfo->compress)
+        status = encode_secret_file_data_compressed(encInfo);
+    else if (encInfo->archive != NULL)
+        status = encode_archive_members(encInfo);
     else
-    {
-        printf("Opening of File Failed...\n");
+        status = encode_secret_file_data(encInfo);
+
+    if (status == e_success && encInfo->use_index)
+        status = encode_chunk_index_patch(encInfo);
+    if (status == e_success && encInfo->archive != NULL)
+        status = encode_archive_directory_patch(encInfo);
+    if (status == e_success && encInfo->use_checksum)
+        status = encode_payload_checksum_patch(encInfo);
+    return status;
+}
+
+/* Run the stages of encode_frame() */
+static Status encode_frame_stages(EncodeInfo *encInfo)
+{
+    encInfo->stage = e_stage_capacity;
+    if (finish_stage(encInfo, check_capacity(encInfo)) != e_success)
         return e_failure;
-    }
-    return e_success;
+
+    encInfo->stage = e_stage_header;
+    if (finish_stage(encInfo, encInfo->src_map != NULL ? copy_bmp_header_mapped(encInfo)
+                                                       : copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image)) != e_success)
+        return e_failure;
+
+    /* Magic string through archive directory; reports each of their stages */
+    if (encode_frame_fields(encInfo) != e_success)
+        return e_failure;
+
+    encInfo->stage = e_stage_data;
+    if (finish_stage(encInfo, encode_payload(encInfo)) != e_success)
+        return e_failure;
+
+    /* A reflink clone already holds the untouched tail */
+    encInfo->stage = e_stage_tail;
+    if (encInfo->tail_cloned)
+        return finish_stage(encInfo, e_success);
+    return finish_stage(encInfo, encInfo->src_map != NULL ? copy_remaining_img_data_mapped(encInfo)
+                                                          : copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image));
+}
+
+/*
+ * Run every stage after opening, in order: capacity check, header copy,
+ * the frame fields (magic string, extension size, extension, file size and
+ * checksum, chunk index and archive directory if requested) in one pass,
+ * file data and the remaining image data. On failure encInfo->stage names
+ * the failed stage.
+*/
+Status encode_frame(EncodeInfo *encInfo)
+{
+    Status status = encode_frame_stages(encInfo);
+    chunk_index_free(&encInfo->index);
+    return status;
+}
+
+/* Perform the encoding process and release every file it opened */
+Status do_encoding(EncodeInfo *encInfo)
+{
+    Status status;
+
+    encInfo->stage = e_stage_open;
+    status = finish_stage(encInfo, open_files(encInfo));
+    if (status == e_success)
+        status = encode_frame(encInfo);
+
+    if (close_files(encInfo) != e_success)
+        status = e_failure;
+    return status;
+}
+
+/* Free the buffers kept in encInfo across encodings */
+void release_encode_info(EncodeInfo *encInfo)
+{
+    free(encInfo->image_data);
+    free(encInfo->secret_data);
+    free(encInfo->raw_data);
+    encInfo->image_data = encInfo->secret_data = NULL;
+    encInfo->raw_data = NULL;
 }
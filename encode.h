@@ -13,7 +13,15 @@
 #ifndef ENCODE_H
 #define ENCODE_H
 
+#include <stdio.h>
+#include <sys/types.h>
 #include "types.h" // Contains user defined types
+#include "common.h" // Contains shared constants
+#include "chunkidx.h" // Chunk index of indexed payloads
+#include "archive.h" // Archive member directory
+#include "bmp.h" // Pixel layout of the cover
+#include "covercache.h" // Parsed and mapped covers kept across encodings
+#include "shard.h" // Shard header of a sharded payload
 
 /* 
  * Structure to store information required for
@@ -22,29 +30,67 @@
  * also stored
 */
 
-#define MAX_SECRET_BUF_SIZE 1
-#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
-#define MAX_FILE_SUFFIX 4
-
 typedef struct _EncodeInfo
 {
     /* Source Image info */
     char *src_image_fname;          // Source image file name
     FILE *fptr_src_image;           // File pointer for source image
-    uint image_capacity;            // Capacity of the image to store secret data
-    uint bits_per_pixel;            // Bits per pixel (for BMP images, it is 24)
-    char image_data[MAX_IMAGE_BUF_SIZE]; // Buffer to store image data
+    size_t image_capacity;          // Cover bytes of the image (colour bytes of the pixel array)
+    uint image_width;               // Width read from the BMP header
+    uint image_height;              // Height read from the BMP header
+    uint bits_per_pixel;            // Bits per pixel (24 or 32)
+    BmpLayout layout;               // Pixel layout of the cover, parsed by check_capacity()
+    size_t cover_pos;               // Cover bytes embedded into so far
+    char *image_data;               // Image block buffer (MAX_IMAGE_BUF_SIZE), allocated on first use
+    unsigned char *raw_data;        // File bytes of a block of a non-contiguous cover, allocated on first use
 
     /* Secret File Info */
     char *secret_fname;             // Secret file name to encode
     FILE *fptr_secret;              // File pointer for secret file
-    char extn_secret_file[MAX_FILE_SUFFIX]; // Extension of the secret file
-    char secret_data[MAX_SECRET_BUF_SIZE];  // Buffer to store secret file data
+    char extn_secret_file[MAX_FILE_SUFFIX + 1]; // Extension of the secret file
+    char *secret_data;              // Secret chunk buffer (MAX_SECRET_BUF_SIZE), allocated on first use
+    const unsigned char *secret_mem; // In-memory secret used instead of fptr_secret (optional)
     long size_secret_file;          // Size of the secret file
+    int depth;                      // Bits per image byte for the payload (1-4, 0 means 1); > 1 writes the extended frame
+    int use_index;                  // Write a chunk index (extended frame) for random-access decoding
+    int compress;                   // Embed the secret as compressed blocks (extended frame)
+    int use_checksum;               // Store a CRC32C of the whole payload (extended frame)
+    uint32_t payload_crc;           // CRC32C of the payload embedded so far
+    size_t checksum_offset;         // Cover position of the reserved payload checksum
+    ChunkIndex index;               // Index being built while the data is embedded
+    size_t index_offset;            // Cover position of the reserved index entries
+
+    /* Archive mode (optional) */
+    ArchiveDir *archive;            // Members packed instead of a single secret file
+    size_t archive_offset;          // Cover position of the reserved directory
+    long secret_base;               // Offset of the secret being embedded within the data field
+    uint32_t *secret_crc;           // CRC32C extended with the secret's bytes (optional)
+
+    /* Sharding (optional) */
+    const ShardInfo *shard;         // Embed only this shard of the secret (see shard.h)
 
     /* Stego Image Info */
     char *stego_image_fname;        // Stego image file name (output image)
     FILE *fptr_stego_image;         // File pointer for stego image
+    int tail_cloned;                // Stego image is a reflink clone of the cover
+
+    /* Memory-mapped backend (optional) */
+    int use_mmap;                   // Map the images instead of using stdio
+    unsigned char *src_map;         // Read-only mapping of the source image
+    unsigned char *stego_map;       // Read-write mapping of the stego image
+    size_t map_size;                // Size of both mappings
+
+    /* Cover cache (optional) */
+    CoverCache *cover_cache;        // Look the cover up here instead of reading it (see covercache.h)
+    CoverEntry *cover;              // Cached cover src_map belongs to, held until close_files()
+
+    int num_threads;                // Strip workers for the secret data (<= 1: sequential)
+    int use_aio;                    // Pipeline the stdio secret data stage (see aio.h)
+
+    /* Progress reporting */
+    Stage stage;                    // Stage being run (the failed one if encoding fails)
+    StageCallback progress;         // Called after each successful stage (optional)
+    void *progress_arg;             // Passed to progress
 
 } EncodeInfo;
 
@@ -60,26 +106,38 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo);
 /* Perform the encoding */
 Status do_encoding(EncodeInfo *encInfo);
 
+/* Run every stage after opening: capacity check through remaining data copy */
+Status encode_frame(EncodeInfo *encInfo);
+
+/* Free the buffers kept in encInfo across encodings */
+void release_encode_info(EncodeInfo *encInfo);
+
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Release mappings and close the files opened by open_files() */
+Status close_files(EncodeInfo *encInfo);
+
 /* Check capacity of source image to store secret data */
 Status check_capacity(EncodeInfo *encInfo);
 
-/* Get image size for BMP image */
-uint get_image_size_for_bmp(FILE *fptr_image);
+/* Most secret bytes a cover of capacity cover bytes holds with encInfo's options (-1: not even an empty one) */
+long encode_max_secret_size(const EncodeInfo *encInfo, size_t capacity);
+
+/* Get the cover bytes of a BMP image (0 if its layout is not supported) */
+size_t get_image_size_for_bmp(FILE *fptr_image);
 
-/* Get file size */
-uint get_file_size(FILE *fptr);
+/* Get file size (-1 on failure) */
+off_t get_file_size(FILE *fptr);
 
-/* Copy bmp image header from source to stego image */
+/* Copy everything before the pixel array from source to stego image */
 Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
 
 /* Store Magic String (for identifying stego image) */
 Status encode_magic_string(char *magic_string, EncodeInfo *encInfo);
 
 /* Encode secret file extension size into the image */
-Status encode_secret_file_extn_size(int file_extn_size, FILE *fptr_src_image, FILE *fptr_stego_image);
+Status encode_secret_file_extn_size(int file_extn_size, EncodeInfo *encInfo);
 
 /* Encode secret file extension into the image */
 Status encode_secret_file_extn(char *file_extn, EncodeInfo *encInfo);
@@ -91,13 +149,13 @@ Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
 Status encode_secret_file_data(EncodeInfo *encInfo);
 
 /* Encode function, which does the real encoding of data into image */
-Status encode_data_to_image(char *data, int size, FILE *fptr_src_image, FILE *fptr_stego_image, EncodeInfo *encInfo);
+Status encode_data_to_image(char *data, long size, FILE *fptr_src_image, FILE *fptr_stego_image, EncodeInfo *encInfo);
 
 /* Encode a byte into the Least Significant Bit (LSB) of image data */
 Status encode_byte_to_lsb(char data, char *image_buffer);
 
-/* Encode a size into LSB of image data array */
-Status encode_size_to_lsb(int size, char *image_buffer);
+/* Encode a 32-bit size field into LSB of image data array */
+Status encode_size_to_lsb(uint32_t size, char *image_buffer);
 
 /* Copy remaining image bytes from source to stego image after encoding */
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
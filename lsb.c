@@ -0,0 +1,461 @@
+/*
+ * Bulk LSB Kernels
+ *
+ * Description:
+ * Whole-buffer implementations of the one-bit-per-byte LSB encoding used by
+ * encode_byte_to_lsb() and decode_byte_from_lsb(). Secret bytes are stored
+ * most significant bit first, so image byte 8*i + j carries bit (7 - j) of
+ * secret byte i.
+ *
+ * Kernels:
+ * - scalar: portable C, one secret byte per iteration.
+ * - sse2:   broadcast-and-blend embed, movemask gather on extract (2 bytes/iter).
+ * - bmi2:   pdep/pext on 64-bit words (1 byte/iter, no tables).
+ * - avx2:   same as sse2 with in-lane shuffles (4 bytes/iter).
+ * The best kernel is picked once from cpuid by a startup constructor and can
+ * be overridden with the LSB_KERNEL environment variable.
+ *
+ * Depths 2 to 4 pack k bits into each image byte. A group of k secret bytes
+ * then fills exactly 8 image bytes, which the bmi2 kernels handle as one
+ * pdep/pext on a 64-bit word; the portable kernels unroll the same group
+ * with constant shifts and masks. Both are written once as always-inline
+ * templates and instantiated per depth.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lsb.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LSB_X86 1
+#include <immintrin.h>
+#endif
+
+/* Bit-reversal table for the movemask based extract */
+static unsigned char reverse_bits[256];
+
+/* Embed secret bytes one at a time */
+static void embed_scalar(unsigned char *image_out, const unsigned char *image_in,
+                         const unsigned char *data, size_t nbytes)
+{
+    for (size_t i = 0; i < nbytes; i++)
+    {
+        unsigned char ch = data[i];
+        const unsigned char *in = image_in + i * 8;
+        unsigned char *out = image_out + i * 8;
+        for (int j = 0; j < 8; j++)
+        {
+            out[j] = (in[j] & 0xFE) | ((ch >> (7 - j)) & 0x01);
+        }
+    }
+}
+
+/* Extract secret bytes one at a time */
+static void extract_scalar(unsigned char *data, const unsigned char *image_in, size_t nbytes)
+{
+    for (size_t i = 0; i < nbytes; i++)
+    {
+        const unsigned char *in = image_in + i * 8;
+        unsigned char ch = 0;
+        for (int j = 0; j < 8; j++)
+        {
+            ch = (ch << 1) | (in[j] & 0x01);
+        }
+        data[i] = ch;
+    }
+}
+
+#ifdef LSB_X86
+
+/* Embed two secret bytes per 16 image bytes */
+__attribute__((target("sse2")))
+static void embed_sse2(unsigned char *image_out, const unsigned char *image_in,
+                       const unsigned char *data, size_t nbytes)
+{
+    const __m128i bit_select = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                             (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m128i one = _mm_set1_epi8(0x01);
+    const __m128i keep = _mm_set1_epi8((char)0xFE);
+    size_t i = 0;
+
+    for (; i + 2 <= nbytes; i += 2)
+    {
+        /* Broadcast data[i] to bytes 0-7 and data[i + 1] to bytes 8-15 */
+        __m128i d = _mm_cvtsi32_si128(data[i] | (data[i + 1] << 8));
+        d = _mm_unpacklo_epi8(d, d);
+        d = _mm_unpacklo_epi16(d, d);
+        d = _mm_unpacklo_epi32(d, d);
+
+        __m128i bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(d, bit_select), bit_select), one);
+        __m128i px = _mm_loadu_si128((const __m128i *)(image_in + i * 8));
+        px = _mm_or_si128(_mm_and_si128(px, keep), bits);
+        _mm_storeu_si128((__m128i *)(image_out + i * 8), px);
+    }
+    embed_scalar(image_out + i * 8, image_in + i * 8, data + i, nbytes - i);
+}
+
+/* Extract two secret bytes per 16 image bytes */
+__attribute__((target("sse2")))
+static void extract_sse2(unsigned char *data, const unsigned char *image_in, size_t nbytes)
+{
+    size_t i = 0;
+
+    for (; i + 2 <= nbytes; i += 2)
+    {
+        __m128i px = _mm_loadu_si128((const __m128i *)(image_in + i * 8));
+        int mask = _mm_movemask_epi8(_mm_slli_epi16(px, 7));
+        data[i] = reverse_bits[mask & 0xFF];
+        data[i + 1] = reverse_bits[(mask >> 8) & 0xFF];
+    }
+    extract_scalar(data + i, image_in + i * 8, nbytes - i);
+}
+
+/* Embed one secret byte per 64-bit word with pdep */
+__attribute__((target("bmi2")))
+static void embed_bmi2(unsigned char *image_out, const unsigned char *image_in,
+                       const unsigned char *data, size_t nbytes)
+{
+    const uint64_t lsb_mask = 0x0101010101010101ULL;
+
+    for (size_t i = 0; i < nbytes; i++)
+    {
+        uint64_t px;
+        memcpy(&px, image_in + i * 8, 8);
+        uint64_t bits = __builtin_bswap64(_pdep_u64(data[i], lsb_mask));
+        px = (px & ~lsb_mask) | bits;
+        memcpy(image_out + i * 8, &px, 8);
+    }
+}
+
+/* Extract one secret byte per 64-bit word with pext */
+__attribute__((target("bmi2")))
+static void extract_bmi2(unsigned char *data, const unsigned char *image_in, size_t nbytes)
+{
+    const uint64_t lsb_mask = 0x0101010101010101ULL;
+
+    for (size_t i = 0; i < nbytes; i++)
+    {
+        uint64_t px;
+        memcpy(&px, image_in + i * 8, 8);
+        data[i] = (unsigned char)_pext_u64(__builtin_bswap64(px), lsb_mask);
+    }
+}
+
+/* Embed four secret bytes per 32 image bytes */
+__attribute__((target("avx2")))
+static void embed_avx2(unsigned char *image_out, const unsigned char *image_in,
+                       const unsigned char *data, size_t nbytes)
+{
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bit_select = _mm256_set1_epi64x(0x0102040810204080LL);
+    const __m256i one = _mm256_set1_epi8(0x01);
+    const __m256i keep = _mm256_set1_epi8((char)0xFE);
+    size_t i = 0;
+
+    for (; i + 4 <= nbytes; i += 4)
+    {
+        uint32_t word;
+        memcpy(&word, data + i, 4);
+        __m256i d = _mm256_shuffle_epi8(_mm256_set1_epi32((int)word), spread);
+
+        __m256i bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(d, bit_select), bit_select), one);
+        __m256i px = _mm256_loadu_si256((const __m256i *)(image_in + i * 8));
+        px = _mm256_or_si256(_mm256_and_si256(px, keep), bits);
+        _mm256_storeu_si256((__m256i *)(image_out + i * 8), px);
+    }
+    embed_scalar(image_out + i * 8, image_in + i * 8, data + i, nbytes - i);
+}
+
+/* Extract four secret bytes per 32 image bytes */
+__attribute__((target("avx2")))
+static void extract_avx2(unsigned char *data, const unsigned char *image_in, size_t nbytes)
+{
+    /* Reverse each group of 8 bytes so movemask yields MSB-first bytes */
+    const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                             7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t i = 0;
+
+    for (; i + 4 <= nbytes; i += 4)
+    {
+        __m256i px = _mm256_loadu_si256((const __m256i *)(image_in + i * 8));
+        px = _mm256_shuffle_epi8(px, reverse);
+        uint32_t word = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(px, 7));
+        memcpy(data + i, &word, 4);
+    }
+    extract_scalar(data + i, image_in + i * 8, nbytes - i);
+}
+
+#endif /* LSB_X86 */
+
+/* Mask of the low k bits in each of the 8 bytes of a word */
+#define DEPTH_MASK64(k) (0x0101010101010101ULL * ((1u << (k)) - 1))
+
+/*
+ * Embed at depth k, one group of k secret bytes per 8 image bytes.
+ * A final partial group is padded with zero bits and only the image bytes it
+ * reaches are written.
+*/
+static inline __attribute__((always_inline))
+void embed_depth_scalar(unsigned char *image_out, const unsigned char *image_in,
+                        const unsigned char *data, size_t nbytes, const int k)
+{
+    const unsigned char mask = (1u << k) - 1;
+
+    for (size_t i = 0; i < nbytes; i += k)
+    {
+        size_t rem = nbytes - i < (size_t)k ? nbytes - i : (size_t)k;
+        size_t used = (rem * 8 + k - 1) / k;
+        uint64_t word = 0;
+        for (int b = 0; b < k; b++)
+        {
+            word = (word << 8) | ((size_t)b < rem ? data[i + b] : 0);
+        }
+
+        const unsigned char *in = image_in + i / k * 8;
+        unsigned char *out = image_out + i / k * 8;
+        for (size_t j = 0; j < used; j++)
+        {
+            out[j] = (in[j] & ~mask) | ((word >> (8 * k - k * (j + 1))) & mask);
+        }
+    }
+}
+
+/* Extract at depth k, one group of k secret bytes per 8 image bytes */
+static inline __attribute__((always_inline))
+void extract_depth_scalar(unsigned char *data, const unsigned char *image_in, size_t nbytes, const int k)
+{
+    const unsigned char mask = (1u << k) - 1;
+
+    for (size_t i = 0; i < nbytes; i += k)
+    {
+        size_t rem = nbytes - i < (size_t)k ? nbytes - i : (size_t)k;
+        size_t used = (rem * 8 + k - 1) / k;
+        const unsigned char *in = image_in + i / k * 8;
+        uint64_t word = 0;
+        for (size_t j = 0; j < 8; j++)
+        {
+            word = (word << k) | (j < used ? (in[j] & mask) : 0);
+        }
+        for (size_t b = 0; b < rem; b++)
+        {
+            data[i + b] = (unsigned char)(word >> (8 * (k - 1 - b)));
+        }
+    }
+}
+
+#ifdef LSB_X86
+
+/* Embed at depth k with one pdep per group of k secret bytes */
+static inline __attribute__((always_inline, target("bmi2")))
+void embed_depth_bmi2(unsigned char *image_out, const unsigned char *image_in,
+                      const unsigned char *data, size_t nbytes, const int k)
+{
+    const uint64_t mask = DEPTH_MASK64(k);
+    size_t i = 0;
+
+    for (; i + k <= nbytes; i += k)
+    {
+        uint64_t word = 0, px;
+        for (int b = 0; b < k; b++)
+        {
+            word = (word << 8) | data[i + b];
+        }
+        memcpy(&px, image_in + i / k * 8, 8);
+        px = (px & ~mask) | __builtin_bswap64(_pdep_u64(word, mask));
+        memcpy(image_out + i / k * 8, &px, 8);
+    }
+    embed_depth_scalar(image_out + i / k * 8, image_in + i / k * 8, data + i, nbytes - i, k);
+}
+
+/* Extract at depth k with one pext per group of k secret bytes */
+static inline __attribute__((always_inline, target("bmi2")))
+void extract_depth_bmi2(unsigned char *data, const unsigned char *image_in, size_t nbytes, const int k)
+{
+    const uint64_t mask = DEPTH_MASK64(k);
+    size_t i = 0;
+
+    for (; i + k <= nbytes; i += k)
+    {
+        uint64_t px;
+        memcpy(&px, image_in + i / k * 8, 8);
+        uint64_t word = _pext_u64(__builtin_bswap64(px), mask);
+        for (int b = 0; b < k; b++)
+        {
+            data[i + b] = (unsigned char)(word >> (8 * (k - 1 - b)));
+        }
+    }
+    extract_depth_scalar(data + i, image_in + i / k * 8, nbytes - i, k);
+}
+
+#endif /* LSB_X86 */
+
+/* Instantiate the depth templates for depth k */
+#define DEPTH_KERNELS(k)                                                                        \
+static void embed_scalar_d##k(unsigned char *image_out, const unsigned char *image_in,         \
+                              const unsigned char *data, size_t nbytes)                        \
+{                                                                                               \
+    embed_depth_scalar(image_out, image_in, data, nbytes, k);                                  \
+}                                                                                               \
+static void extract_scalar_d##k(unsigned char *data, const unsigned char *image_in, size_t nbytes) \
+{                                                                                               \
+    extract_depth_scalar(data, image_in, nbytes, k);                                           \
+}                                                                                               \
+DEPTH_KERNELS_BMI2(k)
+
+#ifdef LSB_X86
+#define DEPTH_KERNELS_BMI2(k)                                                                   \
+__attribute__((target("bmi2")))                                                                 \
+static void embed_bmi2_d##k(unsigned char *image_out, const unsigned char *image_in,           \
+                            const unsigned char *data, size_t nbytes)                          \
+{                                                                                               \
+    embed_depth_bmi2(image_out, image_in, data, nbytes, k);                                    \
+}                                                                                               \
+__attribute__((target("bmi2")))                                                                 \
+static void extract_bmi2_d##k(unsigned char *data, const unsigned char *image_in, size_t nbytes) \
+{                                                                                               \
+    extract_depth_bmi2(data, image_in, nbytes, k);                                             \
+}
+#else
+#define DEPTH_KERNELS_BMI2(k)
+#endif
+
+DEPTH_KERNELS(2)
+DEPTH_KERNELS(3)
+DEPTH_KERNELS(4)
+
+/* Depth kernels indexed by depth; entry 1 is filled from the active 1-bit kernel */
+static lsb_embed_fn embed_by_depth[LSB_MAX_DEPTH + 1] =
+    { NULL, NULL, embed_scalar_d2, embed_scalar_d3, embed_scalar_d4 };
+static lsb_extract_fn extract_by_depth[LSB_MAX_DEPTH + 1] =
+    { NULL, NULL, extract_scalar_d2, extract_scalar_d3, extract_scalar_d4 };
+
+/* Table of available kernels, best first */
+typedef struct
+{
+    const char *name;
+    lsb_embed_fn embed;
+    lsb_extract_fn extract;
+} LsbKernel;
+
+static const LsbKernel kernels[] =
+{
+#ifdef LSB_X86
+    { "avx2", embed_avx2, extract_avx2 },
+    { "bmi2", embed_bmi2, extract_bmi2 },
+    { "sse2", embed_sse2, extract_sse2 },
+#endif
+    { "scalar", embed_scalar, extract_scalar },
+};
+
+lsb_embed_fn lsb_embed = embed_scalar;
+lsb_extract_fn lsb_extract = extract_scalar;
+static const char *active_kernel = "scalar";
+
+/* Check whether the CPU can run a kernel */
+static int kernel_supported(const char *name)
+{
+#ifdef LSB_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(name, "bmi2") == 0)
+        return __builtin_cpu_supports("bmi2");
+    if (strcmp(name, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return strcmp(name, "scalar") == 0;
+}
+
+/* Use the bmi2 or the portable kernels for depths 2 to 4 */
+static void select_depth_kernels(int use_bmi2)
+{
+#ifdef LSB_X86
+    if (use_bmi2)
+    {
+        embed_by_depth[2] = embed_bmi2_d2;
+        embed_by_depth[3] = embed_bmi2_d3;
+        embed_by_depth[4] = embed_bmi2_d4;
+        extract_by_depth[2] = extract_bmi2_d2;
+        extract_by_depth[3] = extract_bmi2_d3;
+        extract_by_depth[4] = extract_bmi2_d4;
+        return;
+    }
+#endif
+    (void)use_bmi2;
+    embed_by_depth[2] = embed_scalar_d2;
+    embed_by_depth[3] = embed_scalar_d3;
+    embed_by_depth[4] = embed_scalar_d4;
+    extract_by_depth[2] = extract_scalar_d2;
+    extract_by_depth[3] = extract_scalar_d3;
+    extract_by_depth[4] = extract_scalar_d4;
+}
+
+/* Force a kernel by name */
+int lsb_select_kernel(const char *name)
+{
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+    {
+        if (strcmp(kernels[i].name, name) == 0 && kernel_supported(name))
+        {
+            lsb_embed = kernels[i].embed;
+            lsb_extract = kernels[i].extract;
+            active_kernel = kernels[i].name;
+            /* Only the bmi2 and avx2 kernels bring the pdep/pext depth kernels with them */
+            select_depth_kernels((strcmp(name, "bmi2") == 0 || strcmp(name, "avx2") == 0) &&
+                                 kernel_supported("bmi2"));
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Select the best kernels for this CPU */
+void lsb_init(void)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        unsigned char r = 0;
+        for (int j = 0; j < 8; j++)
+        {
+            r |= ((i >> j) & 0x01) << (7 - j);
+        }
+        reverse_bits[i] = r;
+    }
+
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+    {
+        if (lsb_select_kernel(kernels[i].name) == 0)
+            break;
+    }
+
+    const char *env = getenv("LSB_KERNEL");
+    if (env != NULL)
+        lsb_select_kernel(env);
+}
+
+/* Embed kernel for a depth */
+lsb_embed_fn lsb_embed_for_depth(int depth)
+{
+    return depth <= 1 ? lsb_embed : embed_by_depth[depth];
+}
+
+/* Extract kernel for a depth */
+lsb_extract_fn lsb_extract_for_depth(int depth)
+{
+    return depth <= 1 ? lsb_extract : extract_by_depth[depth];
+}
+
+/* Name of the active kernel */
+const char *lsb_kernel_name(void)
+{
+    return active_kernel;
+}
+
+/* Run the CPU dispatch once before main() */
+__attribute__((constructor))
+static void lsb_startup(void)
+{
+    lsb_init();
+}
@@ -0,0 +1,78 @@
+/*
+ * Header file for the bulk LSB kernels
+ *
+ * Description:
+ * These kernels embed and extract whole runs of secret bytes in one call,
+ * one secret bit per image byte, most significant bit first. Several
+ * implementations exist (portable scalar, SSE2, BMI2 and AVX2); the fastest
+ * one supported by the CPU is selected once at program startup.
+ *
+ * Deeper embeddings store k = 2, 3 or 4 bits in the low bits of each image
+ * byte, again most significant first, so a secret byte needs 8 / k image
+ * bytes. Every depth has its own kernel, specialized at compile time.
+*/
+
+#ifndef LSB_H
+#define LSB_H
+
+#include <stddef.h>
+
+/* Deepest supported embedding, in bits per image byte */
+#define LSB_MAX_DEPTH 4
+
+/*
+ * Embed nbytes secret bytes from data into 8 * nbytes image bytes.
+ * Image bytes are read from image_in and written to image_out, which may
+ * point to the same buffer.
+*/
+typedef void (*lsb_embed_fn)(unsigned char *image_out, const unsigned char *image_in,
+                             const unsigned char *data, size_t nbytes);
+
+/* Extract nbytes secret bytes from 8 * nbytes image bytes */
+typedef void (*lsb_extract_fn)(unsigned char *data, const unsigned char *image_in, size_t nbytes);
+
+/* Kernels selected from cpuid at startup */
+extern lsb_embed_fn lsb_embed;
+extern lsb_extract_fn lsb_extract;
+
+/* Select the best kernels for this CPU (runs automatically at startup) */
+void lsb_init(void);
+
+/*
+ * Force a kernel by name ("scalar", "sse2", "bmi2" or "avx2").
+ * Depths 2 to 4 use the bmi2 kernels only under "bmi2" or "avx2".
+ * Returns 0 on success, -1 if unknown or not supported by this CPU.
+ * The LSB_KERNEL environment variable does the same at startup.
+*/
+int lsb_select_kernel(const char *name);
+
+/* Kernels for depth bits per image byte (1 to LSB_MAX_DEPTH) */
+lsb_embed_fn lsb_embed_for_depth(int depth);
+lsb_extract_fn lsb_extract_for_depth(int depth);
+
+/*
+ * Image bytes holding nbytes secret bytes at the given depth.
+ * A run that does not fill its last image byte leaves the low bits of that
+ * byte padded with zeros.
+*/
+static inline size_t lsb_cover_size(size_t nbytes, int depth)
+{
+    return (nbytes * 8 + depth - 1) / depth;
+}
+
+/* Smallest run of secret bytes filling a whole number of image bytes (3 at depth 3, else 1) */
+static inline size_t lsb_group_size(int depth)
+{
+    return depth % 3 == 0 ? 3 : 1;
+}
+
+/* Longest run of at most max bytes that can be followed by another run without padding */
+static inline size_t lsb_align_run(size_t max, int depth)
+{
+    return max - max % lsb_group_size(depth);
+}
+
+/* Name of the active kernel */
+const char *lsb_kernel_name(void);
+
+#endif
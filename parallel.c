@@ -0,0 +1,116 @@
+/*
+ * Strip-Parallel Helpers
+ *
+ * Description:
+ * run_strips() hands contiguous payload strips to worker threads. The
+ * calling thread processes the first strip itself, so one thread means no
+ * thread is created at all. Workers share nothing but read-only context and
+ * report their own status, so no locks are needed.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "parallel.h"
+
+typedef struct
+{
+    pthread_t thread;
+    strip_fn fn;
+    void *ctx;
+    long begin;
+    long end;
+    int joinable;
+    Status status;
+} Strip;
+
+/* Thread entry point for one strip */
+static void *strip_main(void *arg)
+{
+    Strip *strip = arg;
+    strip->status = strip->fn(strip->ctx, strip->begin, strip->end);
+    return NULL;
+}
+
+/* Run fn over [0, total) split into aligned strips */
+Status run_strips(int num_threads, long total, long align, strip_fn fn, void *ctx)
+{
+    long max_strips = total / MIN_STRIP_SIZE;
+    int count = num_threads;
+
+    if (count > max_strips)
+        count = max_strips;
+    if (count > 64)
+        count = 64;
+    if (count <= 1 || align <= 0)
+        return fn(ctx, 0, total);
+
+    Strip strips[64];
+    long step = (total / count + align - 1) / align * align;
+
+    for (int i = 0; i < count; i++)
+    {
+        strips[i].fn = fn;
+        strips[i].ctx = ctx;
+        strips[i].begin = i * step < total ? i * step : total;
+        strips[i].end = (i + 1) * step < total && i < count - 1 ? (i + 1) * step : total;
+        strips[i].joinable = 0;
+        strips[i].status = e_success;
+    }
+
+    /* Strip 0 runs on the calling thread; a strip that cannot get a thread runs inline */
+    for (int i = 1; i < count; i++)
+    {
+        if (pthread_create(&strips[i].thread, NULL, strip_main, &strips[i]) == 0)
+            strips[i].joinable = 1;
+        else
+            strip_main(&strips[i]);
+    }
+    strip_main(&strips[0]);
+
+    Status status = strips[0].status;
+    for (int i = 1; i < count; i++)
+    {
+        if (strips[i].joinable)
+            pthread_join(strips[i].thread, NULL);
+        if (strips[i].status != e_success)
+            status = e_failure;
+    }
+    return status;
+}
+
+/* Read exactly len bytes at offset */
+Status pread_full(int fd, void *buf, size_t len, off_t offset)
+{
+    char *p = buf;
+    while (len > 0)
+    {
+        ssize_t got = pread(fd, p, len, offset);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return e_failure;
+        p += got;
+        len -= got;
+        offset += got;
+    }
+    return e_success;
+}
+
+/* Write exactly len bytes at offset */
+Status pwrite_full(int fd, const void *buf, size_t len, off_t offset)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t put = pwrite(fd, p, len, offset);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put <= 0)
+            return e_failure;
+        p += put;
+        len -= put;
+        offset += put;
+    }
+    return e_success;
+}
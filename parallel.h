@@ -0,0 +1,34 @@
+/*
+ * Header file for strip-parallel helpers
+ *
+ * Description:
+ * Payload byte i always lives at a fixed image offset, so the payload range
+ * can be split into independent strips. These helpers run one worker per
+ * strip on its own thread and provide the positional I/O the workers use
+ * instead of shared FILE streams.
+*/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <sys/types.h>
+#include "types.h"
+
+/* Smallest strip worth handing to its own thread (in payload bytes) */
+#define MIN_STRIP_SIZE (1024 * 1024)
+
+/* Worker called for payload bytes [begin, end) */
+typedef Status (*strip_fn)(void *ctx, long begin, long end);
+
+/*
+ * Split [0, total) into at most num_threads strips whose boundaries are
+ * multiples of align, run fn on each strip in parallel and wait for all.
+ * Returns e_failure if any strip failed.
+*/
+Status run_strips(int num_threads, long total, long align, strip_fn fn, void *ctx);
+
+/* pread()/pwrite() that retry until all len bytes are transferred */
+Status pread_full(int fd, void *buf, size_t len, off_t offset);
+Status pwrite_full(int fd, const void *buf, size_t len, off_t offset);
+
+#endif
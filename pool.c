@@ -0,0 +1,147 @@
+/*
+ * Work-Stealing Thread Pool
+ *
+ * Description:
+ * Tasks are dealt round-robin onto per-worker deques before the workers
+ * start. Each deque has its own small lock, so a worker popping its own
+ * bottom rarely contends with a thief taking from the top. No task creates
+ * new tasks, so a worker that finds every deque empty can simply exit.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pool.h"
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    void **items;
+    int top;        // Next task to steal
+    int bottom;     // One past the next task to pop
+} Deque;
+
+typedef struct
+{
+    Deque *deques;
+    int num_workers;
+    pool_task_fn fn;
+    void *arg;
+} Pool;
+
+typedef struct
+{
+    Pool *pool;
+    int id;
+    pthread_t thread;
+} Worker;
+
+/* Take the newest task from the owner's end */
+static void *deque_pop(Deque *deque)
+{
+    void *task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top)
+        task = deque->items[--deque->bottom];
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/* Take the oldest task from the thieves' end */
+static void *deque_steal(Deque *deque)
+{
+    void *task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top)
+        task = deque->items[deque->top++];
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/* Worker loop: drain the own deque, then steal until nothing is left */
+static void *worker_main(void *data)
+{
+    Worker *worker = data;
+    Pool *pool = worker->pool;
+
+    for (;;)
+    {
+        void *task = deque_pop(&pool->deques[worker->id]);
+        for (int i = 1; task == NULL && i < pool->num_workers; i++)
+        {
+            task = deque_steal(&pool->deques[(worker->id + i) % pool->num_workers]);
+        }
+        if (task == NULL)
+            break;
+        pool->fn(pool->arg, worker->id, task);
+    }
+    return NULL;
+}
+
+/* Run every task on num_workers threads */
+Status pool_run(int num_workers, void **tasks, int num_tasks, pool_task_fn fn, void *arg)
+{
+    if (num_workers > num_tasks)
+        num_workers = num_tasks;
+    if (num_workers < 1)
+        num_workers = 1;
+
+    Pool pool = { calloc(num_workers, sizeof(Deque)), num_workers, fn, arg };
+    Worker *workers = calloc(num_workers, sizeof(Worker));
+    int per_worker = (num_tasks + num_workers - 1) / num_workers;
+    Status status = e_success;
+
+    if (pool.deques == NULL || workers == NULL)
+    {
+        free(pool.deques);
+        free(workers);
+        return e_failure;
+    }
+
+    for (int w = 0; w < num_workers; w++)
+    {
+        pthread_mutex_init(&pool.deques[w].lock, NULL);
+        pool.deques[w].items = malloc((per_worker + 1) * sizeof(void *));
+        if (pool.deques[w].items == NULL)
+            status = e_failure;
+    }
+    for (int t = 0; t < num_tasks && status == e_success; t++)
+    {
+        Deque *deque = &pool.deques[t % num_workers];
+        deque->items[deque->bottom++] = tasks[t];
+    }
+
+    if (status == e_success)
+    {
+        /* Worker 0 runs on the calling thread */
+        for (int w = 1; w < num_workers; w++)
+        {
+            workers[w] = (Worker){ &pool, w, 0 };
+            if (pthread_create(&workers[w].thread, NULL, worker_main, &workers[w]) != 0)
+                workers[w].pool = NULL;
+        }
+        workers[0] = (Worker){ &pool, 0, 0 };
+        worker_main(&workers[0]);
+        for (int w = 1; w < num_workers; w++)
+        {
+            if (workers[w].pool != NULL)
+                pthread_join(workers[w].thread, NULL);
+        }
+    }
+
+    for (int w = 0; w < num_workers; w++)
+    {
+        pthread_mutex_destroy(&pool.deques[w].lock);
+        free(pool.deques[w].items);
+    }
+    free(pool.deques);
+    free(workers);
+    return status;
+}
+
+/* Number of online CPUs */
+int pool_default_workers(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
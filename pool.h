@@ -0,0 +1,28 @@
+/*
+ * Header file for the work-stealing thread pool
+ *
+ * Description:
+ * A fixed set of worker threads, each owning a deque of tasks. A worker
+ * takes tasks from the bottom of its own deque and, once it runs dry,
+ * steals from the top of the other workers' deques. Used by batch mode to
+ * spread many independent jobs over the machine.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include "types.h"
+
+/* Run one task on behalf of worker (0 .. num_workers - 1) */
+typedef void (*pool_task_fn)(void *arg, int worker, void *task);
+
+/*
+ * Run every task in tasks on num_workers threads and wait for all of them.
+ * The worker index lets callers keep per-worker state without locking.
+*/
+Status pool_run(int num_workers, void **tasks, int num_tasks, pool_task_fn fn, void *arg);
+
+/* Number of online CPUs (at least 1) */
+int pool_default_workers(void);
+
+#endif
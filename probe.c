@@ -0,0 +1,281 @@
+/*
+ * Probe Mode
+ *
+ * Description:
+ * Checks images for a payload by running the decoder's frame stages up to
+ * the file size and shard header over the first PROBE_READ_SIZE bytes of
+ * each image. Paths are collected into batches of PROBE_BATCH_SIZE and each
+ * batch is probed on the work-stealing pool, so memory stays bounded
+ * however many images a tree holds. Directory walks keep one directory open
+ * at a time.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "probe.h"
+#include "decode.h"
+#include "lsb.h"
+#include "pool.h"
+#include "bmp.h"
+#include "report.h"
+
+/* Paths probed per pool run */
+#define PROBE_BATCH_SIZE 4096
+
+/* State of one do_probe() call */
+typedef struct
+{
+    int num_workers;
+    char *paths[PROBE_BATCH_SIZE];  // Current batch
+    int count;
+    long probed;                    // Images probed so far
+    long found;                     // Images carrying a payload (updated by the workers)
+    Status status;
+    MessageCallback report;
+    void *report_arg;
+} ProbeRun;
+
+/* Probe the first bytes of an image from a file of file_size bytes */
+Status probe_image_buffer(const unsigned char *image, size_t image_len, long file_size, ProbeResult *result)
+{
+    DecodeInfo decInfo = { 0 };
+    unsigned char cover[PROBE_READ_SIZE];   // Gathered cover bytes of a non-contiguous image
+
+    if (image == NULL || image_len < BMP_HEADER_SIZE || image[0] != 'B' || image[1] != 'M')
+        return e_failure;
+
+    decInfo.d_src_map = (unsigned char *)image;
+    decInfo.d_map_size = image_len < PROBE_READ_SIZE ? image_len : PROBE_READ_SIZE;
+    decInfo.d_image_data = (char *)cover;
+    decInfo.num_threads = 1;
+    decInfo.probe_only = 1;
+    if (decode_frame(&decInfo) != e_success)
+        return e_failure;
+
+    // A two-byte magic string matches by chance, so the pixel array must be in the file and the payload must fit it
+    if (bmp_end(&decInfo.d_layout) > file_size)
+        return e_failure;
+    if (!(decInfo.d_flags & FRAME_FLAG_COMPRESS) &&
+        lsb_cover_size(decInfo.size_secret_file, decInfo.depth) > decInfo.d_layout.capacity - decInfo.d_cover_pos)
+        return e_failure;
+
+    result->depth = decInfo.depth;
+    result->flags = decInfo.d_flags;
+    strcpy(result->extn, decInfo.d_extn_secret_file);
+    result->payload_size = decInfo.size_secret_file;
+    result->shard = decInfo.d_shard;
+    return e_success;
+}
+
+/* Probe the image file at path with a single pread() */
+Status probe_image(const char *path, ProbeResult *result)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return e_failure;
+    Status status = probe_image_fd(fd, result);
+    close(fd);
+    return status;
+}
+
+/* Probe the image file open on fd */
+Status probe_image_fd(int fd, ProbeResult *result)
+{
+    unsigned char head[PROBE_READ_SIZE];
+    struct stat st;
+
+    ssize_t got = fstat(fd, &st) == 0 ? pread(fd, head, sizeof(head), 0) : -1;
+    if (got < 0)
+        return e_failure;
+    return probe_image_buffer(head, got, st.st_size, result);
+}
+
+/* Probe one image on behalf of a pool worker and report it if it carries a payload */
+static void probe_task(void *arg, int worker, void *task)
+{
+    ProbeRun *run = arg;
+    const char *path = task;
+    ProbeResult result;
+    char shard[32] = "";
+
+    (void)worker;
+    if (probe_image(path, &result) != e_success)
+        return;
+
+    __atomic_add_fetch(&run->found, 1, __ATOMIC_RELAXED);
+    if (result.flags & FRAME_FLAG_SHARD)
+        snprintf(shard, sizeof(shard), ", shard %d of %d", result.shard.index + 1, result.shard.count);
+    report_message(run->report, run->report_arg, 0, "%s: %ld bytes at depth %d%s%s%s%s%s", path, result.payload_size, result.depth,
+                   result.extn[0] != '\0' ? ", extension " : "", result.extn,
+                   (result.flags & FRAME_FLAG_ARCHIVE) ? ", archive" : "",
+                   (result.flags & FRAME_FLAG_COMPRESS) ? ", compressed" : "", shard);
+}
+
+/* Probe the current batch and start a new one */
+static void flush_batch(ProbeRun *run)
+{
+    if (run->count > 0 && pool_run(run->num_workers, (void **)run->paths, run->count, probe_task, run) != e_success)
+        run->status = e_failure;
+
+    for (int i = 0; i < run->count; i++)
+    {
+        free(run->paths[i]);
+    }
+    run->probed += run->count;
+    run->count = 0;
+}
+
+/* Queue one file for probing */
+static void add_path(ProbeRun *run, const char *path)
+{
+    if ((run->paths[run->count] = strdup(path)) == NULL)
+    {
+        run->status = e_failure;
+        return;
+    }
+    if (++run->count == PROBE_BATCH_SIZE)
+        flush_batch(run);
+}
+
+/* Whether a file name ends in ".bmp" (any case) */
+static int is_bmp_name(const char *name)
+{
+    size_t len = strlen(name);
+    return len > 4 && strcasecmp(name + len - 4, ".bmp") == 0;
+}
+
+/*
+ * Queue the *.bmp files below dir. Subdirectories are visited after dir is
+ * closed, so the walk never holds more than one directory open. Symbolic
+ * links are not followed.
+*/
+static void walk_directory(ProbeRun *run, const char *dir)
+{
+    DIR *stream = opendir(dir);
+    char **subdirs = NULL;
+    int num_subdirs = 0, capacity = 0;
+    struct dirent *entry;
+
+    if (stream == NULL)
+    {
+        report_message(run->report, run->report_arg, 1, "%s: %s", dir, strerror(errno));
+        return;
+    }
+
+    while ((entry = readdir(stream)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        char *path = malloc(strlen(dir) + strlen(entry->d_name) + 2);
+        if (path == NULL)
+        {
+            run->status = e_failure;
+            break;
+        }
+        sprintf(path, "%s/%s", dir, entry->d_name);
+
+        // Fall back to lstat() on file systems that do not report d_type
+        unsigned char type = entry->d_type;
+        struct stat st;
+        if (type == DT_UNKNOWN && lstat(path, &st) == 0)
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+
+        if (type == DT_DIR)
+        {
+            if (num_subdirs == capacity)
+            {
+                capacity = capacity ? capacity * 2 : 16;
+                char **grown = realloc(subdirs, capacity * sizeof(char *));
+                if (grown == NULL)
+                {
+                    free(path);
+                    run->status = e_failure;
+                    break;
+                }
+                subdirs = grown;
+            }
+            subdirs[num_subdirs++] = path;
+            continue;
+        }
+        if (type == DT_REG && is_bmp_name(entry->d_name))
+            add_path(run, path);
+        free(path);
+    }
+    closedir(stream);
+
+    for (int i = 0; i < num_subdirs; i++)
+    {
+        walk_directory(run, subdirs[i]);
+        free(subdirs[i]);
+    }
+    free(subdirs);
+}
+
+/* Queue a command-line path: a directory tree, a file, or "-" for a list on standard input */
+static void add_argument(ProbeRun *run, const char *arg)
+{
+    struct stat st;
+
+    if (strcmp(arg, "-") == 0)
+    {
+        char *line = NULL;
+        size_t size = 0;
+        ssize_t len;
+
+        while ((len = getline(&line, &size, stdin)) > 0)
+        {
+            while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+                line[--len] = '\0';
+            if (len > 0)
+                add_path(run, line);
+        }
+        free(line);
+    }
+    else if (stat(arg, &st) != 0)
+    {
+        report_message(run->report, run->report_arg, 1, "%s: %s", arg, strerror(errno));
+        run->status = e_failure;
+    }
+    else if (S_ISDIR(st.st_mode))
+    {
+        walk_directory(run, arg);
+    }
+    else
+    {
+        add_path(run, arg);
+    }
+}
+
+/* Probe every file or directory tree in paths */
+Status do_probe(char **paths, int count, int num_workers, MessageCallback report, void *report_arg)
+{
+    ProbeRun *run = calloc(1, sizeof(ProbeRun));
+
+    if (run == NULL)
+        return e_failure;
+    run->num_workers = num_workers > 0 ? num_workers : pool_default_workers();
+    run->status = e_success;
+    run->report = report;
+    run->report_arg = report_arg;
+
+    for (int i = 0; i < count; i++)
+    {
+        add_argument(run, paths[i]);
+    }
+    flush_batch(run);
+
+    report_message(run->report, run->report_arg, 0, "Probe Complete: %ld of %ld Images Carry a Payload", run->found, run->probed);
+    Status status = run->status;
+    free(run);
+    return status;
+}
@@ -0,0 +1,60 @@
+/*
+ * Header file for probe mode
+ *
+ * Description:
+ * Probing tells whether an image carries a payload without decoding it.
+ * Only the first PROBE_READ_SIZE bytes are read, with one pread(): the BMP
+ * header and the frame fields up to the file size and shard header. Nothing is written and
+ * nothing is allocated per image.
+ *
+ * do_probe() checks files and directory trees (only *.bmp files inside
+ * directories) on the work-stealing pool. Each worker has at most one image
+ * open at a time.
+*/
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#include "types.h"
+#include "common.h"
+#include "shard.h"
+
+/*
+ * Bytes read per image: the BMP header plus the magic string, frame header,
+ * extension size, longest extension, file size, payload checksum and shard
+ * header at 1 bit per byte (478 bytes), rounded up to two sectors.
+*/
+#define PROBE_READ_SIZE 1024
+
+/* What a probe found out about one image */
+typedef struct
+{
+    int depth;                          // Bits per image byte of the payload
+    int flags;                          // Frame flags (FRAME_FLAG_*)
+    char extn[MAX_FILE_SUFFIX + 1];     // Recorded extension
+    long payload_size;                  // Payload bytes (before compression)
+    ShardInfo shard;                    // Where the payload belongs (FRAME_FLAG_SHARD only)
+} ProbeResult;
+
+/*
+ * Probe the first bytes of an image (image_len bytes, at most
+ * PROBE_READ_SIZE are looked at) from a file of file_size bytes.
+ * Returns e_success if they start a frame whose payload fits in the file.
+*/
+Status probe_image_buffer(const unsigned char *image, size_t image_len, long file_size, ProbeResult *result);
+
+/* Probe the image file at path */
+Status probe_image(const char *path, ProbeResult *result);
+
+/* Probe the image file open on fd (read with pread(), so its offset is left alone) */
+Status probe_image_fd(int fd, ProbeResult *result);
+
+/*
+ * Probe every file or directory tree in paths ("-" reads one path per line
+ * from standard input) on num_workers threads (<= 0: one per online CPU)
+ * and report the images carrying a payload, and paths that cannot be
+ * read, to report (optional, see report.h).
+*/
+Status do_probe(char **paths, int count, int num_workers, MessageCallback report, void *report_arg);
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * Run Reports
+ *
+ * Description:
+ * Formats the lines the multi-job modes report into a buffer on the stack
+ * and hands them to the caller's callback, so reporting allocates nothing
+ * and may happen on any worker thread.
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include "report.h"
+
+/* Format a message and pass it to fn */
+void report_message(MessageCallback fn, void *arg, int error, const char *format, ...)
+{
+    char message[REPORT_MAX_MESSAGE];
+    va_list args;
+
+    if (fn == NULL)
+        return;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    fn(error, message, arg);
+}
@@ -0,0 +1,24 @@
+/*
+ * Header file for run reports
+ *
+ * Description:
+ * The library never prints. Modes that run many jobs (batch, probe, shard
+ * and join, and the daemon) describe each job and their outcome in lines
+ * of text handed to the caller's MessageCallback, which decides where they
+ * go. Without a callback the lines are dropped; the return value still
+ * tells whether the run succeeded.
+*/
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "types.h"
+
+/* Longest message passed to a MessageCallback, with room for two paths (longer ones are cut) */
+#define REPORT_MAX_MESSAGE 8192
+
+/* Format a message and pass it to fn (if set); error marks a failure of the run itself */
+void report_message(MessageCallback fn, void *arg, int error, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+#endif
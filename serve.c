@@ -0,0 +1,616 @@
+/*
+ * Daemon Mode
+ *
+ * Description:
+ * Serves encode, decode and probe jobs over a Unix domain socket (see
+ * serve.h for the protocol). The listening socket is shared by a fixed set
+ * of workers that accept connections themselves, so the only thread without
+ * a worker's job is the main one, which waits for SIGINT or SIGTERM. Jobs
+ * run the usual do_encoding()/do_decoding() on the descriptors that came
+ * with the request, wrapped into stdio streams, and on the worker's own
+ * EncodeInfo and DecodeInfo, whose block buffers are allocated at start-up
+ * and kept until shutdown.
+ *
+ * On shutdown the listening socket and every open connection are shut
+ * down; requests already received are finished and answered first.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "serve.h"
+#include "encode.h"
+#include "decode.h"
+#include "probe.h"
+#include "pool.h"
+#include "lsb.h"
+#include "report.h"
+
+/* Pending connections the kernel queues while every worker is busy */
+#define SERVE_BACKLOG 128
+
+/* Bytes of a reply body before the extension */
+#define SERVE_REPLY_FIXED 13
+
+typedef struct
+{
+    const ServeOptions *options;
+    int listen_fd;
+    int stop;                   // Set once on shutdown
+    CoverCache *cover_cache;    // Shared by all workers (optional)
+} Server;
+
+/* One worker and the contexts it reuses for every job */
+typedef struct
+{
+    Server *server;
+    pthread_t thread;
+    pthread_mutex_t lock;       // Guards conn against shutdown
+    int conn;                   // Connection being served (-1: none)
+    EncodeInfo encInfo;
+    DecodeInfo decInfo;
+} ServeWorker;
+
+/* Store the low n bytes of a value big-endian */
+static void store_be(unsigned char *out, uint64_t value, int n)
+{
+    for (int i = n - 1; i >= 0; i--, value >>= 8)
+        out[i] = value;
+}
+
+/* Load an n-byte big-endian value */
+static uint64_t load_be(const unsigned char *in, int n)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < n; i++)
+        value = value << 8 | in[i];
+    return value;
+}
+
+/*
+ * Receive exactly len bytes, collecting the descriptors that come with them.
+ * num_fds counts every descriptor sent; only the first SERVE_MAX_FDS are
+ * kept in fds, the others are closed.
+*/
+static Status recv_full(int sock, unsigned char *buf, size_t len, int *fds, int *num_fds)
+{
+    while (len > 0)
+    {
+        union
+        {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(SERVE_MAX_FDS * sizeof(int))];
+        } control;
+        struct iovec iov = { buf, len };
+        struct msghdr msg = { 0 };
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        ssize_t got = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return e_failure;
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                continue;
+            int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < count; i++)
+            {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                if (*num_fds < SERVE_MAX_FDS)
+                    fds[*num_fds] = fd;
+                else
+                    close(fd);
+                (*num_fds)++;
+            }
+        }
+        /* Descriptors the control buffer had no room for were dropped by the kernel */
+        if (msg.msg_flags & MSG_CTRUNC)
+            *num_fds += SERVE_MAX_FDS + 1;
+
+        buf += got;
+        len -= got;
+    }
+    return e_success;
+}
+
+/* Send exactly len bytes */
+static Status send_full(int sock, const unsigned char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t put = send(sock, buf, len, MSG_NOSIGNAL);
+        if (put < 0 && errno == EINTR)
+            continue;
+        if (put <= 0)
+            return e_failure;
+        buf += put;
+        len -= put;
+    }
+    return e_success;
+}
+
+/* Receive one message body (at most SERVE_MAX_MESSAGE bytes) and its descriptors */
+static Status recv_message(int sock, unsigned char *body, size_t *len, int *fds, int *num_fds)
+{
+    unsigned char header[4];
+
+    if (recv_full(sock, header, sizeof(header), fds, num_fds) != e_success)
+        return e_failure;
+    *len = load_be(header, 4);
+    if (*len > SERVE_MAX_MESSAGE)
+        return e_failure;
+    return recv_full(sock, body, *len, fds, num_fds);
+}
+
+/* Descriptors a request of operation op carries */
+static int request_fds(int op)
+{
+    return op == SERVE_OP_ENCODE ? 3 : op == SERVE_OP_DECODE ? 2 : 1;
+}
+
+/* Parse a request body */
+static Status parse_request(const unsigned char *body, size_t len, ServeRequest *request)
+{
+    if (len < 4 || len != 4u + body[3] || body[3] > MAX_FILE_SUFFIX)
+        return e_failure;
+
+    request->op = body[0];
+    request->depth = body[1];
+    request->flags = body[2];
+    memcpy(request->extn, body + 4, body[3]);
+    request->extn[body[3]] = '\0';
+
+    if (request->op != SERVE_OP_ENCODE && request->op != SERVE_OP_DECODE && request->op != SERVE_OP_PROBE)
+        return e_failure;
+    if (request->depth > LSB_MAX_DEPTH || (request->flags & ~(SERVE_FLAG_INDEX | SERVE_FLAG_COMPRESS | SERVE_FLAG_CHECKSUM)))
+        return e_failure;
+    /* As on the command line, compressed payloads have no chunk index */
+    if ((request->flags & SERVE_FLAG_INDEX) && (request->flags & SERVE_FLAG_COMPRESS))
+        return e_failure;
+    return strlen(request->extn) == body[3] ? e_success : e_failure;
+}
+
+/* Wrap a received descriptor into a stream that takes it over */
+static FILE *open_stream(int *fd, const char *mode)
+{
+    FILE *stream = fdopen(*fd, mode);
+    if (stream != NULL)
+        *fd = -1;
+    return stream;
+}
+
+/* Open a received output descriptor like fopen(..., "w") or "w+" would */
+static FILE *open_output(int *fd)
+{
+    struct stat st;
+    int readable = (fcntl(*fd, F_GETFL) & O_ACCMODE) == O_RDWR;
+
+    if (fstat(*fd, &st) == 0 && S_ISREG(st.st_mode) && ftruncate(*fd, 0) != 0)
+        return NULL;
+    return open_stream(fd, readable ? "w+" : "w");
+}
+
+/* Run an encode job on the worker's EncodeInfo */
+static void run_encode(ServeWorker *worker, const ServeRequest *request, int *fds, ServeReply *reply)
+{
+    EncodeInfo *encInfo = &worker->encInfo;
+    const ServeOptions *options = worker->server->options;
+
+    encInfo->src_map = encInfo->stego_map = NULL;
+    encInfo->tail_cloned = 0;
+    encInfo->use_mmap = options->use_mmap;
+    encInfo->use_aio = options->use_aio;
+    encInfo->cover_cache = worker->server->cover_cache;
+    encInfo->num_threads = 1;
+    encInfo->depth = request->depth;
+    encInfo->use_index = (request->flags & SERVE_FLAG_INDEX) != 0;
+    encInfo->compress = (request->flags & SERVE_FLAG_COMPRESS) != 0;
+    encInfo->use_checksum = (request->flags & SERVE_FLAG_CHECKSUM) != 0;
+    encInfo->progress = NULL;
+    encInfo->size_secret_file = 0;
+    strcpy(encInfo->extn_secret_file, request->extn);
+
+    encInfo->fptr_src_image = open_stream(&fds[0], "r");
+    encInfo->fptr_secret = open_stream(&fds[1], "r");
+    encInfo->fptr_stego_image = open_output(&fds[2]);
+
+    Status status = e_failure;
+    encInfo->stage = e_stage_open;
+    if (encInfo->fptr_src_image != NULL && encInfo->fptr_secret != NULL && encInfo->fptr_stego_image != NULL)
+        status = do_encoding(encInfo);
+    else
+        close_files(encInfo);
+
+    reply->status = status == e_success ? SERVE_OK : SERVE_FAILED;
+    reply->stage = encInfo->stage;
+    reply->depth = request->depth > 1 ? request->depth : 1;
+    reply->flags = (encInfo->use_index ? FRAME_FLAG_INDEX : 0) | (encInfo->compress ? FRAME_FLAG_COMPRESS : 0) |
+                   (encInfo->use_checksum ? FRAME_FLAG_CHECKSUM : 0);
+    reply->payload_size = encInfo->size_secret_file;
+    strcpy(reply->extn, request->extn);
+}
+
+/* Run a decode job on the worker's DecodeInfo */
+static void run_decode(ServeWorker *worker, int *fds, ServeReply *reply)
+{
+    DecodeInfo *decInfo = &worker->decInfo;
+    const ServeOptions *options = worker->server->options;
+
+    decInfo->d_src_map = NULL;
+    decInfo->use_mmap = options->use_mmap;
+    decInfo->use_aio = options->use_aio;
+    decInfo->num_threads = 1;
+    decInfo->progress = NULL;
+    decInfo->size_secret_file = 0;
+    decInfo->d_extn_secret_file[0] = '\0';
+
+    decInfo->fptr_d_src_image = open_stream(&fds[0], "r");
+    decInfo->fptr_d_secret = open_output(&fds[1]);
+
+    Status status = e_failure;
+    decInfo->stage = e_stage_open;
+    if (decInfo->fptr_d_src_image != NULL && decInfo->fptr_d_secret != NULL)
+        status = do_decoding(decInfo);
+    else
+        close_files_decode(decInfo);
+    /* The output is closed by the data stage; a decode that stopped earlier leaves it open */
+    if (decInfo->fptr_d_secret != NULL)
+    {
+        fclose(decInfo->fptr_d_secret);
+        decInfo->fptr_d_secret = NULL;
+    }
+
+    reply->status = status == e_success ? SERVE_OK : SERVE_FAILED;
+    reply->stage = decInfo->stage;
+    reply->depth = decInfo->depth;
+    reply->flags = decInfo->d_flags;
+    reply->payload_size = decInfo->size_secret_file;
+    strcpy(reply->extn, decInfo->d_extn_secret_file);
+}
+
+/* Run a probe job */
+static void run_probe(int *fds, ServeReply *reply)
+{
+    ProbeResult result;
+
+    if (probe_image_fd(fds[0], &result) != e_success)
+    {
+        reply->status = SERVE_FAILED;
+        reply->stage = e_stage_magic;
+        return;
+    }
+    reply->status = SERVE_OK;
+    reply->stage = e_stage_size;
+    reply->depth = result.depth;
+    reply->flags = result.flags;
+    reply->payload_size = result.payload_size;
+    strcpy(reply->extn, result.extn);
+}
+
+/* Serialize and send a reply */
+static Status send_reply(int sock, const ServeReply *reply)
+{
+    unsigned char message[4 + SERVE_MAX_MESSAGE];
+    size_t n = strlen(reply->extn);
+    unsigned char *body = message + 4;
+
+    store_be(message, SERVE_REPLY_FIXED + n, 4);
+    body[0] = reply->status;
+    body[1] = reply->stage;
+    body[2] = reply->depth;
+    body[3] = reply->flags;
+    store_be(body + 4, reply->payload_size, 8);
+    body[12] = n;
+    memcpy(body + SERVE_REPLY_FIXED, reply->extn, n);
+    return send_full(sock, message, 4 + SERVE_REPLY_FIXED + n);
+}
+
+/* Receive, run and answer one request; e_failure ends the connection */
+static Status serve_request(ServeWorker *worker, int conn)
+{
+    unsigned char body[SERVE_MAX_MESSAGE];
+    int fds[SERVE_MAX_FDS];
+    int num_fds = 0;
+    size_t len;
+    Status status = recv_message(conn, body, &len, fds, &num_fds);
+
+    if (status == e_success)
+    {
+        ServeRequest request;
+        ServeReply reply = { 0 };
+
+        if (parse_request(body, len, &request) != e_success || num_fds != request_fds(request.op))
+            reply.status = SERVE_BAD_REQUEST;
+        else if (request.op == SERVE_OP_ENCODE)
+            run_encode(worker, &request, fds, &reply);
+        else if (request.op == SERVE_OP_DECODE)
+            run_decode(worker, fds, &reply);
+        else
+            run_probe(fds, &reply);
+        status = send_reply(conn, &reply);
+    }
+
+    /* Descriptors the job did not take over */
+    for (int i = 0; i < num_fds && i < SERVE_MAX_FDS; i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    return status;
+}
+
+/* Worker thread: accept connections and serve their requests until shutdown */
+static void *serve_worker_main(void *arg)
+{
+    ServeWorker *worker = arg;
+    Server *server = worker->server;
+
+    while (!__atomic_load_n(&server->stop, __ATOMIC_SEQ_CST))
+    {
+        int conn = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0)
+        {
+            /* Out of descriptors: let other connections close before retrying */
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+                usleep(1000);
+            continue;
+        }
+
+        pthread_mutex_lock(&worker->lock);
+        worker->conn = conn;
+        pthread_mutex_unlock(&worker->lock);
+
+        while (!__atomic_load_n(&server->stop, __ATOMIC_SEQ_CST) && serve_request(worker, conn) == e_success)
+            ;
+
+        pthread_mutex_lock(&worker->lock);
+        worker->conn = -1;
+        close(conn);
+        pthread_mutex_unlock(&worker->lock);
+    }
+    return NULL;
+}
+
+/* Fill in the address of socket_path */
+static Status socket_address(const char *socket_path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr->sun_path))
+        return e_failure;
+    strcpy(addr->sun_path, socket_path);
+    return e_success;
+}
+
+/* Bind and listen on socket_path, replacing a socket left behind by a daemon that is gone */
+static int open_listener(const char *socket_path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (socket_address(socket_path, &addr) != e_success)
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if (!bound && errno == EADDRINUSE && stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        int probe = serve_connect(socket_path);
+        if (probe >= 0)
+            close(probe);
+        else if (errno == ECONNREFUSED && unlink(socket_path) == 0)
+            bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    if (!bound || listen(fd, SERVE_BACKLOG) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Serve jobs until SIGINT or SIGTERM */
+Status do_serve(const char *socket_path, const ServeOptions *options)
+{
+    Server server = { options, -1, 0, NULL };
+    CoverCache cover_cache;
+    int num_workers = options->num_workers > 0 ? options->num_workers : pool_default_workers();
+    sigset_t signals, old;
+
+    /* Only the main thread takes the shutdown signals; a vanished reader must not kill the daemon */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &old);
+    signal(SIGPIPE, SIG_IGN);
+
+    server.listen_fd = open_listener(socket_path);
+    if (server.listen_fd < 0)
+    {
+        report_message(options->report, options->report_arg, 1, "Cannot listen on %s: %s", socket_path, strerror(errno));
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        return e_failure;
+    }
+
+    ServeWorker *workers = calloc(num_workers, sizeof(ServeWorker));
+    int started = 0;
+    Status status = workers != NULL ? e_success : e_failure;
+
+    if (options->cover_cache_size > 0)
+    {
+        if (cover_cache_init(&cover_cache, options->cover_cache_size) == e_success)
+            server.cover_cache = &cover_cache;
+        else
+            status = e_failure;
+    }
+
+    for (int i = 0; i < num_workers && status == e_success; i++)
+    {
+        ServeWorker *worker = &workers[i];
+
+        worker->server = &server;
+        worker->conn = -1;
+        pthread_mutex_init(&worker->lock, NULL);
+        /* Block buffers up front, so no job pays for their allocation */
+        worker->encInfo.image_data = malloc(MAX_IMAGE_BUF_SIZE);
+        worker->encInfo.secret_data = malloc(MAX_SECRET_BUF_SIZE);
+        worker->decInfo.d_image_data = malloc(MAX_IMAGE_BUF_SIZE);
+        worker->decInfo.d_secret_data = malloc(MAX_SECRET_BUF_SIZE);
+        if (worker->encInfo.image_data == NULL || worker->encInfo.secret_data == NULL ||
+            worker->decInfo.d_image_data == NULL || worker->decInfo.d_secret_data == NULL ||
+            pthread_create(&worker->thread, NULL, serve_worker_main, worker) != 0)
+        {
+            release_encode_info(&worker->encInfo);
+            release_decode_info(&worker->decInfo);
+            pthread_mutex_destroy(&worker->lock);
+            status = e_failure;
+            break;
+        }
+        started++;
+    }
+
+    if (status == e_success)
+    {
+        int sig;
+        report_message(options->report, options->report_arg, 0, "Serving on %s with %d workers", socket_path, num_workers);
+        sigwait(&signals, &sig);
+    }
+
+    /* Wake the workers: accept() fails once the listener is shut down, reads once their connection is */
+    __atomic_store_n(&server.stop, 1, __ATOMIC_SEQ_CST);
+    shutdown(server.listen_fd, SHUT_RDWR);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_mutex_lock(&workers[i].lock);
+        if (workers[i].conn >= 0)
+            shutdown(workers[i].conn, SHUT_RD);
+        pthread_mutex_unlock(&workers[i].lock);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        release_encode_info(&workers[i].encInfo);
+        release_decode_info(&workers[i].decInfo);
+        pthread_mutex_destroy(&workers[i].lock);
+    }
+
+    if (server.cover_cache != NULL)
+    {
+        report_message(options->report, options->report_arg, 0, "Cover cache: %ld hits, %ld misses", cover_cache.hits, cover_cache.misses);
+        cover_cache_destroy(server.cover_cache);
+    }
+    free(workers);
+    close(server.listen_fd);
+    unlink(socket_path);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return status;
+}
+
+/* Connect to a daemon */
+int serve_connect(const char *socket_path)
+{
+    struct sockaddr_un addr;
+
+    if (socket_address(socket_path, &addr) != e_success)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+/* Send one job and wait for its reply */
+Status serve_call(int sock, const ServeRequest *request, const int *fds, int num_fds, ServeReply *reply)
+{
+    unsigned char message[4 + SERVE_MAX_MESSAGE];
+    size_t n = strlen(request->extn);
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(SERVE_MAX_FDS * sizeof(int))];
+    } control;
+
+    if (n > MAX_FILE_SUFFIX || num_fds < 0 || num_fds > SERVE_MAX_FDS)
+        return e_failure;
+    store_be(message, 4 + n, 4);
+    message[4] = request->op;
+    message[5] = request->depth;
+    message[6] = request->flags;
+    message[7] = n;
+    memcpy(message + 8, request->extn, n);
+
+    /* The descriptors ride on the first byte; the rest follows if the first send falls short */
+    struct iovec iov = { message, 8 + n };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (num_fds > 0)
+    {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+    }
+
+    ssize_t put;
+    do
+    {
+        put = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (put < 0 && errno == EINTR);
+    if (put <= 0 || send_full(sock, message + put, 8 + n - put) != e_success)
+        return e_failure;
+
+    unsigned char body[SERVE_MAX_MESSAGE];
+    int received[SERVE_MAX_FDS];
+    int num_received = 0;
+    size_t len;
+    Status status = recv_message(sock, body, &len, received, &num_received);
+    for (int i = 0; i < num_received && i < SERVE_MAX_FDS; i++)
+        close(received[i]);
+    if (status != e_success || num_received != 0 || len < SERVE_REPLY_FIXED ||
+        body[12] > MAX_FILE_SUFFIX || len != SERVE_REPLY_FIXED + (size_t)body[12])
+        return e_failure;
+
+    reply->status = body[0];
+    reply->stage = body[1];
+    reply->depth = body[2];
+    reply->flags = body[3];
+    reply->payload_size = load_be(body + 4, 8);
+    memcpy(reply->extn, body + SERVE_REPLY_FIXED, body[12]);
+    reply->extn[body[12]] = '\0';
+    return e_success;
+}
@@ -0,0 +1,106 @@
+/*
+ * Header file for daemon mode
+ *
+ * Description:
+ * do_serve() listens on a Unix domain socket and runs encode, decode and
+ * probe jobs for local clients. A job then costs a few system calls instead
+ * of a process start-up, and it runs on buffers that are already allocated
+ * and warm. The files come with the request as descriptors (SCM_RIGHTS), so
+ * the daemon opens no paths and nothing is copied through the socket.
+ *
+ * A fixed set of workers each own one EncodeInfo and one DecodeInfo, with
+ * their block buffers allocated at start-up. Every worker accepts a
+ * connection itself and serves its requests in order until the client
+ * closes it, so a client wanting several jobs at once opens several
+ * connections. Further connections wait in the listen backlog.
+ *
+ * Protocol (all integers big-endian):
+ * Every message is a 4-byte body length followed by the body.
+ *
+ * Request body:
+ *   op (1 byte: SERVE_OP_*), depth (1 byte, 0 for 1), flags (1 byte:
+ *   SERVE_FLAG_*), extension length (1 byte), extension (encode only: the
+ *   one recorded in the image, at most MAX_FILE_SUFFIX bytes).
+ * The descriptors travel as one SCM_RIGHTS message with the request:
+ *   encode: cover, secret, stego image (truncated by the daemon)
+ *   decode: stego image, output (truncated by the daemon)
+ *   probe:  image
+ * With the mmap backend (--mmap) the stego image of an encode and the
+ * output of a decode must be open for reading and writing.
+ *
+ * Reply body:
+ *   status (1 byte: SERVE_*), stage (1 byte: the failed Stage, or the last
+ *   one), depth (1 byte), frame flags (1 byte: FRAME_FLAG_*), payload size
+ *   (8 bytes), extension length (1 byte), extension.
+ * A request that cannot be parsed gets SERVE_BAD_REQUEST; a message longer
+ * than SERVE_MAX_MESSAGE closes the connection.
+*/
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "types.h"
+#include "common.h"
+
+/* Longest message body (reply: 13 bytes plus the extension) */
+#define SERVE_MAX_MESSAGE 64
+
+/* Most descriptors a request carries */
+#define SERVE_MAX_FDS 3
+
+/* Operations */
+#define SERVE_OP_ENCODE 'e'
+#define SERVE_OP_DECODE 'd'
+#define SERVE_OP_PROBE 'p'
+
+/* Encode flags */
+#define SERVE_FLAG_INDEX 0x01
+#define SERVE_FLAG_COMPRESS 0x02
+#define SERVE_FLAG_CHECKSUM 0x04
+
+/* Reply status */
+#define SERVE_OK 0
+#define SERVE_FAILED 1          // The job failed (see the stage); probe: no payload
+#define SERVE_BAD_REQUEST 2     // Unknown operation, bad fields or wrong descriptor count
+
+/* A job as sent by a client */
+typedef struct
+{
+    int op;                             // SERVE_OP_*
+    int depth;                          // Bits per image byte (0 for 1)
+    int flags;                          // SERVE_FLAG_*
+    char extn[MAX_FILE_SUFFIX + 1];     // Extension to record (encode)
+} ServeRequest;
+
+/* The outcome of a job */
+typedef struct
+{
+    int status;                         // SERVE_*
+    int stage;                          // Stage reached (the failed one on SERVE_FAILED)
+    int depth;                          // Payload depth
+    int flags;                          // Frame flags (FRAME_FLAG_*)
+    long payload_size;                  // Payload bytes
+    char extn[MAX_FILE_SUFFIX + 1];     // Recorded extension
+} ServeReply;
+
+/* Options applied to every job */
+typedef struct
+{
+    int num_workers;    // Worker threads (<= 0: one per online CPU)
+    int use_mmap;       // Use the mmap backend for every job
+    int use_aio;        // Pipeline the secret data of every job (see aio.h)
+    size_t cover_cache_size; // Bytes of covers kept mapped across encode jobs (0: none, see covercache.h)
+    MessageCallback report; // Told when the daemon is ready and, at shutdown, the cover cache hit rate (optional, see report.h)
+    void *report_arg;
+} ServeOptions;
+
+/* Serve jobs on socket_path until SIGINT or SIGTERM */
+Status do_serve(const char *socket_path, const ServeOptions *options);
+
+/* Connect to a daemon; returns the socket, or -1 */
+int serve_connect(const char *socket_path);
+
+/* Send one job with its num_fds descriptors and wait for the reply */
+Status serve_call(int sock, const ServeRequest *request, const int *fds, int num_fds, ServeReply *reply);
+
+#endif
@@ -0,0 +1,459 @@
+/*
+ * Sharding
+ *
+ * Description:
+ * Splits a payload across several covers and joins it back. Both ways run
+ * on the work-stealing pool with one shard per task. Like batch mode, every
+ * worker owns one EncodeInfo or DecodeInfo, so the block buffers are
+ * allocated once per worker. Encoding reads each shard straight from its
+ * offset in the secret; joining sizes the output once and every worker
+ * writes its shard at its own offset, so neither side copies the payload
+ * through an intermediate file.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include "shard.h"
+#include "encode.h"
+#include "decode.h"
+#include "pool.h"
+#include "bmp.h"
+#include "report.h"
+
+/* One shard to embed or decode */
+typedef struct
+{
+    char *image;                // Cover (encode) or shard image (join)
+    char *stego;                // Stego image written (encode only)
+    ShardInfo shard;
+    Status status;
+} ShardJob;
+
+/* State of one do_shard_encode() or do_shard_join() call */
+typedef struct
+{
+    const ShardOptions *options;
+    const char *secret_fname;   // Secret (encode) or output (join)
+    EncodeInfo **encoders;      // Per-worker contexts, allocated on first use
+    DecodeInfo **decoders;
+} ShardRun;
+
+/* Store a big-endian value of size bytes */
+static void store_be(unsigned char *out, uint64_t value, int size)
+{
+    for (int i = 0; i < size; i++)
+        out[i] = value >> (8 * (size - 1 - i));
+}
+
+/* Load a big-endian value of size bytes */
+static uint64_t load_be(const unsigned char *in, int size)
+{
+    uint64_t value = 0;
+
+    for (int i = 0; i < size; i++)
+        value = value << 8 | in[i];
+    return value;
+}
+
+/* Serialize a shard header */
+void shard_header_store(const ShardInfo *shard, unsigned char *out)
+{
+    store_be(out, shard->set_id, 8);
+    store_be(out + 8, shard->index, 2);
+    store_be(out + 10, shard->count, 2);
+    store_be(out + 12, shard->offset, 8);
+    store_be(out + 20, shard->total_size, 8);
+}
+
+/* Parse a shard header and check that the shard lies inside its payload */
+Status shard_header_load(ShardInfo *shard, const unsigned char *in, long length)
+{
+    uint64_t offset = load_be(in + 12, 8);
+    uint64_t total_size = load_be(in + 20, 8);
+
+    shard->set_id = load_be(in, 8);
+    shard->index = load_be(in + 8, 2);
+    shard->count = load_be(in + 10, 2);
+    if (shard->count == 0 || shard->index >= shard->count || total_size > LONG_MAX || offset > total_size ||
+        (uint64_t)length > total_size - offset)
+        return e_failure;
+    shard->offset = offset;
+    shard->length = length;
+    shard->total_size = total_size;
+    return e_success;
+}
+
+/* Whether two headers describe the same shard */
+int shard_same(const ShardInfo *a, const ShardInfo *b)
+{
+    return a->set_id == b->set_id && a->index == b->index && a->count == b->count && a->offset == b->offset &&
+           a->length == b->length && a->total_size == b->total_size;
+}
+
+/* A random set id, so shards of different payloads never join by accident */
+static uint64_t new_set_id(void)
+{
+    uint64_t id;
+    struct timespec now;
+
+    if (getrandom(&id, sizeof(id), 0) == sizeof(id))
+        return id;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ ((uint64_t)getpid() << 16);
+}
+
+/* Set up a worker's EncodeInfo for one shard */
+static Status prepare_encoder(EncodeInfo *encInfo, ShardRun *run, ShardJob *job)
+{
+    const ShardOptions *options = run->options;
+    char *argv[] = { "shard", "-e", job->image, (char *)run->secret_fname, job->stego, NULL };
+
+    encInfo->fptr_src_image = encInfo->fptr_secret = encInfo->fptr_stego_image = NULL;
+    encInfo->src_map = encInfo->stego_map = NULL;
+    encInfo->tail_cloned = 0;
+    encInfo->use_mmap = options->use_mmap;
+    encInfo->depth = options->depth;
+    encInfo->use_index = options->use_index;
+    encInfo->compress = options->compress;
+    encInfo->use_checksum = 1;
+    encInfo->num_threads = 1;
+    encInfo->use_aio = options->use_aio;
+    encInfo->progress = NULL;
+    encInfo->shard = &job->shard;
+    return read_and_validate_encode_args(argv, encInfo);
+}
+
+/* Embed one shard on behalf of a pool worker */
+static void encode_task(void *arg, int worker, void *task)
+{
+    ShardRun *run = arg;
+    ShardJob *job = task;
+    EncodeInfo **encInfo = &run->encoders[worker];
+
+    job->status = e_failure;
+    if (*encInfo == NULL && (*encInfo = calloc(1, sizeof(EncodeInfo))) == NULL)
+        return;
+    if (prepare_encoder(*encInfo, run, job) == e_success)
+        job->status = do_encoding(*encInfo);
+
+    report_message(run->options->report, run->options->report_arg, 0, "[shard %d] %s -> %s: %ld bytes at %ld: %s", job->shard.index,
+                   job->image, job->stego, job->shard.length, job->shard.offset, job->status == e_success ? "OK" : "FAILED");
+}
+
+/* Decode one shard to its offset in the output on behalf of a pool worker */
+static void join_task(void *arg, int worker, void *task)
+{
+    ShardRun *run = arg;
+    ShardJob *job = task;
+    DecodeInfo **decInfo = &run->decoders[worker];
+
+    job->status = e_failure;
+    if (*decInfo == NULL && (*decInfo = calloc(1, sizeof(DecodeInfo))) == NULL)
+        return;
+    (*decInfo)->fptr_d_src_image = (*decInfo)->fptr_d_secret = NULL;
+    (*decInfo)->d_src_map = NULL;
+    (*decInfo)->use_mmap = run->options->use_mmap;
+    (*decInfo)->num_threads = 1;
+    (*decInfo)->use_aio = run->options->use_aio;
+    (*decInfo)->progress = NULL;
+    (*decInfo)->d_src_image_fname = job->image;
+    (*decInfo)->d_secret_fname = (char *)run->secret_fname;
+    (*decInfo)->d_join = &job->shard;
+    job->status = do_decoding(*decInfo);
+
+    report_message(run->options->report, run->options->report_arg, 0, "[shard %d] %s: %ld bytes at %ld: %s", job->shard.index,
+                   job->image, job->shard.length, job->shard.offset, job->status == e_success ? "OK" : "FAILED");
+}
+
+/* Run every job on the pool and free the per-worker contexts; returns the jobs that succeeded */
+static int run_jobs(ShardRun *run, ShardJob *jobs, int count, pool_task_fn fn)
+{
+    int num_workers = run->options->num_workers > 0 ? run->options->num_workers : pool_default_workers();
+    void **tasks = malloc(count * sizeof(void *));
+    int succeeded = 0;
+
+    run->encoders = calloc(num_workers, sizeof(EncodeInfo *));
+    run->decoders = calloc(num_workers, sizeof(DecodeInfo *));
+    if (tasks != NULL && run->encoders != NULL && run->decoders != NULL)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            tasks[i] = &jobs[i];
+        }
+        if (pool_run(num_workers, tasks, count, fn, run) == e_success)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                succeeded += jobs[i].status == e_success;
+            }
+        }
+    }
+
+    for (int w = 0; w < num_workers; w++)
+    {
+        if (run->encoders != NULL && run->encoders[w] != NULL)
+        {
+            release_encode_info(run->encoders[w]);
+            free(run->encoders[w]);
+        }
+        if (run->decoders != NULL && run->decoders[w] != NULL)
+        {
+            release_decode_info(run->decoders[w]);
+            free(run->decoders[w]);
+        }
+    }
+    free(run->encoders);
+    free(run->decoders);
+    free(tasks);
+    return succeeded;
+}
+
+/* Most secret bytes a cover holds as a shard of run's secret (-1 if it is not a usable cover) */
+static long shard_capacity(ShardRun *run, ShardJob *job)
+{
+    unsigned char header[BMP_HEADER_SIZE];
+    BmpLayout layout;
+    EncodeInfo trial = { 0 };
+    int fd = open(job->image, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return -1;
+    Status status = pread(fd, header, sizeof(header), 0) == sizeof(header) ? bmp_parse_layout(header, sizeof(header), &layout) : e_failure;
+    close(fd);
+    if (status != e_success || prepare_encoder(&trial, run, job) != e_success)
+        return -1;
+    return encode_max_secret_size(&trial, layout.capacity);
+}
+
+/*
+ * Give each cover a share of total_size in proportion to what it holds.
+ * Rounding leaves fewer bytes than covers over; they go to the first
+ * covers with room to spare.
+*/
+static Status plan_shards(ShardJob *jobs, int count, const long *capacity, long total_size)
+{
+    unsigned __int128 sum = 0;
+    long assigned = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        sum += capacity[i];
+    }
+    if (sum < (unsigned __int128)total_size)
+        return e_failure;
+
+    for (int i = 0; i < count; i++)
+    {
+        jobs[i].shard.length = sum > 0 ? (long)((unsigned __int128)total_size * capacity[i] / sum) : 0;
+        assigned += jobs[i].shard.length;
+    }
+    for (int i = 0; i < count && assigned < total_size; i++)
+    {
+        long room = capacity[i] - jobs[i].shard.length;
+        long extra = total_size - assigned < room ? total_size - assigned : room;
+
+        jobs[i].shard.length += extra;
+        assigned += extra;
+    }
+
+    long offset = 0;
+    for (int i = 0; i < count; i++)
+    {
+        jobs[i].shard.offset = offset;
+        offset += jobs[i].shard.length;
+    }
+    return e_success;
+}
+
+/* Split the secret across the covers and embed the shards in parallel */
+Status do_shard_encode(const char *secret_fname, const char *stego_prefix, char **covers, int count, const ShardOptions *options)
+{
+    ShardRun run = { options, secret_fname, NULL, NULL };
+    struct stat st;
+
+    if (count < 1 || count > SHARD_MAX_COUNT)
+    {
+        report_message(options->report, options->report_arg, 1, "Error: Sharding Takes 1 to %d Covers", SHARD_MAX_COUNT);
+        return e_failure;
+    }
+    if (stat(secret_fname, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > LONG_MAX)
+    {
+        report_message(options->report, options->report_arg, 1, "Error: Can't Read %s", secret_fname);
+        return e_failure;
+    }
+
+    ShardJob *jobs = calloc(count, sizeof(ShardJob));
+    long *capacity = calloc(count, sizeof(long));
+    Status status = jobs != NULL && capacity != NULL ? e_success : e_failure;
+    uint64_t set_id = new_set_id();
+
+    for (int i = 0; i < count && status == e_success; i++)
+    {
+        size_t size = strlen(stego_prefix) + 16;
+
+        jobs[i].image = covers[i];
+        jobs[i].shard = (ShardInfo){ set_id, i, count, 0, 0, st.st_size };
+        if ((jobs[i].stego = malloc(size)) == NULL)
+        {
+            status = e_failure;
+            break;
+        }
+        snprintf(jobs[i].stego, size, "%s_%d.bmp", stego_prefix, i);
+
+        if ((capacity[i] = shard_capacity(&run, &jobs[i])) < 0)
+        {
+            report_message(options->report, options->report_arg, 1, "Error: %s Is Not a Usable Cover", covers[i]);
+            status = e_failure;
+        }
+    }
+    if (status == e_success && plan_shards(jobs, count, capacity, st.st_size) != e_success)
+    {
+        report_message(options->report, options->report_arg, 1, "Error: The Covers Hold Less Than %ld Bytes", (long)st.st_size);
+        status = e_failure;
+    }
+
+    if (status == e_success)
+    {
+        int succeeded = run_jobs(&run, jobs, count, encode_task);
+        report_message(options->report, options->report_arg, 0, "Sharding Complete: %d of %d Shards Written", succeeded, count);
+        if (succeeded != count)
+            status = e_failure;
+    }
+
+    for (int i = 0; jobs != NULL && i < count; i++)
+    {
+        free(jobs[i].stego);
+    }
+    free(capacity);
+    free(jobs);
+    return status;
+}
+
+/*
+ * Decode the frame fields of a shard image up to its shard header. Unlike a
+ * probe, this reads as far into the file as the pixel array starts.
+*/
+static Status read_shard_header(DecodeInfo *decInfo, char *image)
+{
+    decInfo->fptr_d_src_image = NULL;
+    decInfo->d_src_map = NULL;
+    decInfo->d_src_image_fname = image;
+    decInfo->probe_only = 1;
+    if (do_decoding(decInfo) != e_success || !(decInfo->d_flags & FRAME_FLAG_SHARD))
+        return e_failure;
+    return e_success;
+}
+
+/*
+ * Read the shard headers of the images and check that they are one whole
+ * set: the same set id, count, payload size and extension throughout,
+ * every index exactly once, and the shards in index order tiling the
+ * payload. Orders jobs by index.
+*/
+static Status collect_shards(ShardJob *jobs, char **images, int count, const ShardOptions *options)
+{
+    DecodeInfo *decInfo = calloc(1, sizeof(DecodeInfo));
+    ShardInfo first = { 0 };
+    char extn[MAX_FILE_SUFFIX + 1] = "";
+    Status status = decInfo != NULL ? e_success : e_failure;
+
+    for (int i = 0; i < count && status == e_success; i++)
+    {
+        const ShardInfo *shard = &decInfo->d_shard;
+
+        status = e_failure;
+        if (read_shard_header(decInfo, images[i]) != e_success)
+        {
+            report_message(options->report, options->report_arg, 1, "Error: %s Is Not a Shard", images[i]);
+            break;
+        }
+        if (i == 0)
+        {
+            first = *shard;
+            strcpy(extn, decInfo->d_extn_secret_file);
+        }
+        if (shard->set_id != first.set_id || shard->count != first.count || shard->total_size != first.total_size ||
+            strcmp(decInfo->d_extn_secret_file, extn) != 0)
+        {
+            report_message(options->report, options->report_arg, 1, "Error: %s Belongs to Another Set", images[i]);
+            break;
+        }
+        if (shard->count != count || jobs[shard->index].image != NULL)
+        {
+            report_message(options->report, options->report_arg, 1, "Error: Expected Each of %d Shards Once", shard->count);
+            break;
+        }
+        jobs[shard->index].image = images[i];
+        jobs[shard->index].shard = *shard;
+        status = e_success;
+    }
+    if (decInfo != NULL)
+        release_decode_info(decInfo);
+    free(decInfo);
+
+    long offset = 0;
+    for (int i = 0; i < count && status == e_success; i++)
+    {
+        if (jobs[i].shard.offset != offset)
+        {
+            report_message(options->report, options->report_arg, 1, "Error: Shard %d Does Not Follow Shard %d", i, i - 1);
+            status = e_failure;
+        }
+        offset += jobs[i].shard.length;
+    }
+    if (status == e_success && offset != first.total_size)
+    {
+        report_message(options->report, options->report_arg, 1, "Error: The Shards Do Not Cover the Payload");
+        status = e_failure;
+    }
+    return status;
+}
+
+/* Reassemble a payload from its shard images, decoding them in parallel */
+Status do_shard_join(const char *output_fname, char **images, int count, const ShardOptions *options)
+{
+    ShardRun run = { options, output_fname, NULL, NULL };
+
+    if (count < 1 || count > SHARD_MAX_COUNT)
+    {
+        report_message(options->report, options->report_arg, 1, "Error: Joining Takes 1 to %d Shards", SHARD_MAX_COUNT);
+        return e_failure;
+    }
+
+    ShardJob *jobs = calloc(count, sizeof(ShardJob));
+    Status status = jobs != NULL ? collect_shards(jobs, images, count, options) : e_failure;
+
+    /* Every worker writes into the output at its own offset, so it is created at its final size */
+    if (status == e_success)
+    {
+        int fd = open(output_fname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0 || ftruncate(fd, jobs[0].shard.total_size) != 0)
+        {
+            report_message(options->report, options->report_arg, 1, "Error: Can't Create %s", output_fname);
+            status = e_failure;
+        }
+        if (fd >= 0)
+            close(fd);
+    }
+
+    if (status == e_success)
+    {
+        int succeeded = run_jobs(&run, jobs, count, join_task);
+        report_message(options->report, options->report_arg, 0, "Joining Complete: %d of %d Shards Decoded", succeeded, count);
+        if (succeeded != count)
+            status = e_failure;
+        /* An incomplete join leaves nothing behind */
+        if (status != e_success)
+            unlink(output_fname);
+    }
+    free(jobs);
+    return status;
+}
@@ -0,0 +1,80 @@
+/*
+ * Header file for sharding
+ *
+ * Description:
+ * A payload larger than any one cover can be split across several covers.
+ * do_shard_encode() gives every cover a shard (a contiguous piece of the
+ * payload) in proportion to how much it can hold, and embeds the shards
+ * in parallel, one cover per worker. Each shard is an ordinary frame with
+ * FRAME_FLAG_SHARD set: its file size is the shard's length, its payload
+ * checksum (always stored) covers the shard, and a shard header after the
+ * checksum places it in the whole payload.
+ *
+ * do_shard_join() takes the shard images in any order, checks from their
+ * headers that they form one complete set, and decodes them in parallel,
+ * every worker writing its shard straight to its offset in the output.
+ *
+ * Shard header (SHARD_HEADER_SIZE bytes, big-endian, at the payload depth):
+ *   set id (8 bytes, random, shared by the shards of one payload),
+ *   shard index (2 bytes), shard count (2 bytes),
+ *   offset of the shard in the payload (8 bytes),
+ *   size of the whole payload (8 bytes).
+*/
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+#include "types.h"
+
+#define SHARD_HEADER_SIZE 28
+
+/* Most shards in a set (the count field is 16 bits) */
+#define SHARD_MAX_COUNT 65535
+
+/* Where one shard belongs */
+typedef struct
+{
+    uint64_t set_id;    // Random, shared by the shards of one payload
+    int index;          // 0 .. count - 1, in payload order
+    int count;          // Shards in the set
+    long offset;        // Offset of the shard in the payload
+    long length;        // Bytes of the shard (the frame's file size)
+    long total_size;    // Bytes of the whole payload
+} ShardInfo;
+
+/* Options applied to every shard */
+typedef struct
+{
+    int num_workers;    // Worker threads (<= 0: one per online CPU)
+    int use_mmap;       // Use the mmap backend for every shard
+    int depth;          // Embedding depth (bits per image byte, 0 means 1)
+    int use_index;      // Store a chunk index with every shard
+    int compress;       // Compress every shard
+    int use_aio;        // Pipeline the secret data of every shard (see aio.h)
+    MessageCallback report; // Told each shard's status, the summary and why a set is rejected (optional, see report.h)
+    void *report_arg;
+} ShardOptions;
+
+/* Serialize a shard header into SHARD_HEADER_SIZE bytes */
+void shard_header_store(const ShardInfo *shard, unsigned char *out);
+
+/*
+ * Parse a shard header read from a frame whose file size is length.
+ * Fails unless the shard lies inside the payload it describes.
+*/
+Status shard_header_load(ShardInfo *shard, const unsigned char *in, long length);
+
+/* Whether two headers describe the same shard */
+int shard_same(const ShardInfo *a, const ShardInfo *b);
+
+/*
+ * Split secret_fname across the count covers and write shard i to
+ * "<stego_prefix>_<i>.bmp".
+*/
+Status do_shard_encode(const char *secret_fname, const char *stego_prefix, char **covers, int count, const ShardOptions *options);
+
+/* Reassemble the payload carried by the count shard images into output_fname */
+Status do_shard_join(const char *output_fname, char **images, int count, const ShardOptions *options);
+
+#endif
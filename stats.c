@@ -0,0 +1,157 @@
+/*
+ * Per-Stage Statistics
+ *
+ * Description:
+ * Each sample reads the process-wide counters: CLOCK_MONOTONIC for wall
+ * time, getrusage() for CPU time and page faults, and /proc/self/io for the
+ * bytes and system calls of all reads and writes. The difference between
+ * two samples is charged to the stage that just finished.
+ *
+ * Reading /proc/self/io is itself a read, which shows up in the next sample.
+ * The recorder keeps count of those reads and subtracts them, so only the
+ * stages' own I/O is reported.
+*/
+
+#ifdef STEGO_STATS
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "stats.h"
+#include "stego.h"
+
+/* Value of one "name: value" line of /proc/self/io */
+static unsigned long long io_field(const char *text, const char *name)
+{
+    const char *line = strstr(text, name);
+    return line != NULL ? strtoull(line + strlen(name), NULL, 10) : 0;
+}
+
+/* Take an absolute sample of every counter */
+static void take_sample(StatsRecorder *rec, StageStats *sample)
+{
+    struct timespec now;
+    struct rusage usage;
+
+    memset(sample, 0, sizeof(*sample));
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sample->wall_seconds = now.tv_sec + now.tv_nsec / 1e9;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        sample->cpu_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                              usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+        sample->page_faults = usage.ru_minflt + usage.ru_majflt;
+    }
+
+    char text[512];
+    ssize_t got = rec->io_fd >= 0 ? pread(rec->io_fd, text, sizeof(text) - 1, 0) : -1;
+    if (got <= 0)
+        return;
+    text[got] = '\0';
+
+    // This read is accounted after it returns, so only the earlier ones are in the text
+    sample->bytes_read = io_field(text, "rchar:") - rec->own_bytes;
+    sample->bytes_written = io_field(text, "wchar:");
+    sample->read_calls = io_field(text, "syscr:") - rec->own_calls;
+    sample->write_calls = io_field(text, "syscw:");
+    rec->own_bytes += got;
+    rec->own_calls++;
+}
+
+/* Start recording */
+void stats_start(StatsRecorder *rec)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->io_fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+    take_sample(rec, &rec->last);
+}
+
+/* Charge everything since the previous boundary to stage */
+void stats_stage_done(StatsRecorder *rec, Stage stage)
+{
+    StageStats now;
+    StageStats *st = &rec->stages[stage];
+
+    take_sample(rec, &now);
+    st->ran = 1;
+    st->wall_seconds += now.wall_seconds - rec->last.wall_seconds;
+    st->cpu_seconds += now.cpu_seconds - rec->last.cpu_seconds;
+    st->bytes_read += now.bytes_read - rec->last.bytes_read;
+    st->bytes_written += now.bytes_written - rec->last.bytes_written;
+    st->read_calls += now.read_calls - rec->last.read_calls;
+    st->write_calls += now.write_calls - rec->last.write_calls;
+    st->page_faults += now.page_faults - rec->last.page_faults;
+    rec->last = now;
+}
+
+/* Drop everything since the previous boundary */
+void stats_resume(StatsRecorder *rec)
+{
+    take_sample(rec, &rec->last);
+}
+
+/* Print one row of counters */
+static void print_row(const StageStats *st, const char *operation, const char *name, StatsFormat format, FILE *out, int first)
+{
+    if (format == e_stats_csv)
+    {
+        fprintf(out, "%s,%s,%.3f,%.3f,%llu,%llu,%llu,%llu,%llu\n", operation, name,
+                st->wall_seconds * 1e3, st->cpu_seconds * 1e3, st->bytes_read, st->bytes_written,
+                st->read_calls, st->write_calls, st->page_faults);
+        return;
+    }
+    fprintf(out, "%s    {\"stage\": \"%s\", \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"bytes_read\": %llu, "
+            "\"bytes_written\": %llu, \"read_calls\": %llu, \"write_calls\": %llu, \"page_faults\": %llu}",
+            first ? "" : ",\n", name, st->wall_seconds * 1e3, st->cpu_seconds * 1e3, st->bytes_read,
+            st->bytes_written, st->read_calls, st->write_calls, st->page_faults);
+}
+
+/* Print the stages that ran and their total */
+void stats_print(const StatsRecorder *rec, const char *operation, StatsFormat format, FILE *out)
+{
+    StageStats total = { 0 };
+    int first = 1;
+
+    if (format == e_stats_csv)
+        fprintf(out, "operation,stage,wall_ms,cpu_ms,bytes_read,bytes_written,read_calls,write_calls,page_faults\n");
+    else
+        fprintf(out, "{\n  \"operation\": \"%s\",\n  \"stages\": [\n", operation);
+
+    for (int i = 0; i < e_stage_count; i++)
+    {
+        const StageStats *st = &rec->stages[i];
+        if (!st->ran)
+            continue;
+        print_row(st, operation, stage_name(i), format, out, first);
+        first = 0;
+        total.wall_seconds += st->wall_seconds;
+        total.cpu_seconds += st->cpu_seconds;
+        total.bytes_read += st->bytes_read;
+        total.bytes_written += st->bytes_written;
+        total.read_calls += st->read_calls;
+        total.write_calls += st->write_calls;
+        total.page_faults += st->page_faults;
+    }
+
+    if (format == e_stats_csv)
+    {
+        print_row(&total, operation, "total", format, out, 1);
+        return;
+    }
+    fprintf(out, "\n  ],\n  \"total\":\n");
+    print_row(&total, operation, "total", format, out, 1);
+    fprintf(out, "\n}\n");
+}
+
+/* Stop recording */
+void stats_stop(StatsRecorder *rec)
+{
+    if (rec->io_fd >= 0)
+        close(rec->io_fd);
+    rec->io_fd = -1;
+}
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * Header file for per-stage statistics
+ *
+ * Description:
+ * Records, for every stage of an encoding or decoding, the wall-clock and
+ * CPU time, the bytes read and written, the read/write system calls and the
+ * page faults (which is where the mmap backend does its I/O). Counters are
+ * process-wide (getrusage() and /proc/self/io), so strip worker threads are
+ * included. They are sampled at stage boundaries only, typically from the
+ * progress callback, so the stages themselves run unchanged.
+ *
+ * Built with STEGO_STATS (the default in the Makefile; "make STATS=0"
+ * turns it off) the functions below are real. Without it they are empty
+ * inline functions and STATS_ENABLED is 0, so the layer compiles to nothing.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "types.h"
+
+/* Output formats of stats_print() */
+typedef enum
+{
+    e_stats_json,
+    e_stats_csv
+} StatsFormat;
+
+/* Counters of one stage (or absolute counters at one sample) */
+typedef struct
+{
+    int ran;                            // The stage was charged at least once
+    double wall_seconds;
+    double cpu_seconds;                 // User and system time of all threads
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+    unsigned long long read_calls;      // read()/pread() and friends
+    unsigned long long write_calls;
+    unsigned long long page_faults;     // Minor and major
+} StageStats;
+
+/* Counters of one operation */
+typedef struct
+{
+    StageStats stages[e_stage_count];
+    StageStats last;                    // Sample taken at the previous boundary
+    int io_fd;                          // /proc/self/io, kept open between samples (-1 if unavailable)
+    unsigned long long own_bytes;       // Bytes the samples themselves read from /proc/self/io
+    unsigned long long own_calls;       // Reads the samples themselves issued
+} StatsRecorder;
+
+#ifdef STEGO_STATS
+
+#define STATS_ENABLED 1
+
+/* Start recording: the next stage is charged from now on */
+void stats_start(StatsRecorder *rec);
+
+/* Charge everything since the previous boundary to stage */
+void stats_stage_done(StatsRecorder *rec, Stage stage);
+
+/* Drop everything since the previous boundary (work outside any stage, e.g. printing) */
+void stats_resume(StatsRecorder *rec);
+
+/* Print the stages that ran and their total, labelled with operation */
+void stats_print(const StatsRecorder *rec, const char *operation, StatsFormat format, FILE *out);
+
+/* Stop recording and release /proc/self/io */
+void stats_stop(StatsRecorder *rec);
+
+#else
+
+#define STATS_ENABLED 0
+
+static inline void stats_start(StatsRecorder *rec) { (void)rec; }
+static inline void stats_stage_done(StatsRecorder *rec, Stage stage) { (void)rec; (void)stage; }
+static inline void stats_resume(StatsRecorder *rec) { (void)rec; }
+static inline void stats_print(const StatsRecorder *rec, const char *operation, StatsFormat format, FILE *out)
+{
+    (void)rec; (void)operation; (void)format; (void)out;
+}
+static inline void stats_stop(StatsRecorder *rec) { (void)rec; }
+
+#endif
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * libstego Buffer API
+ *
+ * Description:
+ * Implements the buffer-to-buffer interface on top of the same stage
+ * functions the file-based encoder and decoder use. The caller's image is
+ * presented as an already mapped cover/stego pair (in place) and the payload
+ * as an in-memory secret, so encode_frame()/decode_frame() run unchanged and
+ * no block buffers are needed unless the image's cover bytes have to be
+ * gathered (padded rows, 32-bit pixels). The failed stage is translated into
+ * an error code; nothing is printed.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include "stego.h"
+#include "lsb.h"
+#include "bmp.h"
+
+/* Check the minimal BMP signature and header size */
+static int is_bmp_image(const unsigned char *image, size_t image_len)
+{
+    return image != NULL && image_len >= BMP_HEADER_SIZE && image[0] == 'B' && image[1] == 'M';
+}
+
+/*
+ * The stages fail without saying why. Failed allocations and system calls
+ * leave errno set, so a failure with errno set since the call started is
+ * reported as such rather than held against the image.
+*/
+static StegoError system_error(void)
+{
+    if (errno == ENOMEM)
+        return e_stego_no_memory;
+    return errno != 0 ? e_stego_io : e_stego_ok;
+}
+
+/* Embed a payload into a caller-owned BMP image */
+StegoError stego_encode_buffer(unsigned char *image, size_t image_len,
+                               const unsigned char *payload, size_t payload_len, const char *extn,
+                               const StegoParams *params)
+{
+    EncodeInfo encInfo = { 0 };
+
+    if (extn == NULL || strlen(extn) > MAX_FILE_SUFFIX || (payload == NULL && payload_len > 0) || payload_len > LONG_MAX)
+        return e_stego_invalid_args;
+    if (params != NULL && (params->depth < 0 || params->depth > LSB_MAX_DEPTH))
+        return e_stego_invalid_args;
+    if (!is_bmp_image(image, image_len))
+        return e_stego_bad_image;
+
+    strcpy(encInfo.extn_secret_file, extn);
+    encInfo.secret_mem = payload != NULL ? payload : (const unsigned char *)"";
+    encInfo.size_secret_file = payload_len;
+    encInfo.src_map = encInfo.stego_map = image;
+    encInfo.map_size = image_len;
+    encInfo.num_threads = 1;
+    encInfo.depth = params != NULL ? params->depth : 0;
+    encInfo.use_index = params != NULL ? params->use_index : 0;
+    encInfo.compress = params != NULL ? params->compress : 0;
+    encInfo.use_checksum = params != NULL ? params->use_checksum : 0;
+
+    errno = 0;
+    Status status = encode_frame(&encInfo);
+    StegoError error = status == e_success ? e_stego_ok : system_error();
+    release_encode_info(&encInfo);
+    if (status == e_success)
+        return e_stego_ok;
+    if (error != e_stego_ok)
+        return error;
+    return encInfo.stage == e_stage_capacity ? e_stego_no_capacity : e_stego_bad_image;
+}
+
+/* Extract the payload of a caller-owned BMP image */
+StegoError stego_decode_buffer(const unsigned char *image, size_t image_len,
+                               unsigned char *out, size_t out_cap, size_t *payload_len, char *extn)
+{
+    DecodeInfo decInfo = { 0 };
+
+    if (payload_len == NULL || (out == NULL && out_cap > 0))
+        return e_stego_invalid_args;
+    if (!is_bmp_image(image, image_len))
+        return e_stego_bad_image;
+
+    decInfo.d_src_map = (unsigned char *)image;
+    decInfo.d_map_size = image_len;
+    decInfo.d_out_mem = out != NULL ? out : (unsigned char *)"";
+    decInfo.d_out_cap = out_cap;
+    decInfo.num_threads = 1;
+
+    errno = 0;
+    Status status = decode_frame(&decInfo);
+    StegoError error = status == e_success ? e_stego_ok : system_error();
+    release_decode_info(&decInfo);
+    *payload_len = decInfo.size_secret_file > 0 ? (size_t)decInfo.size_secret_file : 0;
+    if (extn != NULL && decInfo.stage > e_stage_extn)
+        strcpy(extn, decInfo.d_extn_secret_file);
+
+    if (status == e_success)
+        return e_stego_ok;
+    if (error != e_stego_ok)
+        return error;
+    if (decInfo.stage == e_stage_magic)
+        return e_stego_no_payload;
+    if (decInfo.stage == e_stage_data && *payload_len > out_cap)
+        return e_stego_short_buffer;
+    return e_stego_corrupt;
+}
+
+/* Extract a byte range of the payload of a caller-owned BMP image */
+StegoError stego_decode_range(const unsigned char *image, size_t image_len, size_t offset, size_t length,
+                              unsigned char *out, size_t out_cap)
+{
+    DecodeInfo decInfo = { 0 };
+
+    if (out == NULL && out_cap > 0)
+        return e_stego_invalid_args;
+    if (length > out_cap)
+        return e_stego_short_buffer;
+    if (!is_bmp_image(image, image_len))
+        return e_stego_bad_image;
+
+    decInfo.d_src_map = (unsigned char *)image;
+    decInfo.d_map_size = image_len;
+    decInfo.d_out_mem = out != NULL ? out : (unsigned char *)"";
+    decInfo.d_out_cap = out_cap;
+    decInfo.num_threads = 1;
+    decInfo.use_range = 1;
+    decInfo.range_offset = offset;
+    decInfo.range_length = length;
+
+    errno = 0;
+    Status status = decode_frame(&decInfo);
+    StegoError error = status == e_success ? e_stego_ok : system_error();
+    release_decode_info(&decInfo);
+    if (status == e_success)
+        return e_stego_ok;
+    if (error != e_stego_ok)
+        return error;
+    if (decInfo.stage == e_stage_magic)
+        return e_stego_no_payload;
+    if (decInfo.stage == e_stage_data && offset + length > (size_t)decInfo.size_secret_file)
+        return e_stego_invalid_args;
+    return e_stego_corrupt;
+}
+
+/* Human-readable description of an error code */
+const char *stego_strerror(StegoError error)
+{
+    static const char *messages[] =
+    {
+        "Success",
+        "Invalid arguments",
+        "Not a BMP image or image truncated",
+        "Payload does not fit into the image",
+        "Image carries no hidden payload",
+        "Hidden payload is corrupt or truncated",
+        "Output buffer too small",
+        "Out of memory",
+        "I/O error"
+    };
+    if ((unsigned)error < sizeof(messages) / sizeof(messages[0]))
+        return messages[error];
+    return "Unknown error";
+}
+
+/* Short machine-readable name of a stage */
+const char *stage_name(Stage stage)
+{
+    static const char *names[e_stage_count] =
+    {
+        "open", "capacity", "header", "magic", "extn_size", "extn", "size", "index", "directory", "data", "tail"
+    };
+    return (unsigned)stage < e_stage_count ? names[stage] : "unknown";
+}
@@ -0,0 +1,101 @@
+/*
+ * libstego Public Header
+ *
+ * Description:
+ * Single header for applications linking libstego (libstego.a / libstego.so).
+ * It exposes two interfaces:
+ * - The file-based API from encode.h, decode.h, batch.h, shard.h and
+ *   probe.h (do_encoding(), do_decoding(), do_batch(), do_shard_encode(),
+ *   do_shard_join(), do_probe()), which never prints. Encoding and decoding
+ *   report progress through the optional StageCallback in
+ *   EncodeInfo/DecodeInfo; the multi-job modes report each job and their
+ *   summary through an optional MessageCallback (see report.h).
+ * - A buffer-to-buffer API that embeds a payload into a BMP image held in
+ *   caller-owned memory and extracts it into a caller-owned buffer, without
+ *   touching the disk. Which calls allocate on the heap is listed below.
+ * The client side of daemon mode (serve_connect(), serve_call() in serve.h)
+ * is exported as well. Callers that encode into the same covers again and
+ * again can share a CoverCache (covercache.h) through EncodeInfo.cover_cache.
+*/
+
+#ifndef STEGO_H
+#define STEGO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h"
+#include "common.h"
+#include "encode.h"
+#include "decode.h"
+#include "batch.h"
+#include "probe.h"
+#include "serve.h"
+#include "shard.h"
+
+/* Error codes of the buffer API */
+typedef enum
+{
+    e_stego_ok,             // Operation succeeded
+    e_stego_invalid_args,   // NULL pointer, extension longer than MAX_FILE_SUFFIX, bad depth or range
+    e_stego_bad_image,      // Not a BMP image, or shorter than its header says
+    e_stego_no_capacity,    // Payload does not fit into the image
+    e_stego_no_payload,     // Image carries no magic string
+    e_stego_corrupt,        // Header fields are inconsistent with the image, or a checksum failed
+    e_stego_short_buffer,   // Output buffer too small (required size is reported)
+    e_stego_no_memory,      // A working buffer could not be allocated
+    e_stego_io              // A system call failed
+} StegoError;
+
+/* Encoding parameters of the buffer API (NULL selects the defaults) */
+typedef struct
+{
+    int depth;              // Bits per image byte, 1 to 4 (0 means 1: the original format)
+    int use_index;          // Store a chunk index for verified partial extraction
+    int compress;           // Compress the payload (not together with use_index)
+    int use_checksum;       // Store a CRC32C of the payload, verified by full decodes
+} StegoParams;
+
+/*
+ * Heap use: stego_encode_buffer() and stego_decode_buffer() allocate nothing
+ * for a 24-bit image whose rows need no padding and a payload with neither a
+ * chunk index nor compression. Otherwise they allocate, and free again
+ * before returning:
+ * - up to about 2.5 MiB of block buffers for padded rows and 32-bit pixels;
+ * - the chunk index (use_index, or decoding an indexed payload);
+ * - a 128 KiB block buffer (compress, or decoding a compressed payload);
+ * - the member directory when decoding an archive.
+ * stego_decode_range() always allocates one buffer of at most
+ * MAX_SECRET_BUF_SIZE bytes. A failed allocation returns e_stego_no_memory.
+*/
+
+/*
+ * Embed payload into the BMP image (header + pixels) held in image, in place.
+ * extn is the extension recorded with the payload ("" or e.g. ".txt").
+*/
+StegoError stego_encode_buffer(unsigned char *image, size_t image_len,
+                               const unsigned char *payload, size_t payload_len, const char *extn,
+                               const StegoParams *params);
+
+/*
+ * Extract the payload of the BMP image in image into out.
+ * *payload_len receives the payload size, also when out is too small.
+ * extn (optional, MAX_FILE_SUFFIX + 1 bytes) receives the recorded extension.
+*/
+StegoError stego_decode_buffer(const unsigned char *image, size_t image_len,
+                               unsigned char *out, size_t out_cap, size_t *payload_len, char *extn);
+
+/*
+ * Extract only payload bytes [offset, offset + length) into out.
+ * Only the image bytes holding the range are decoded; with a chunk index the
+ * chunks it touches are verified as well.
+*/
+StegoError stego_decode_range(const unsigned char *image, size_t image_len, size_t offset, size_t length,
+                              unsigned char *out, size_t out_cap);
+
+/* Human-readable description of an error code */
+const char *stego_strerror(StegoError error);
+
+/* Short machine-readable name of a stage ("open", "capacity", ...) */
+const char *stage_name(Stage stage);
+
+#endif
@@ -9,8 +9,33 @@
  * - Decoding a secret file from a BMP image (retrieving the hidden data from the image).
  * 
  * The operations are controlled by command-line options:
- * - Encoding: ./a.out -e source_image.bmp secret_file.txt stego_image.bmp
- * - Decoding: ./a.out -d stego_image.bmp decoded_file.txt
+ * - Encoding: ./a.out -e source_image.bmp secret_file.txt stego_image.bmp [--depth K] [--mmap]
+ * - Decoding: ./a.out -d stego_image.bmp decoded_file.txt [--range OFF:LEN] [--mmap]
+ * - Batch:    ./a.out -b manifest.txt [--threads N] [--mmap] [--cover-cache MB]
+ * - Archive:  ./a.out -a source_image.bmp stego_image.bmp file... [--depth K] [--index]
+ * - List:     ./a.out -l stego_image.bmp
+ * - Extract:  ./a.out -x stego_image.bmp member [output_file]
+ * - Probe:    ./a.out -p image_or_directory... [--threads N]
+ * - Shard:    ./a.out -s secret_file stego_prefix source_image.bmp... [--threads N] [--depth K]
+ * - Join:     ./a.out -j output_file shard_image.bmp... [--threads N]
+ * - Daemon:   ./a.out --serve socket_path [--threads N] [--mmap] [--aio] [--cover-cache MB]
+ *
+ * Options starting with "--" may appear anywhere after the operation:
+ * - --mmap: memory-map the images instead of using stdio streams.
+ * - --threads N: embed/extract the secret data with N strip workers
+ *   (in batch, shard and join modes: run N jobs or shards at a time,
+ *   default one per CPU).
+ * - --aio: overlap the secret data's reads, embedding/extraction and writes
+ *   (io_uring, or I/O threads where it is unavailable) on the stdio backend.
+ * - --cover-cache MB: keep up to MB megabytes of covers parsed and mapped
+ *   between the encode jobs of a batch or daemon.
+ * - --depth K: embed K bits (1-4) per image byte; the decoder reads K from the image.
+ * - --index: store a chunk index (offset, length, CRC32C per chunk) with the payload.
+ * - --compress: compress the payload in blocks before embedding it.
+ * - --checksum: store a CRC32C of the payload; the decoder verifies it.
+ * - --stats json|csv: print per-stage timings and I/O counters to stderr
+ *   (encoding, decoding, archiving, listing and extraction only).
+ * - --range OFF:LEN: decode only LEN payload bytes starting at byte OFF.
  *
  * The program will validate the arguments and proceed with the appropriate operation 
  * (encoding or decoding). If the arguments are invalid or insufficient, the program
@@ -18,22 +43,437 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include "common.h"
-#include "encode.h"
-#include "types.h"
-#include "decode.h"
+#include <time.h>
+#include <sys/stat.h>
+#include "stego.h"
+#include "lsb.h"
+#include "stats.h"
+
+/* Command-line options shared by encoding and decoding */
+typedef struct
+{
+    int use_mmap;    // --mmap
+    int num_threads; // --threads N
+    int use_aio;     // --aio
+    const char *serve_path; // --serve PATH
+    long cover_cache_mb; // --cover-cache MB
+    int depth;       // --depth K
+    int use_index;   // --index
+    int compress;    // --compress
+    int use_checksum; // --checksum
+    int stats;       // --stats FORMAT
+    StatsFormat stats_format;
+    int use_range;   // --range OFF:LEN
+    long range_offset;
+    long range_length;
+} Options;
+
+/* Progress messages per stage; NULL where an operation has no such stage */
+static const char *encode_messages[e_stage_count] =
+{
+    "Opening of File",
+    "Capacity Check",
+    "Header Copy",
+    "Encoding of Magic String",
+    "Encoding of Secret File Extension Size",
+    "Encoding of Secret File Extension",
+    "Encoding of Secret File Size",
+    "Encoding of Chunk Index",
+    "Encoding of Archive Directory",
+    "Encoding of Secret File Data",
+    "Remaining Image Data Copy"
+};
+
+static const char *decode_messages[e_stage_count] =
+{
+    "Opening of File",
+    NULL,
+    NULL,
+    "Decoding of Magic String",
+    "Decoding of Secret File Extension Size",
+    "Decoding of Secret File Extension",
+    "Decoding of Secret File Size",
+    "Decoding of Chunk Index",
+    "Decoding of Archive Directory",
+    "Decoding of Secret File Data",
+    NULL
+};
+
+/* Per-stage statistics of the running operation (--stats) */
+static StatsRecorder stats_recorder;
+static int stats_on;
+
+/* Start recording statistics once pending output is written */
+static void start_stats(const Options *opts)
+{
+    if (!opts->stats)
+        return;
+    fflush(stdout);
+    stats_on = 1;
+    stats_start(&stats_recorder);
+}
+
+/* Charge the rest of a failed operation to the failed stage and print the statistics */
+static void finish_stats(const Options *opts, const char *operation, Status status, Stage stage)
+{
+    if (!stats_on)
+        return;
+    if (status != e_success)
+        stats_stage_done(&stats_recorder, stage);
+    stats_stop(&stats_recorder);
+    stats_on = 0;
+    fflush(stdout);
+    stats_print(&stats_recorder, operation, opts->stats_format, stderr);
+}
+
+/* Print the outcome of one encoding stage */
+static void report_encode_stage(Stage stage, void *arg)
+{
+    EncodeInfo *encInfo = arg;
+
+    // Close the stage's statistics before printing, and leave the printing out of the next one
+    if (stats_on)
+        stats_stage_done(&stats_recorder, stage);
+
+    if (stage == e_stage_capacity)
+    {
+        printf("Width = %u\n", encInfo->image_width);
+        printf("Height = %u\n", encInfo->image_height);
+    }
+    if (stage == e_stage_tail && encInfo->tail_cloned)
+        printf("Remaining Image Data Shared With Cover (reflink)...\n");
+    else
+        printf("%s Successful...\n", encode_messages[stage]);
+    if (stats_on)
+    {
+        fflush(stdout);
+        stats_resume(&stats_recorder);
+    }
+}
+
+/* Print the outcome of one decoding stage */
+static void report_decode_stage(Stage stage, void *arg)
+{
+    (void)arg;
+    if (stats_on)
+        stats_stage_done(&stats_recorder, stage);
+    if (decode_messages[stage] != NULL)
+        printf("%s Successful...\n", decode_messages[stage]);
+    if (stats_on)
+    {
+        fflush(stdout);
+        stats_resume(&stats_recorder);
+    }
+}
+
+/* Charge a listing stage to the statistics; listing prints no per-stage lines */
+static void record_list_stage(Stage stage, void *arg)
+{
+    (void)arg;
+    if (stats_on)
+        stats_stage_done(&stats_recorder, stage);
+}
+
+/* Print a line reported by a batch, probe, shard or daemon run; failures of the run go to stderr */
+static void print_message(int error, const char *message, void *arg)
+{
+    (void)arg;
+    fprintf(error ? stderr : stdout, "%s\n", message);
+}
+
+/* Print the members of a decoded archive directory */
+static void print_archive_directory(const ArchiveDir *dir)
+{
+    printf("%10s  %8s  %s\n", "Size", "CRC32C", "Name");
+    for (int i = 0; i < dir->count; i++)
+        printf("%10u  %08x  %s\n", dir->entries[i].size, dir->entries[i].crc, dir->entries[i].name);
+    printf("%d Member(s)\n", dir->count);
+}
+
+/* Seconds elapsed since start */
+static double elapsed_seconds(const struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Report encoding throughput over the whole stego image in MB/s */
+static void print_encode_throughput(double seconds, const char *stego_fname)
+{
+    struct stat st;
+    if (stat(stego_fname, &st) != 0)
+        return;
+    long bytes = st.st_size;
+
+    if (seconds > 0 && bytes > 0)
+        printf("Encoding Throughput: %.2f MB/s (%ld bytes in %.3f s)\n", bytes / seconds / (1024.0 * 1024.0), bytes, seconds);
+}
+
+/*
+ * Remove "--" options from argv, leaving the positional arguments in order.
+ * Returns the new argument count, or -1 on an unknown option.
+*/
+static int extract_options(int argc, char *argv[], Options *opts)
+{
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--", 2) != 0)
+        {
+            argv[kept++] = argv[i];
+        }
+        else if (strcmp(argv[i], "--mmap") == 0)
+        {
+            opts->use_mmap = 1;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            opts->num_threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--aio") == 0)
+        {
+            opts->use_aio = 1;
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+        {
+            opts->serve_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cover-cache") == 0 && i + 1 < argc)
+        {
+            opts->cover_cache_mb = atol(argv[++i]);
+            if (opts->cover_cache_mb < 0)
+            {
+                printf("Error: Cover Cache Size Must Be MB\n");
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--index") == 0)
+        {
+            opts->use_index = 1;
+        }
+        else if (strcmp(argv[i], "--compress") == 0)
+        {
+            opts->compress = 1;
+        }
+        else if (strcmp(argv[i], "--checksum") == 0)
+        {
+            opts->use_checksum = 1;
+        }
+        else if (strcmp(argv[i], "--range") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%ld:%ld", &opts->range_offset, &opts->range_length) != 2 ||
+                opts->range_offset < 0 || opts->range_length < 0)
+            {
+                printf("Error: Range Must Be OFF:LEN\n");
+                return -1;
+            }
+            opts->use_range = 1;
+        }
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+        {
+            const char *format = argv[++i];
+            if (!STATS_ENABLED)
+            {
+                printf("Error: Built Without Statistics Support (make STATS=1)\n");
+                return -1;
+            }
+            if (strcmp(format, "json") != 0 && strcmp(format, "csv") != 0)
+            {
+                printf("Error: Statistics Format Must Be json or csv\n");
+                return -1;
+            }
+            opts->stats = 1;
+            opts->stats_format = strcmp(format, "csv") == 0 ? e_stats_csv : e_stats_json;
+        }
+        else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+        {
+            opts->depth = atoi(argv[++i]);
+            if (opts->depth < 1 || opts->depth > LSB_MAX_DEPTH)
+            {
+                printf("Error: Depth Must Be 1 to %d\n", LSB_MAX_DEPTH);
+                return -1;
+            }
+        }
+        else
+        {
+            printf("Error: Unknown Option %s\n", argv[i]);
+            return -1;
+        }
+    }
+    argv[kept] = NULL;
+    return kept;
+}
 
 int main(int argc, char *argv[])
 {
+    Options opts = { 0 };
+    argc = extract_options(argc, argv, &opts);
+    if (argc < 0)
+    {
+        return e_failure;
+    }
+    if (opts.compress && opts.use_index)
+    {
+        printf("Error: --compress Cannot Be Combined With --index\n");
+        return e_failure;
+    }
+
+    // Batch, probe, shard, join and daemon runs are many operations, not one set of stages
+    if (opts.stats && (opts.serve_path != NULL ||
+                       (argc >= 2 && (check_operation_type(argv) == e_batch || check_operation_type(argv) == e_probe ||
+                                      check_operation_type(argv) == e_shard || check_operation_type(argv) == e_join))))
+    {
+        printf("Error: --stats Only Applies To Encoding, Decoding, Archiving, Listing and Extraction\n");
+        return e_failure;
+    }
+
+    // Daemon mode takes its jobs from the socket
+    if (opts.serve_path != NULL)
+    {
+        ServeOptions serve = { opts.num_threads, opts.use_mmap, opts.use_aio, (size_t)opts.cover_cache_mb << 20, print_message, NULL };
+        // Clients wait for the ready line, so it must not sit in a buffer
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        return do_serve(opts.serve_path, &serve) == e_success ? 0 : e_failure;
+    }
+
+    // Batch mode only needs the manifest
+    if(argc >= 3 && check_operation_type(argv) == e_batch)
+    {
+        BatchOptions batch = { opts.num_threads, opts.use_mmap, opts.depth, opts.use_index, opts.compress, opts.use_checksum, opts.use_aio,
+                               (size_t)opts.cover_cache_mb << 20, print_message, NULL };
+        return do_batch(argv[2], &batch) == e_success ? 0 : e_failure;
+    }
+
+    // Probing takes any number of files and directories
+    if(argc >= 3 && check_operation_type(argv) == e_probe)
+    {
+        return do_probe(argv + 2, argc - 2, opts.num_threads, print_message, NULL) == e_success ? 0 : e_failure;
+    }
+
+    // Sharding splits one secret across any number of covers
+    if(argc >= 5 && check_operation_type(argv) == e_shard)
+    {
+        ShardOptions shard = { opts.num_threads, opts.use_mmap, opts.depth, opts.use_index, opts.compress, opts.use_aio, print_message, NULL };
+        return do_shard_encode(argv[2], argv[3], argv + 4, argc - 4, &shard) == e_success ? 0 : e_failure;
+    }
+
+    // Joining takes the shard images in any order
+    if(argc >= 4 && check_operation_type(argv) == e_join)
+    {
+        ShardOptions shard = { opts.num_threads, opts.use_mmap, 0, 0, 0, opts.use_aio, print_message, NULL };
+        return do_shard_join(argv[2], argv + 3, argc - 3, &shard) == e_success ? 0 : e_failure;
+    }
+
+    // Listing only needs the stego image
+    if(argc >= 3 && check_operation_type(argv) == e_list)
+    {
+        static DecodeInfo decInfo;
+        decInfo.use_mmap = opts.use_mmap;
+        decInfo.list_only = 1;
+        decInfo.progress = record_list_stage;
+        decInfo.d_src_image_fname = argv[2];
+
+        start_stats(&opts);
+        Status status = do_decoding(&decInfo);
+        finish_stats(&opts, "list", status, decInfo.stage);
+        if(status == e_success)
+        {
+            print_archive_directory(&decInfo.d_archive);
+        }
+        else
+        {
+            printf("%s Failed...\n", decode_messages[decInfo.stage]);
+            printf("Listing Failed\n");
+        }
+        release_decode_info(&decInfo);
+        return status == e_success ? 0 : e_failure;
+    }
+
     // Check if sufficient arguments are passed
     if(argc >= 4)
     {
         // Determine the operation type (encoding or decoding)
-        if (check_operation_type(argv) == e_encode)
+        if (check_operation_type(argv) == e_archive)
+        {
+            printf("Selected Archiving\n");
+            if (opts.compress)
+            {
+                printf("Error: Archives Cannot Be Compressed\n");
+                return e_failure;
+            }
+            static EncodeInfo encInfo;
+            static ArchiveDir archive;
+            encInfo.use_mmap = opts.use_mmap;
+            encInfo.use_aio = opts.use_aio;
+            encInfo.depth = opts.depth;
+            encInfo.use_index = opts.use_index;
+            encInfo.use_checksum = opts.use_checksum;
+            encInfo.progress = report_encode_stage;
+            encInfo.progress_arg = &encInfo;
+            encInfo.src_image_fname = argv[2];
+            encInfo.stego_image_fname = argv[3];
+            encInfo.archive = &archive;
+
+            if(archive_dir_build(&archive, argv + 4, argc - 4, opts.depth > 0 ? opts.depth : 1) != e_success)
+            {
+                printf("Error: Archive Members Must Be Readable Files With Distinct Names\n");
+                return e_failure;
+            }
+
+            printf("Encoding Started...\n");
+            start_stats(&opts);
+            Status status = do_encoding(&encInfo);
+            finish_stats(&opts, "archive", status, encInfo.stage);
+            release_encode_info(&encInfo);
+            archive_dir_free(&archive);
+
+            if(status != e_success)
+            {
+                printf("%s Failed...\n", encode_messages[encInfo.stage]);
+                printf("Archiving Failed\n");
+                return e_failure;
+            }
+            printf("Archiving Successful\n");
+        }
+        else if (check_operation_type(argv) == e_extract)
+        {
+            printf("Selected Extraction\n");
+            static DecodeInfo decInfo;
+            decInfo.use_mmap = opts.use_mmap;
+            decInfo.progress = report_decode_stage;
+            decInfo.d_src_image_fname = argv[2];
+            decInfo.d_member = argv[3];
+            decInfo.d_secret_fname = argc >= 5 ? argv[4] : argv[3];
+
+            start_stats(&opts);
+            Status status = do_decoding(&decInfo);
+            finish_stats(&opts, "extract", status, decInfo.stage);
+            release_decode_info(&decInfo);
+
+            if(status != e_success)
+            {
+                printf("%s Failed...\n", decode_messages[decInfo.stage]);
+                printf("Extraction Failed\n");
+                return e_failure;
+            }
+            printf("Extraction Successful\n");
+        }
+        else if (check_operation_type(argv) == e_encode)
         {
             printf("Selected Encoding\n");
-            EncodeInfo encInfo;
+            static EncodeInfo encInfo;
+            encInfo.use_mmap = opts.use_mmap;
+            encInfo.num_threads = opts.num_threads;
+            encInfo.use_aio = opts.use_aio;
+            encInfo.depth = opts.depth;
+            encInfo.use_index = opts.use_index;
+            encInfo.compress = opts.compress;
+            encInfo.use_checksum = opts.use_checksum;
+            encInfo.progress = report_encode_stage;
+            encInfo.progress_arg = &encInfo;
 
             // Validate encoding arguments
             if(read_and_validate_encode_args(argv, &encInfo) == e_success)
@@ -41,12 +481,23 @@ int main(int argc, char *argv[])
                 printf("Successful Reading and Validating\n");
 
                 // Perform the encoding process
-                if(do_encoding(&encInfo) == e_success)
+                printf("Encoding Started...\n");
+                struct timespec start;
+                start_stats(&opts);
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                Status status = do_encoding(&encInfo);
+                double seconds = elapsed_seconds(&start);
+                finish_stats(&opts, "encode", status, encInfo.stage);
+                release_encode_info(&encInfo);
+
+                if(status == e_success)
                 {
+                    print_encode_throughput(seconds, encInfo.stego_image_fname);
                     printf("Encoding Successful\n");
                 }
                 else
                 {
+                    printf("%s Failed...\n", encode_messages[encInfo.stage]);
                     printf("Encoding Failed\n");
                     return e_failure;
                 }
@@ -60,7 +511,14 @@ int main(int argc, char *argv[])
         else if(check_operation_type(argv) == e_decode)
         {
             printf("Selected Decoding\n");
-            DecodeInfo decInfo;
+            static DecodeInfo decInfo;
+            decInfo.use_mmap = opts.use_mmap;
+            decInfo.num_threads = opts.num_threads;
+            decInfo.use_aio = opts.use_aio;
+            decInfo.progress = report_decode_stage;
+            decInfo.use_range = opts.use_range;
+            decInfo.range_offset = opts.range_offset;
+            decInfo.range_length = opts.range_length;
 
             // Validate decoding arguments
             if(read_and_validate_decode_args(argv, &decInfo) == e_success)
@@ -68,13 +526,23 @@ int main(int argc, char *argv[])
                 printf("Successful Reading and Validating\n");
 
                 // Perform the decoding process
-                if(do_decoding(&decInfo) == e_success)
+                printf("Decoding Started...\n");
+                start_stats(&opts);
+                Status status = do_decoding(&decInfo);
+                finish_stats(&opts, "decode", status, decInfo.stage);
+                release_decode_info(&decInfo);
+
+                if(status == e_success)
                 {
                     printf("Decoding Successful\n");
                 }
                 else
                 {
+                    printf("%s Failed...\n", decode_messages[decInfo.stage]);
+                    if (decInfo.stage == e_stage_data && (decInfo.d_flags & FRAME_FLAG_ARCHIVE))
+                        printf("Image Holds an Archive: Use -l or -x\n");
                     printf("Decoding Failed\n");
+                    return e_failure;
                 }
             }
             else
@@ -88,8 +556,16 @@ int main(int argc, char *argv[])
             // Handle invalid operation type
             printf("Invalid Option\n");
             printf("---------------------------------Options---------------------------------\n");
-            printf("Encoding: ./a.out -e beautiful.bmp secret.txt stego.bmp\n");
-            printf("Decoding: ./a.out -d stego.bmp decode.txt\n");
+            printf("Encoding: ./a.out -e beautiful.bmp secret.txt stego.bmp [--depth K] [--index|--compress] [--checksum]\n");
+            printf("Decoding: ./a.out -d stego.bmp decode.txt [--range OFF:LEN]\n");
+            printf("Batch:    ./a.out -b manifest.txt [--threads N] [--depth K]\n");
+            printf("Archive:  ./a.out -a beautiful.bmp stego.bmp file... [--depth K]\n");
+            printf("List:     ./a.out -l stego.bmp\n");
+            printf("Extract:  ./a.out -x stego.bmp member [output]\n");
+            printf("Probe:    ./a.out -p image.bmp|directory... [--threads N]\n");
+            printf("Shard:    ./a.out -s secret.txt stego_prefix beautiful.bmp... [--threads N] [--depth K]\n");
+            printf("Join:     ./a.out -j output.txt shard.bmp... [--threads N]\n");
+            printf("Daemon:   ./a.out --serve socket_path [--threads N] [--mmap] [--aio] [--cover-cache MB]\n");
             printf("-------------------------------------------------------------------------\n");
         }
     }
@@ -113,6 +589,34 @@ OperationType check_operation_type(char *argv[])
     {
         return e_decode;
     }
+    else if(strcmp(argv[1],"-b") == 0)
+    {
+        return e_batch;
+    }
+    else if(strcmp(argv[1],"-a") == 0)
+    {
+        return e_archive;
+    }
+    else if(strcmp(argv[1],"-l") == 0)
+    {
+        return e_list;
+    }
+    else if(strcmp(argv[1],"-x") == 0)
+    {
+        return e_extract;
+    }
+    else if(strcmp(argv[1],"-p") == 0)
+    {
+        return e_probe;
+    }
+    else if(strcmp(argv[1],"-s") == 0)
+    {
+        return e_shard;
+    }
+    else if(strcmp(argv[1],"-j") == 0)
+    {
+        return e_join;
+    }
     else
     {
         return e_unsupported;
@@ -7,7 +7,10 @@
  * - A type alias `uint` for unsigned integers.
  * - A `Status` enumeration to represent success or failure of operations.
  * - An `OperationType` enumeration to differentiate between encoding, 
- *   decoding, and unsupported operations.
+ *   decoding, batch, archive, shard, and unsupported operations.
+ * - A `Stage` enumeration naming the steps of encoding and decoding, used to
+ *   report progress and to tell which step failed.
+ * - The callbacks through which the library reports progress and messages.
 */
 
 #ifndef TYPES_H
@@ -28,7 +31,42 @@ typedef enum
 {
     e_encode,      // Encoding operation
     e_decode,      // Decoding operation
+    e_batch,       // Batch of encode/decode jobs from a manifest
+    e_archive,     // Pack several files into one image
+    e_list,        // List the members of an archive
+    e_extract,     // Extract one member of an archive
+    e_probe,       // Check images for a payload without decoding it
+    e_shard,       // Split one file across several images
+    e_join,        // Reassemble a file from its shard images
     e_unsupported  // Unsupported operation
 } OperationType;
 
+/* Enumeration for the encoding/decoding stages (decoding uses a subset) */
+typedef enum
+{
+    e_stage_open,       // Opening/mapping the files
+    e_stage_capacity,   // Image capacity check
+    e_stage_header,     // BMP header copy
+    e_stage_magic,      // Magic string
+    e_stage_extn_size,  // Secret file extension size
+    e_stage_extn,       // Secret file extension
+    e_stage_size,       // Secret file size
+    e_stage_index,      // Chunk index (indexed payloads only)
+    e_stage_directory,  // Archive directory (archives only)
+    e_stage_data,       // Secret file data
+    e_stage_tail,       // Remaining image data copy
+    e_stage_count
+} Stage;
+
+/* Called after each stage that completed successfully */
+typedef void (*StageCallback)(Stage stage, void *arg);
+
+/*
+ * Called with each line a multi-job mode reports (see report.h), possibly
+ * from several worker threads at once. error is nonzero for failures of
+ * the run itself (a path that cannot be read, a malformed manifest line)
+ * and zero for job results and summaries.
+*/
+typedef void (*MessageCallback)(int error, const char *message, void *arg);
+
 #endif